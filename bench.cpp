@@ -0,0 +1,215 @@
+// Benchmark suite : sweeps scene sizes, resolutions and thread counts and prints the results as JSON.
+//
+
+// ReSharper disable CppUseAuto
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "builder.h"
+#include "render.h"
+#include "scene.h"
+#include "scenes.h"
+#include "scheduler.h"
+
+using namespace std;
+
+struct Resolution {
+    int width, height;
+};
+
+struct BenchConfig {
+    vector<int> sizes = {5, 10, 15, 30}; // n of n_sphere_scene, 1000 to 216000 spheres
+    vector<Resolution> resolutions = {{1920, 1080}};
+    vector<unsigned> threads = {max(1u, thread::hardware_concurrency())};
+    int frames = 10;
+    int warmup = 1;
+    BuildOptions options;
+    int width = 2;
+    bool packets = false;
+    string output;
+};
+
+// Nearest rank percentile of sorted values
+double percentile(const vector<double> &sorted, const double p) {
+    const size_t rank = static_cast<size_t>(ceil(p / 100.0 * static_cast<double>(sorted.size())));
+    return sorted[min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+// Peak resident set size of the process so far, over every scene benched until now
+long peak_rss_kb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // Kilobytes on Linux
+}
+
+template<typename T, typename Parse>
+vector<T> parse_list(const string &list, Parse parse) {
+    vector<T> values;
+    stringstream stream(list);
+    for (string item; getline(stream, item, ',');) {
+        values.push_back(parse(item));
+    }
+    return values;
+}
+
+Resolution parse_resolution(const string &resolution) {
+    const size_t x = resolution.find('x');
+    if (x == string::npos) {
+        throw invalid_argument("Bad resolution " + resolution + " (expected WIDTHxHEIGHT)");
+    }
+    return {stoi(resolution.substr(0, x)), stoi(resolution.substr(x + 1))};
+}
+
+// Rays traced by a frame : one primary ray per pixel, then one shadow ray per light from every primary hit
+size_t rays_per_frame(const Scene &S, const Camera &camera, const vector<Tile> &tiles, TaskScheduler &scheduler) {
+    vector<size_t> hits(tiles.size(), 0);
+    scheduler.run(tiles.size(), [&](const size_t t, unsigned) {
+        for (int i = tiles[t].i0; i < tiles[t].i1; i++) {
+            for (int j = tiles[t].j0; j < tiles[t].j1; j++) {
+                hits[t] += intersect(S, camera.primaryRay(i, j)).has_value();
+            }
+        }
+    });
+    size_t rays = static_cast<size_t>(camera.width) * camera.height;
+    for (const size_t h : hits) {
+        rays += h * S.lights.size();
+    }
+    return rays;
+}
+
+// Times frames of the scene at one resolution on one thread count, appends a JSON object to json
+void bench_render(const Scene &S, const BenchConfig &config, const Resolution resolution, const unsigned threads, ostream &json) {
+    const Camera camera = Camera(resolution.width, resolution.height);
+    const vector<Tile> tiles = make_tiles(resolution.width, resolution.height);
+    vector<float> framebuffer(static_cast<size_t>(resolution.width) * resolution.height * 3);
+    TaskScheduler scheduler(threads);
+    // Counted apart, the timed frames run the renderer as is
+    const double rays = static_cast<double>(rays_per_frame(S, camera, tiles, scheduler));
+
+    const auto frame = [&] {
+        scheduler.run(tiles.size(), [&](const size_t t, unsigned) {
+            render_tile(S, camera, tiles[t], framebuffer.data(), config.packets);
+        });
+    };
+
+    for (int a = 0; a < config.warmup; a++) {
+        frame();
+    }
+    vector<double> frame_ms;
+    for (int a = 0; a < config.frames; a++) {
+        const auto begin = chrono::steady_clock::now();
+        frame();
+        frame_ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count());
+    }
+
+    double mean = 0.0;
+    for (const double ms : frame_ms) {
+        mean += ms / static_cast<double>(frame_ms.size());
+    }
+    sort(frame_ms.begin(), frame_ms.end());
+
+    json << "{\"resolution\": [" << resolution.width << ", " << resolution.height << "], "
+         << "\"threads\": " << threads << ", "
+         << "\"frame_ms\": {\"mean\": " << mean << ", \"min\": " << frame_ms.front()
+         << ", \"p50\": " << percentile(frame_ms, 50) << ", \"p90\": " << percentile(frame_ms, 90)
+         << ", \"p99\": " << percentile(frame_ms, 99) << ", \"max\": " << frame_ms.back() << "}, "
+         << "\"rays_per_frame\": " << static_cast<size_t>(rays) << ", "
+         << "\"mrays_per_s\": " << rays / mean / 1000.0 << "}";
+
+    cerr << "  " << resolution.width << "x" << resolution.height << " on " << threads << " threads : "
+         << mean << " ms per frame, " << rays / mean / 1000.0 << " Mrays/s" << endl;
+}
+
+int main(int argc, char * argv[]) {
+    BenchConfig config;
+    try {
+        for (int i = 1; i < argc; i++) {
+            const string arg = argv[i];
+            if (arg == "--sizes" && i + 1 < argc) {
+                config.sizes = parse_list<int>(argv[++i], [](const string &s) { return stoi(s); });
+            } else if (arg == "--resolutions" && i + 1 < argc) {
+                config.resolutions = parse_list<Resolution>(argv[++i], parse_resolution);
+            } else if (arg == "--threads" && i + 1 < argc) {
+                config.threads = parse_list<unsigned>(argv[++i], [](const string &s) { return static_cast<unsigned>(max(1, stoi(s))); });
+            } else if (arg == "--frames" && i + 1 < argc) {
+                config.frames = max(1, stoi(argv[++i]));
+            } else if (arg == "--warmup" && i + 1 < argc) {
+                config.warmup = max(0, stoi(argv[++i]));
+            } else if (arg == "--builder" && i + 1 < argc) {
+                const string method = argv[++i];
+                if (method != "median" && method != "sah" && method != "lbvh") {
+                    throw invalid_argument("Unknown builder " + method + " (expected median, sah or lbvh)");
+                }
+                config.options.method = method == "median" ? BuildMethod::Median : method == "sah" ? BuildMethod::SAH : BuildMethod::Linear;
+            } else if (arg == "--treelets" && i + 1 < argc) {
+                config.options.treelet_passes = max(0, stoi(argv[++i]));
+            } else if (arg == "--width" && i + 1 < argc) {
+                config.width = stoi(argv[++i]);
+            } else if (arg == "--packets") {
+                config.packets = true;
+            } else if (arg == "--output" && i + 1 < argc) {
+                config.output = argv[++i];
+            } else {
+                throw invalid_argument("Unknown argument " + arg);
+            }
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        cerr << "Usage : " << argv[0] << " [--sizes n,n,...] [--resolutions WxH,...] [--threads t,t,...] [--frames f] [--warmup f]"
+             << " [--builder median|sah|lbvh] [--treelets passes] [--width 2|4|8] [--packets] [--output file.json]" << endl;
+        return 1;
+    }
+
+    // The build uses as many threads as the largest run
+    config.options.threads = *max_element(config.threads.begin(), config.threads.end());
+
+    stringstream json;
+    json << "{\n  \"version\": 2,\n"
+         << "  \"hardware_threads\": " << thread::hardware_concurrency() << ",\n"
+         << "  \"builder\": \"" << build_method_name(config.options.method) << "\",\n"
+         << "  \"treelet_passes\": " << config.options.treelet_passes << ",\n"
+         << "  \"width\": " << config.width << ",\n"
+         << "  \"packets\": " << (config.packets ? "true" : "false") << ",\n"
+         << "  \"frames\": " << config.frames << ",\n"
+         << "  \"scenes\": [";
+
+    for (size_t s = 0; s < config.sizes.size(); s++) {
+        const int n = config.sizes[s];
+        BuildStats stats;
+        Scene S = n_sphere_scene(n, config.options, &stats);
+        const int width = config.width != 2 ? S.useWideHierarchy(config.width) : 2;
+
+        cerr << 8 * n * n * n << " spheres, BVH built in " << stats.build_ms << " ms" << endl;
+        json << (s > 0 ? "," : "") << "\n    {\"spheres\": " << 8 * n * n * n << ", "
+             << "\"build_ms\": " << stats.build_ms << ", \"build_threads\": " << config.options.threads << ", "
+             << "\"nodes\": " << stats.nodes << ", \"leaves\": " << stats.leaves << ", \"sah_cost\": " << stats.sah_cost << ", "
+             << "\"traversal_width\": " << width << ",\n     \"runs\": [";
+
+        bool first = true;
+        for (const Resolution resolution : config.resolutions) {
+            for (const unsigned threads : config.threads) {
+                json << (first ? "" : ",") << "\n       ";
+                bench_render(S, config, resolution, threads, json);
+                first = false;
+            }
+        }
+        json << "\n     ]}";
+    }
+    // The high-water mark of the whole run, that of the largest scene : the process never gives memory back
+    json << "\n  ],\n  \"cumulative_peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+
+    if (config.output.empty()) {
+        cout << json.str();
+    } else {
+        ofstream(config.output) << json.str();
+    }
+}
@@ -5,6 +5,9 @@
 #ifndef AABB_H
 #define AABB_H
 
+#include <algorithm>
+#include <optional>
+
 #include "ray.h"
 
 enum Axis { X, Y, Z };
@@ -25,6 +28,20 @@ struct  AABB {
 
     AABB(Point pmin, Point pmax) : pmin(pmin), pmax(pmax) {}
 
+    // Inverted box, neutral element of unionAABB
+    static AABB empty() {
+      return {Point{INFINITY, INFINITY, INFINITY}, Point{-INFINITY, -INFINITY, -INFINITY}};
+    }
+
+    [[nodiscard]] AABB unionPoint(const Point &p) const {
+      return {this->pmin.minp(p), this->pmax.maxp(p)};
+    }
+
+    [[nodiscard]] float area() const {
+      const Direction d = this->pmax - this->pmin;
+      return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
     [[nodiscard]] AABB unionAABB(const AABB &other) const {
       return {this->pmin.minp(other.pmin), this->pmax.maxp(other.pmax)};
     };
@@ -39,7 +56,8 @@ struct  AABB {
     }
 };
 
-inline optional<float> intersect_aabb(const AABB &cube, const Ray &ray) {
+// Entry distance of the ray in the box, if the box is between the ray origin and tfar
+inline optional<float> intersect_aabb(const AABB &cube, const Ray &ray, const float tfar = INFINITY) {
 
   // X slab
   const float tx1 = (cube.pmin.x - ray.origin.x) * ray.inv_direction.x;
@@ -62,7 +80,8 @@ inline optional<float> intersect_aabb(const AABB &cube, const Ray &ray) {
   const float tminpp = max(tminp, min(tz1, tz2));
   const float tmaxpp = min(tmaxp, max(tz1, tz2));
 
-  if(tmaxpp < tminpp){
+  // Box behind the origin or beyond tfar
+  if(tmaxpp < tminpp || tmaxpp < 0.0f || tminpp > tfar){
     return nullopt;
   }else{
     return tminpp;
@@ -0,0 +1,135 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef ANTIALIAS_H
+#define ANTIALIAS_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include "util.h"
+#include "scene.h"
+#include "render.h"
+#include "stats.h"
+
+using namespace std;
+
+// Adaptive antialiasing : once every pixel has its base sample (render_tile), only the pixels that differ from a
+// neighbour get more samples, 4 at a time, until they agree with each other or the per pixel budget is spent.
+// Flat areas keep their single sample, so the cost follows the length of the edges rather than the image size.
+
+struct AntialiasOptions {
+    int max_samples = 16; // Per pixel, rounded down to a multiple of 4 up to 16, less than 4 turning antialiasing off
+    float threshold = 0.02f; // Largest channel difference (over 255) tolerated between neighbours or between samples
+};
+
+struct AntialiasStats {
+    uint64_t pixels = 0;
+    uint64_t refined = 0; // Pixels that got more than their base sample
+    uint64_t samples = 0; // Primary rays, base samples included
+
+    AntialiasStats &operator+=(const AntialiasStats &other) {
+        pixels += other.pixels;
+        refined += other.refined;
+        samples += other.samples;
+        return *this;
+    }
+
+    [[nodiscard]] double samplesPerPixel() const {
+        return pixels > 0 ? static_cast<double>(samples) / static_cast<double>(pixels) : 0.0;
+    }
+};
+
+constexpr int AA_BATCH = 4;
+constexpr int AA_MAX_SAMPLES = 16;
+
+// Offsets (rows, columns) of the samples inside a pixel, on a 4x4 grid.
+// The first one is the corner, where the base sample is, and every batch of 4 spreads over the whole pixel.
+constexpr float AA_OFFSETS[AA_MAX_SAMPLES][2] = {
+    {0.0f, 0.0f}, {0.5f, 0.5f}, {0.0f, 0.5f}, {0.5f, 0.0f},
+    {0.25f, 0.25f}, {0.75f, 0.75f}, {0.25f, 0.75f}, {0.75f, 0.25f},
+    {0.25f, 0.0f}, {0.75f, 0.5f}, {0.25f, 0.5f}, {0.75f, 0.0f},
+    {0.0f, 0.25f}, {0.5f, 0.75f}, {0.0f, 0.75f}, {0.5f, 0.25f},
+};
+
+inline float color_difference(const float * a, const float * b) {
+    return max({abs(a[0] - b[0]), abs(a[1] - b[1]), abs(a[2] - b[2])}) / 255.0f;
+}
+
+// Refines the pixels of tile whose base sample differs from a neighbour's by more than the threshold.
+// base holds the base samples of rows [first_row, last_row[ (laid out like framebuffer), it is only read so that
+// neighbouring tiles can be refined at the same time; refined pixels are written to framebuffer.
+// With RT_STATS, cost receives the traversal cost of the extra samples on top of the base one.
+inline AntialiasStats refine_tile(const Scene &S, const Camera &camera, const Tile &tile, const float * base, float * framebuffer,
+                                  const AntialiasOptions &options, const int first_row, const int last_row, float * cost = nullptr) {
+    const auto offset = [&](const int i, const int j) {
+        return static_cast<size_t>(i - first_row) * camera.width + j;
+    };
+    const int max_samples = min(options.max_samples / AA_BATCH * AA_BATCH, AA_MAX_SAMPLES);
+    const bool count = ray_stats_enabled && cost != nullptr;
+
+    AntialiasStats stats;
+    stats.pixels = tile.pixels();
+    stats.samples = tile.pixels();
+    if (max_samples <= 1) {
+        return stats;
+    }
+
+    for (int i = tile.i0; i < tile.i1; i++) {
+        for (int j = tile.j0; j < tile.j1; j++) {
+            const float * center = base + offset(i, j) * 3;
+            // Neighbours outside the image or the rendered rows are left out
+            float contrast = 0.0f;
+            if (i > first_row) {
+                contrast = max(contrast, color_difference(center, base + offset(i - 1, j) * 3));
+            }
+            if (i + 1 < last_row) {
+                contrast = max(contrast, color_difference(center, base + offset(i + 1, j) * 3));
+            }
+            if (j > 0) {
+                contrast = max(contrast, color_difference(center, base + offset(i, j - 1) * 3));
+            }
+            if (j + 1 < camera.width) {
+                contrast = max(contrast, color_difference(center, base + offset(i, j + 1) * 3));
+            }
+            if (contrast <= options.threshold) {
+                continue;
+            }
+
+            const uint64_t before = ray_stats_cost();
+            float sum[3] = {center[0], center[1], center[2]};
+            float lowest[3] = {center[0], center[1], center[2]};
+            float highest[3] = {center[0], center[1], center[2]};
+            int samples = 1;
+            while (samples < max_samples) {
+                for (const int last = samples - samples % AA_BATCH + AA_BATCH; samples < last; samples++) {
+                    const Color c = shade(S, intersect(S, camera.primaryRay(i, j, AA_OFFSETS[samples][0], AA_OFFSETS[samples][1])));
+                    const float channels[3] = {c.red, c.green, c.blue};
+                    for (int k = 0; k < 3; k++) {
+                        sum[k] += channels[k];
+                        lowest[k] = min(lowest[k], channels[k]);
+                        highest[k] = max(highest[k], channels[k]);
+                    }
+                }
+                // Samples that agree mean the edge barely crosses the pixel
+                if (color_difference(lowest, highest) <= options.threshold) {
+                    break;
+                }
+            }
+
+            float * pixel = framebuffer + offset(i, j) * 3;
+            for (int k = 0; k < 3; k++) {
+                pixel[k] = sum[k] / static_cast<float>(samples);
+            }
+            stats.refined++;
+            stats.samples += samples - 1;
+            if (count) {
+                cost[offset(i, j)] += static_cast<float>(ray_stats_cost() - before);
+            }
+        }
+    }
+    return stats;
+}
+
+#endif //ANTIALIAS_H
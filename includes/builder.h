@@ -0,0 +1,323 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "AABB.h"
+#include "intersection.h"
+#include "lbvh.h"
+
+using namespace std;
+
+enum class BuildMethod { Median, SAH, Linear };
+
+struct BuildOptions {
+    BuildMethod method = BuildMethod::SAH;
+    int bins = 16; // Candidate split planes per axis for the SAH builder
+    int treelet_passes = 0; // Treelet restructuring passes after a linear build (see lbvh.h)
+    float traversal_cost = 1.0f; // Relative cost of one node visit against one sphere test
+    float intersection_cost = 1.0f;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+};
+
+inline const char * build_method_name(const BuildMethod method) {
+    switch (method) {
+        case BuildMethod::Median:
+            return "median";
+        case BuildMethod::SAH:
+            return "sah";
+        case BuildMethod::Linear:
+            return "lbvh";
+    }
+    return "";
+}
+
+struct BuildStats {
+    double build_ms = 0.0;
+    float sah_cost = 0.0f;
+    size_t nodes = 0;
+    size_t leaves = 0;
+};
+
+// Expected cost of a ray hitting the root, the probability of visiting a node being its area over the root's one
+inline float sah_cost(const ObjectHierarchy &hierarchy, const float traversal_cost = 1.0f, const float intersection_cost = 1.0f) {
+    if (hierarchy.nodes.empty()) {
+        return 0.0f;
+    }
+
+    const float root_area = hierarchy.nodes[0].aabb.area();
+    float cost = 0.0f;
+    for (const HierarchyNode &node : hierarchy.nodes) {
+        const float probability = root_area > 0.0f ? node.aabb.area() / root_area : 1.0f;
+        cost += probability * (node.isLeaf() ? intersection_cost * static_cast<float>(node.count) : traversal_cost);
+    }
+    return cost;
+}
+
+// --- Median builder ---
+
+inline bool compare_sphere_X(const Sphere &s1, const Sphere &s2) {
+    return s1.center.x < s2.center.x;
+}
+inline bool compare_sphere_Y(const Sphere &s1, const Sphere &s2) {
+    return s1.center.y < s2.center.y;
+}
+inline bool compare_sphere_Z(const Sphere &s1, const Sphere &s2) {
+    return s1.center.z < s2.center.z;
+}
+
+// Builds the subtree of the spheres listed in hierarchy.indices[begin, end[ and returns the index of its root
+inline uint32_t build_median_node(ObjectHierarchy &hierarchy, const size_t begin, const size_t end) {
+    const Storage<Sphere> &spheres = hierarchy.spheres;
+    const auto first = hierarchy.indices.begin() + static_cast<ptrdiff_t>(begin);
+    const auto last = hierarchy.indices.begin() + static_cast<ptrdiff_t>(end);
+
+    // Creating the smallest bounding box that contains all the spheres
+    AABB aabb = sphere_to_aabb(spheres[*first]);
+    for (auto sphere = first; sphere != last; ++sphere) {
+        aabb = aabb.unionAABB(sphere_to_aabb(spheres[*sphere]));
+    }
+
+    const auto index = static_cast<uint32_t>(hierarchy.nodes.size());
+
+    if (end - begin < LEAF_SIZE){
+        hierarchy.nodes.emplace_back(aabb, static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin)); // Leaf
+        return index;
+    }
+
+    // Only the median has to be in place, each half is ordered by its own subtree
+    const size_t cut = begin + (end - begin) / 2;
+    const auto middle = hierarchy.indices.begin() + static_cast<ptrdiff_t>(cut);
+    const auto by = [&](bool (*compare)(const Sphere &, const Sphere &)) {
+        return [&spheres, compare](const uint32_t a, const uint32_t b) {
+            return compare(spheres[a], spheres[b]);
+        };
+    };
+    switch (aabb.largestAxis()) {
+        case Axis::X:
+            nth_element(first, middle, last, by(compare_sphere_X));
+            break;
+        case Axis::Y:
+            nth_element(first, middle, last, by(compare_sphere_Y));
+            break;
+        case Axis::Z:
+            nth_element(first, middle, last, by(compare_sphere_Z));
+            break;
+    }
+
+    hierarchy.nodes.emplace_back(aabb, 0, 0); // Node, second child index is known once the first subtree is built
+
+    build_median_node(hierarchy, begin, cut);
+    hierarchy.nodes[index].offset = build_median_node(hierarchy, cut, end);
+
+    return index;
+}
+
+// --- Binned SAH builder ---
+
+// Below this many spheres, spawning a task costs more than it saves
+constexpr size_t SAH_PARALLEL_THRESHOLD = 4096;
+// Median splits below it need at most 32 more levels
+constexpr int SAH_MAX_DEPTH = HIERARCHY_MAX_DEPTH - 40;
+
+struct SAHBuilder {
+    const BuildOptions &options;
+    vector<AABB> bounds; // Per sphere, in input order
+    vector<Point> centroids;
+    vector<uint32_t> indices; // Partitioned in place, leaves are ranges of it
+
+    // Appends the subtree of indices[begin, end[ to nodes, child offsets being relative to base
+    void build(const size_t begin, const size_t end, vector<HierarchyNode> &nodes, const uint32_t base, const unsigned threads, const int depth = 0) {
+        AABB aabb = AABB::empty();
+        AABB centroid_bounds = AABB::empty();
+        for (size_t i = begin; i < end; i++) {
+            aabb = aabb.unionAABB(bounds[indices[i]]);
+            centroid_bounds = centroid_bounds.unionPoint(centroids[indices[i]]);
+        }
+
+        const auto index = static_cast<uint32_t>(nodes.size());
+        const size_t count = end - begin;
+        const float leaf_cost = options.intersection_cost * static_cast<float>(count);
+
+        // Best split over all axes
+        int best_axis = -1;
+        int best_bin = 0;
+        float best_cost = INFINITY;
+
+        if (count > 1) {
+            const int bins = max(2, options.bins);
+            vector<AABB> bin_bounds(bins, AABB::empty());
+            vector<size_t> bin_counts(bins);
+            vector<float> right_areas(bins);
+
+            for (int axis = 0; axis < 3; axis++) {
+                const float cmin = centroid_bounds.pmin[axis];
+                const float extent = centroid_bounds.pmax[axis] - cmin;
+                if (extent <= 0.0f) {
+                    continue;
+                }
+                const float scale = static_cast<float>(bins) / extent;
+
+                fill(bin_bounds.begin(), bin_bounds.end(), AABB::empty());
+                fill(bin_counts.begin(), bin_counts.end(), 0);
+                for (size_t i = begin; i < end; i++) {
+                    const int bin = min(bins - 1, static_cast<int>((centroids[indices[i]][axis] - cmin) * scale));
+                    bin_bounds[bin] = bin_bounds[bin].unionAABB(bounds[indices[i]]);
+                    bin_counts[bin]++;
+                }
+
+                // Right sweep for areas, left sweep to evaluate each plane (the split is after bin i)
+                AABB right = AABB::empty();
+                for (int i = bins - 1; i > 0; i--) {
+                    right = right.unionAABB(bin_bounds[i]);
+                    right_areas[i] = right.area();
+                }
+                AABB left = AABB::empty();
+                size_t left_count = 0;
+                for (int i = 0; i < bins - 1; i++) {
+                    left = left.unionAABB(bin_bounds[i]);
+                    left_count += bin_counts[i];
+                    const size_t right_count = count - left_count;
+                    if (left_count == 0 || right_count == 0) {
+                        continue;
+                    }
+                    const float cost = static_cast<float>(left_count) * left.area() + static_cast<float>(right_count) * right_areas[i + 1];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = i;
+                    }
+                }
+            }
+            best_cost = options.traversal_cost + options.intersection_cost * best_cost / aabb.area();
+        }
+
+        // Leaves stay under LEAF_SIZE so they fit the leaf intersection loop
+        if (count == 1 || (count < LEAF_SIZE && leaf_cost <= best_cost)) {
+            nodes.emplace_back(aabb, static_cast<uint32_t>(begin), static_cast<uint32_t>(count)); // Leaf
+            return;
+        }
+
+        size_t cut;
+        if (best_axis < 0 || depth >= SAH_MAX_DEPTH) {
+            // Every centroid at the same place, any split is as good as another.
+            // Past SAH_MAX_DEPTH, median splits keep the tree within the traversal stack.
+            cut = begin + count / 2;
+        } else {
+            const float cmin = centroid_bounds.pmin[best_axis];
+            const float scale = static_cast<float>(max(2, options.bins)) / (centroid_bounds.pmax[best_axis] - cmin);
+            const int bins = max(2, options.bins);
+            const auto middle = partition(indices.begin() + static_cast<ptrdiff_t>(begin), indices.begin() + static_cast<ptrdiff_t>(end), [&](const uint32_t i) {
+                return min(bins - 1, static_cast<int>((centroids[i][best_axis] - cmin) * scale)) <= best_bin;
+            });
+            cut = static_cast<size_t>(middle - indices.begin());
+            if (cut == begin || cut == end) {
+                cut = begin + count / 2;
+            }
+        }
+
+        nodes.emplace_back(aabb, 0, 0); // Node
+
+        if (threads > 1 && count >= SAH_PARALLEL_THRESHOLD) {
+            // The second subtree is built on its own node list, then appended after the first one
+            vector<HierarchyNode> right_nodes;
+            auto right_task = async(launch::async, [&] {
+                build(cut, end, right_nodes, 0, threads / 2, depth + 1);
+            });
+            build(begin, cut, nodes, base, threads - threads / 2, depth + 1);
+            right_task.get();
+
+            const auto right_index = static_cast<uint32_t>(nodes.size());
+            nodes[index].offset = base + right_index;
+            for (HierarchyNode node : right_nodes) {
+                if (!node.isLeaf()) {
+                    node.offset += base + right_index;
+                }
+                nodes.push_back(node);
+            }
+        } else {
+            build(begin, cut, nodes, base, 1, depth + 1);
+            nodes[index].offset = base + static_cast<uint32_t>(nodes.size());
+            build(cut, end, nodes, base, 1, depth + 1);
+        }
+    }
+};
+
+inline void build_sah(ObjectHierarchy &hierarchy, const BuildOptions &options) {
+    const size_t n = hierarchy.spheres.size();
+
+    SAHBuilder builder{options, {}, {}, {}};
+    builder.bounds.reserve(n);
+    builder.centroids.reserve(n);
+    builder.indices.assign(hierarchy.indices.begin(), hierarchy.indices.end());
+    for (uint32_t i = 0; i < n; i++) {
+        builder.bounds.push_back(sphere_to_aabb(hierarchy.spheres[i]));
+        builder.centroids.push_back(hierarchy.spheres[i].center);
+    }
+
+    const unsigned threads = static_cast<unsigned>(min<size_t>(options.threads, max<size_t>(1, n / SAH_PARALLEL_THRESHOLD)));
+    vector<HierarchyNode> nodes;
+    builder.build(0, n, nodes, 0, max(1u, threads));
+    hierarchy.nodes = std::move(nodes);
+    hierarchy.indices = std::move(builder.indices);
+}
+
+inline ObjectHierarchy build_hierarchy(vector<Sphere> spheres, const BuildOptions &options = {}, BuildStats * stats = nullptr) {
+    const auto begin = chrono::steady_clock::now();
+
+    ObjectHierarchy hierarchy;
+    hierarchy.spheres = std::move(spheres);
+    vector<uint32_t> indices(hierarchy.spheres.size());
+    for (uint32_t i = 0; i < indices.size(); i++) {
+        indices[i] = i;
+    }
+    hierarchy.indices = std::move(indices);
+
+    if (!hierarchy.spheres.empty()) {
+        switch (options.method) {
+            case BuildMethod::Median:
+                // A binary tree with leaves of at least LEAF_SIZE / 2 spheres never needs more nodes than that
+                hierarchy.nodes.reserve(2 * (hierarchy.spheres.size() / (LEAF_SIZE / 2) + 1));
+                build_median_node(hierarchy, 0, hierarchy.spheres.size());
+                break;
+            case BuildMethod::SAH:
+                build_sah(hierarchy, options);
+                break;
+            case BuildMethod::Linear:
+                build_lbvh(hierarchy, options.threads, options.treelet_passes, options.traversal_cost, options.intersection_cost);
+                break;
+        }
+        hierarchy.nodes.shrink_to_fit();
+
+        // Spheres are finally stored in leaf order
+        vector<Sphere> ordered;
+        ordered.reserve(hierarchy.spheres.size());
+        for (const uint32_t i : hierarchy.indices) {
+            ordered.push_back(hierarchy.spheres[i]);
+        }
+        hierarchy.spheres = std::move(ordered);
+    }
+    hierarchy.updateArrays();
+
+    if (stats != nullptr) {
+        stats->build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        stats->sah_cost = sah_cost(hierarchy, options.traversal_cost, options.intersection_cost);
+        stats->nodes = hierarchy.nodes.size();
+        stats->leaves = static_cast<size_t>(count_if(hierarchy.nodes.begin(), hierarchy.nodes.end(), [](const HierarchyNode &node) {
+            return node.isLeaf();
+        }));
+    }
+
+    return hierarchy;
+}
+
+#endif //BUILDER_H
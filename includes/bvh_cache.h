@@ -0,0 +1,249 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#include "builder.h"
+#include "intersection.h"
+#include "mapped_file.h"
+#include "simd.h"
+
+using namespace std;
+
+// Built hierarchies saved to disk and mapped back in place of a rebuild.
+// The file holds the nodes, the spheres in leaf order with their input positions and their structure of arrays copy,
+// each array 64 byte aligned.
+// Nodes only refer to each other and to spheres by index, so the file can be mapped anywhere.
+// It is named after a hash of the input spheres and of the build settings : any change gives another file.
+
+constexpr char BVH_CACHE_MAGIC[8] = {'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0'};
+// To be increased whenever the builders or the layout of the file change
+constexpr uint32_t BVH_CACHE_VERSION = 2;
+constexpr uint64_t BVH_CACHE_ALIGNMENT = 64;
+
+static_assert(is_trivially_copyable_v<HierarchyNode> && sizeof(HierarchyNode) == 32, "HierarchyNode is stored as is in cache files");
+static_assert(is_trivially_copyable_v<Sphere>, "Sphere is stored as is in cache files");
+
+struct BVHCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size; // sizeof(HierarchyNode) when the file was written
+    uint32_t sphere_size;
+    uint32_t padding; // LEAF_KERNEL_PADDING
+    uint64_t key;
+    uint64_t node_count;
+    uint64_t node_offset;
+    uint64_t sphere_count;
+    uint64_t sphere_offset;
+    uint64_t indices_offset; // sphere_count uint32_t
+    uint64_t array_offset[4]; // x, y, z, radius2, sphere_count + padding floats each
+    float sah_cost;
+    uint32_t leaves;
+};
+
+// 64 bit hash, 8 bytes at a time so that hashing millions of spheres stays cheap next to mapping them
+inline uint64_t hash_bytes(const void * data, const size_t size, uint64_t hash = 0x9e3779b97f4a7c15ull) {
+    const auto * bytes = static_cast<const uint8_t *>(data);
+    const auto mix = [&](const uint64_t word) {
+        hash ^= word;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    };
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        mix(word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, size - i);
+    mix(tail ^ size);
+    return hash;
+}
+
+// Identifies what the builder would produce : input spheres, settings changing the tree and format version.
+// The thread count does not change the tree and is left out.
+inline uint64_t hierarchy_key(const span<const Sphere> spheres, const BuildOptions &options) {
+    const int settings[] = {static_cast<int>(BVH_CACHE_VERSION), static_cast<int>(options.method), options.bins, options.treelet_passes, LEAF_SIZE, HIERARCHY_MAX_DEPTH};
+    const float costs[] = {options.traversal_cost, options.intersection_cost};
+    uint64_t key = hash_bytes(settings, sizeof settings);
+    key = hash_bytes(costs, sizeof costs, key);
+    return hash_bytes(spheres.data(), spheres.size_bytes(), key);
+}
+
+inline string hierarchy_cache_path(const string &directory, const uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof name, "%016llx.rtbvh", static_cast<unsigned long long>(key));
+    return (filesystem::path(directory) / name).string();
+}
+
+// The cache file of hierarchy, written to out from its start
+inline void write_hierarchy(ostream &out, const ObjectHierarchy &hierarchy, const uint64_t key, const BuildStats &stats) {
+    const auto align = [](const uint64_t offset) {
+        return (offset + BVH_CACHE_ALIGNMENT - 1) / BVH_CACHE_ALIGNMENT * BVH_CACHE_ALIGNMENT;
+    };
+    const Storage<float> * arrays[4] = {&hierarchy.arrays.x, &hierarchy.arrays.y, &hierarchy.arrays.z, &hierarchy.arrays.radius2};
+
+    BVHCacheHeader header{};
+    memcpy(header.magic, BVH_CACHE_MAGIC, sizeof header.magic);
+    header.version = BVH_CACHE_VERSION;
+    header.node_size = sizeof(HierarchyNode);
+    header.sphere_size = sizeof(Sphere);
+    header.padding = LEAF_KERNEL_PADDING;
+    header.key = key;
+    header.node_count = hierarchy.nodes.size();
+    header.node_offset = align(sizeof header);
+    header.sphere_count = hierarchy.spheres.size();
+    header.sphere_offset = align(header.node_offset + header.node_count * sizeof(HierarchyNode));
+    header.indices_offset = align(header.sphere_offset + header.sphere_count * sizeof(Sphere));
+    uint64_t end = header.indices_offset + header.sphere_count * sizeof(uint32_t);
+    for (int a = 0; a < 4; a++) {
+        header.array_offset[a] = align(end);
+        end = header.array_offset[a] + arrays[a]->size() * sizeof(float);
+    }
+    header.sah_cost = stats.sah_cost;
+    header.leaves = static_cast<uint32_t>(stats.leaves);
+
+    const auto write_at = [&](const uint64_t offset, const void * data, const size_t size) {
+        const vector<char> zeros(offset - static_cast<uint64_t>(out.tellp()), 0);
+        out.write(zeros.data(), static_cast<streamsize>(zeros.size()));
+        out.write(static_cast<const char *>(data), static_cast<streamsize>(size));
+    };
+    write_at(0, &header, sizeof header);
+    write_at(header.node_offset, hierarchy.nodes.data(), header.node_count * sizeof(HierarchyNode));
+    write_at(header.sphere_offset, hierarchy.spheres.data(), header.sphere_count * sizeof(Sphere));
+    write_at(header.indices_offset, hierarchy.indices.data(), header.sphere_count * sizeof(uint32_t));
+    for (int a = 0; a < 4; a++) {
+        write_at(header.array_offset[a], arrays[a]->data(), arrays[a]->size() * sizeof(float));
+    }
+}
+
+inline void save_hierarchy(const string &path, const ObjectHierarchy &hierarchy, const uint64_t key, const BuildStats &stats) {
+    // Written next to its final name then renamed, a concurrent reader never maps half a file.
+    // Processes filling the same cache each write their own file, the last rename wins.
+    const string temporary = path + "." + to_string(getpid()) + ".tmp";
+    {
+        ofstream out(temporary, ios::binary);
+        if (!out) {
+            throw runtime_error("Cannot open " + temporary);
+        }
+        write_hierarchy(out, hierarchy, key, stats);
+        if (!out) {
+            throw runtime_error("Cannot write " + temporary);
+        }
+    }
+    filesystem::rename(temporary, path);
+}
+
+// Whether nodes can be traversed without reading out of bounds : children after their parent and within nodes,
+// leaves within the spheres, no deeper than the traversal stacks
+inline bool valid_hierarchy(const span<const HierarchyNode> nodes, const span<const uint32_t> indices) {
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const HierarchyNode &node = nodes[i];
+        if (node.isLeaf() ? static_cast<uint64_t>(node.offset) + node.count > indices.size()
+                          : i + 1 >= nodes.size() || node.offset <= i + 1 || node.offset >= nodes.size()) {
+            return false;
+        }
+    }
+    for (const uint32_t index : indices) {
+        if (index >= indices.size()) {
+            return false;
+        }
+    }
+    return hierarchy_depth(nodes) <= HIERARCHY_MAX_DEPTH;
+}
+
+// The hierarchy stored at path, read in place from the mapping, if it is a valid cache file for key
+inline optional<ObjectHierarchy> load_hierarchy(const string &path, const uint64_t key, BuildStats * stats = nullptr) {
+    if (!filesystem::exists(path)) {
+        return nullopt;
+    }
+    try {
+        // Traversal reads all over the file, every page is going to be needed
+        const auto file = make_shared<const MappedFile>(path, MADV_WILLNEED);
+        if (file->size() < sizeof(BVHCacheHeader) || memcmp(file->data(), BVH_CACHE_MAGIC, sizeof BVH_CACHE_MAGIC) != 0) {
+            return nullopt;
+        }
+        const BVHCacheHeader &header = *file->array<BVHCacheHeader>(0, 1);
+        if (header.version != BVH_CACHE_VERSION || header.key != key || header.node_size != sizeof(HierarchyNode) ||
+            header.sphere_size != sizeof(Sphere) || header.padding != LEAF_KERNEL_PADDING) {
+            return nullopt;
+        }
+
+        ObjectHierarchy hierarchy;
+        hierarchy.nodes = Storage(file, file->array<HierarchyNode>(header.node_offset, header.node_count), header.node_count);
+        hierarchy.spheres = Storage(file, file->array<Sphere>(header.sphere_offset, header.sphere_count), header.sphere_count);
+        hierarchy.indices = Storage(file, file->array<uint32_t>(header.indices_offset, header.sphere_count), header.sphere_count);
+        Storage<float> * arrays[4] = {&hierarchy.arrays.x, &hierarchy.arrays.y, &hierarchy.arrays.z, &hierarchy.arrays.radius2};
+        const uint64_t array_count = header.sphere_count + header.padding;
+        for (int a = 0; a < 4; a++) {
+            *arrays[a] = Storage(file, file->array<float>(header.array_offset[a], array_count), array_count);
+        }
+        // A damaged file may still carry the right key
+        if (const ObjectHierarchy &mapped = hierarchy; !valid_hierarchy(span(mapped.nodes.data(), mapped.nodes.size()), span(mapped.indices.data(), mapped.indices.size()))) {
+            return nullopt;
+        }
+
+        if (stats != nullptr) {
+            stats->sah_cost = header.sah_cost;
+            stats->nodes = header.node_count;
+            stats->leaves = header.leaves;
+        }
+        return hierarchy;
+    } catch (const runtime_error &) {
+        return nullopt; // Unreadable or truncated, rebuilt and overwritten
+    }
+}
+
+// build_hierarchy going through the cache in directory : mapped when present, built and saved otherwise.
+// cached tells which of the two happened. A cache that cannot be written does not fail the build, save_error receiving why.
+inline ObjectHierarchy build_hierarchy_cached(vector<Sphere> spheres, const string &directory, const BuildOptions &options = {},
+                                              BuildStats * stats = nullptr, bool * cached = nullptr, string * save_error = nullptr) {
+    const auto begin = chrono::steady_clock::now();
+    const uint64_t key = hierarchy_key(spheres, options);
+    const string path = hierarchy_cache_path(directory, key);
+
+    BuildStats local_stats;
+    BuildStats &build_stats = stats != nullptr ? *stats : local_stats;
+
+    if (optional<ObjectHierarchy> hierarchy = load_hierarchy(path, key, &build_stats); hierarchy.has_value()) {
+        build_stats.build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        if (cached != nullptr) {
+            *cached = true;
+        }
+        return std::move(hierarchy.value());
+    }
+
+    ObjectHierarchy hierarchy = build_hierarchy(std::move(spheres), options, &build_stats);
+    try {
+        filesystem::create_directories(directory);
+        save_hierarchy(path, hierarchy, key, build_stats);
+    } catch (const runtime_error &e) {
+        if (save_error != nullptr) {
+            *save_error = e.what();
+        }
+    }
+    if (cached != nullptr) {
+        *cached = false;
+    }
+    return hierarchy;
+}
+
+#endif //BVH_CACHE_H
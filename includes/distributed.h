@@ -0,0 +1,641 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <new>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "builder.h"
+#include "bvh_cache.h"
+#include "image.h"
+#include "light_tree.h"
+#include "render.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "scheduler.h"
+
+using namespace std;
+
+// Frames rendered by several processes, on one machine or over a network, through TCP sockets.
+// A coordinator waits for its workers, ships them the scene once (spheres, or the hierarchy it built as a cache file)
+// then hands out ranges of tiles as workers ask for them : each worker keeps DISTRIBUTED_IN_FLIGHT ranges queued
+// so that it never waits for the network, and faster workers simply get more ranges.
+// Tiles come back quantized and are copied into the image. A worker that leaves has its ranges handed to the others.
+// Messages are the memory layout of the structures, like scene and cache files : every node runs the same build.
+
+// Ranges queued per worker
+constexpr size_t DISTRIBUTED_IN_FLIGHT = 2;
+// Smallest range, in tiles, a range being at least two tiles per worker thread
+constexpr uint32_t DISTRIBUTED_MIN_TILES = 8;
+// A worker the coordinator waits on and does not hear from for this long is given up, its ranges going to the others
+constexpr int DISTRIBUTED_TIMEOUT_MS = 60000;
+
+enum class MessageType : uint32_t {
+    Scene, // Coordinator : RenderJob, lights, then the spheres or a hierarchy cache file
+    Ready, // Worker : WorkerReady
+    Tiles, // Coordinator : first and last tile of a range
+    Pixels, // Worker : first and last tile, then the RGB bytes of the tiles, rows of each tile in turn
+    Done // Coordinator : no more work
+};
+
+struct MessageHeader {
+    MessageType type;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+// Everything a worker needs besides the scene to render the same pixels as the coordinator would
+struct RenderJob {
+    int32_t width;
+    int32_t height;
+    float focal;
+    int32_t bvh_width = 2;
+    int32_t quantize_bits = 0;
+    uint8_t packets = 0;
+    uint8_t cache_occluders = 0;
+    uint8_t light_tree = 0;
+    uint8_t hierarchy_shipped = 0; // A hierarchy cache file follows the lights instead of the spheres
+    BuildOptions build{}; // The worker uses its own thread count
+    LightTreeOptions light_options{};
+    uint64_t sphere_count = 0;
+    uint64_t light_count = 0;
+};
+
+struct WorkerReady {
+    uint32_t threads;
+    float setup_ms; // Receiving the scene and building or loading its hierarchy
+};
+
+static_assert(is_trivially_copyable_v<RenderJob> && is_trivially_copyable_v<WorkerReady>, "Sent as is");
+
+struct WorkerStats {
+    uint32_t threads = 0;
+    double setup_ms = 0.0;
+    size_t ranges = 0;
+    size_t tiles = 0;
+    bool lost = false;
+};
+
+struct DistributedStats {
+    double setup_ms = 0.0; // Until every worker is ready
+    double render_ms = 0.0; // From then to the last tile
+    size_t reassigned_tiles = 0; // Of lost workers
+    vector<WorkerStats> workers;
+};
+
+// --- Sockets ---
+
+class Socket {
+public:
+    Socket() = default;
+
+    explicit Socket(const int fd) : fd(fd) {}
+
+    ~Socket() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+
+    Socket(Socket &&other) noexcept : fd(exchange(other.fd, -1)) {}
+
+    Socket &operator=(Socket &&other) noexcept {
+        if (this != &other) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            fd = exchange(other.fd, -1);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] int get() const {
+        return fd;
+    }
+
+    // Port the socket is bound to, the one picked by the system for port 0
+    [[nodiscard]] uint16_t port() const {
+        sockaddr_in address{};
+        socklen_t length = sizeof address;
+        if (getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) != 0) {
+            throw runtime_error("Cannot read the socket address");
+        }
+        return ntohs(address.sin_port);
+    }
+
+private:
+    int fd = -1;
+};
+
+// Listening on every interface
+inline Socket listen_socket(const uint16_t port, const int backlog = 64) {
+    Socket socket_fd(socket(AF_INET, SOCK_STREAM, 0));
+    if (socket_fd.get() < 0) {
+        throw runtime_error("Cannot create a socket");
+    }
+    const int on = 1;
+    setsockopt(socket_fd.get(), SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(socket_fd.get(), reinterpret_cast<sockaddr *>(&address), sizeof address) != 0 || listen(socket_fd.get(), backlog) != 0) {
+        throw runtime_error("Cannot listen on port " + to_string(port));
+    }
+    return socket_fd;
+}
+
+inline void set_no_delay(const Socket &socket_fd) {
+    // Small range messages go out at once
+    const int on = 1;
+    setsockopt(socket_fd.get(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+}
+
+// Blocking sends and receives give up after ms, a peer stalled in the middle of a message failing them
+inline void set_timeout(const Socket &socket_fd, const int ms) {
+    const timeval timeout{ms / 1000, ms % 1000 * 1000};
+    setsockopt(socket_fd.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    setsockopt(socket_fd.get(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+}
+
+inline Socket accept_socket(const Socket &listener) {
+    Socket peer(accept(listener.get(), nullptr, nullptr));
+    if (peer.get() < 0) {
+        throw runtime_error("Cannot accept a worker");
+    }
+    set_no_delay(peer);
+    return peer;
+}
+
+// Connects to host:port, trying again for retry_ms so that workers may start before their coordinator
+inline Socket connect_socket(const string &host, const uint16_t port, const int retry_ms = 10000) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo * addresses = nullptr;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses) != 0) {
+        throw runtime_error("Cannot resolve " + host);
+    }
+    const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(retry_ms);
+    while (true) {
+        for (const addrinfo * a = addresses; a != nullptr; a = a->ai_next) {
+            Socket socket_fd(socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+            if (socket_fd.get() >= 0 && connect(socket_fd.get(), a->ai_addr, a->ai_addrlen) == 0) {
+                freeaddrinfo(addresses);
+                set_no_delay(socket_fd);
+                return socket_fd;
+            }
+        }
+        if (chrono::steady_clock::now() >= deadline) {
+            freeaddrinfo(addresses);
+            throw runtime_error("Cannot connect to " + host + ":" + to_string(port));
+        }
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+}
+
+inline void send_all(const Socket &socket_fd, const void * data, size_t size) {
+    const auto * bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        const ssize_t sent = send(socket_fd.get(), bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            throw runtime_error("Connection lost while sending");
+        }
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+}
+
+inline void receive_all(const Socket &socket_fd, void * data, size_t size) {
+    auto * bytes = static_cast<uint8_t *>(data);
+    while (size > 0) {
+        const ssize_t received = recv(socket_fd.get(), bytes, size, 0);
+        if (received <= 0) {
+            throw runtime_error("Connection lost while receiving");
+        }
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+}
+
+// --- Messages ---
+
+template<typename T>
+span<const byte> bytes_of(const T &value) {
+    return as_bytes(span<const T>(&value, 1));
+}
+
+inline void send_message(const Socket &socket_fd, const MessageType type, const initializer_list<span<const byte>> parts = {}) {
+    MessageHeader header{type, 0, 0};
+    for (const span<const byte> part : parts) {
+        header.size += part.size();
+    }
+    send_all(socket_fd, &header, sizeof header);
+    for (const span<const byte> part : parts) {
+        send_all(socket_fd, part.data(), part.size());
+    }
+}
+
+// Payload of a received message, read front to back
+class Message {
+public:
+    MessageType type;
+    vector<uint8_t> payload;
+
+    Message(const MessageType type, vector<uint8_t> payload) : type(type), payload(std::move(payload)) {}
+
+    template<typename T>
+    const T * read(const size_t count) {
+        if (count > (payload.size() - position) / sizeof(T)) {
+            throw runtime_error("Truncated message");
+        }
+        const auto * values = reinterpret_cast<const T *>(payload.data() + position);
+        position += count * sizeof(T);
+        return values;
+    }
+
+    template<typename T>
+    T read() {
+        T value;
+        memcpy(&value, read<uint8_t>(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    [[nodiscard]] size_t remaining() const {
+        return payload.size() - position;
+    }
+
+private:
+    size_t position = 0;
+};
+
+// Largest payload accepted for each MessageType, a larger one coming from a corrupted or hostile peer
+using MessageLimits = array<uint64_t, 5>;
+
+// What a worker receives : the scene, which can be as large as the coordinator's memory, then ranges
+constexpr MessageLimits WORKER_MESSAGE_LIMITS = {uint64_t{1} << 40, 0, 2 * sizeof(uint32_t), 0, 0};
+
+// What the coordinator of job receives : readiness, then tiles, a range being at most the whole image
+inline MessageLimits coordinator_message_limits(const RenderJob &job) {
+    return {0, sizeof(WorkerReady), 0, 2 * sizeof(uint32_t) + static_cast<uint64_t>(job.width) * job.height * 3, 0};
+}
+
+inline Message receive_message(const Socket &socket_fd, const MessageLimits &limits) {
+    MessageHeader header{};
+    receive_all(socket_fd, &header, sizeof header);
+    if (header.type > MessageType::Done || header.size > limits[static_cast<size_t>(header.type)]) {
+        throw runtime_error("Corrupted message");
+    }
+    vector<uint8_t> payload;
+    try {
+        payload.resize(header.size);
+    } catch (const bad_alloc &) {
+        // The peer is dropped like any other failing one
+        throw runtime_error("No memory for a message of " + to_string(header.size) + " bytes");
+    }
+    Message message(header.type, std::move(payload));
+    receive_all(socket_fd, message.payload.data(), message.payload.size());
+    return message;
+}
+
+// Settings of the job that are not part of the hierarchy, as main() applies them
+inline void prepare_scene(Scene &scene, const RenderJob &job) {
+    if (job.quantize_bits > 0) {
+        scene.useQuantizedHierarchy(job.bvh_width, job.quantize_bits);
+    } else if (job.bvh_width != 2) {
+        scene.useWideHierarchy(job.bvh_width);
+    }
+    if (job.light_tree) {
+        scene.useLightTree(job.light_options);
+    }
+    scene.cache_occluders = job.cache_occluders;
+}
+
+// --- Worker ---
+
+// Renders the ranges the coordinator at host:port asks for until it is done, returns the number of tiles rendered
+inline size_t run_worker(const string &host, const uint16_t port, const unsigned threads) {
+    const Socket coordinator = connect_socket(host, port);
+    const auto begin = chrono::steady_clock::now();
+
+    Message scene_message = receive_message(coordinator, WORKER_MESSAGE_LIMITS);
+    if (scene_message.type != MessageType::Scene) {
+        throw runtime_error("Expected a scene");
+    }
+    const auto job = scene_message.read<RenderJob>();
+    const Light * lights = scene_message.read<Light>(job.light_count);
+    ObjectHierarchy hierarchy;
+    if (job.hierarchy_shipped) {
+        // Mapped from a file as the cache does it, the file can go once mapped
+        const size_t size = scene_message.remaining();
+        const auto * bytes = scene_message.read<uint8_t>(size);
+        if (size < sizeof(BVHCacheHeader)) {
+            throw runtime_error("Truncated hierarchy");
+        }
+        BVHCacheHeader header{};
+        memcpy(&header, bytes, sizeof header);
+        const string path = (filesystem::temp_directory_path() / ("rt_worker_" + to_string(getpid()) + "_" + to_string(coordinator.get()) + ".rtbvh")).string();
+        {
+            ofstream out(path, ios::binary);
+            out.write(reinterpret_cast<const char *>(bytes), static_cast<streamsize>(size));
+            if (!out) {
+                throw runtime_error("Cannot write " + path);
+            }
+        }
+        optional<ObjectHierarchy> loaded = load_hierarchy(path, header.key);
+        filesystem::remove(path);
+        if (!loaded.has_value()) {
+            throw runtime_error("The shipped hierarchy was written by an incompatible version");
+        }
+        hierarchy = std::move(loaded.value());
+    } else {
+        const Sphere * spheres = scene_message.read<Sphere>(job.sphere_count);
+        BuildOptions options = job.build;
+        options.threads = threads;
+        hierarchy = build_hierarchy(vector<Sphere>(spheres, spheres + job.sphere_count), options);
+    }
+    Scene scene(std::move(hierarchy), vector<Light>(lights, lights + job.light_count));
+    prepare_scene(scene, job);
+    scene_message.payload = vector<uint8_t>{};
+
+    Camera camera(job.width, job.height);
+    camera.focal = job.focal;
+    const vector<Tile> tiles = make_tiles(job.width, job.height);
+    vector<float> framebuffer(static_cast<size_t>(job.width) * job.height * 3);
+    TaskScheduler scheduler(threads);
+
+    const WorkerReady ready{scheduler.threadCount(), static_cast<float>(chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count())};
+    send_message(coordinator, MessageType::Ready, {bytes_of(ready)});
+
+    size_t rendered = 0;
+    vector<uint8_t> rgb;
+    while (true) {
+        Message message = receive_message(coordinator, WORKER_MESSAGE_LIMITS);
+        if (message.type == MessageType::Done) {
+            return rendered;
+        }
+        if (message.type != MessageType::Tiles) {
+            throw runtime_error("Expected tiles");
+        }
+        const auto first = message.read<uint32_t>();
+        const auto last = message.read<uint32_t>();
+        if (first > last || last > tiles.size()) {
+            throw runtime_error("Tiles out of the image");
+        }
+
+        scheduler.run(last - first, [&](const size_t t, unsigned) {
+            render_tile(scene, camera, tiles[first + t], framebuffer.data(), job.packets);
+        });
+        rgb.clear();
+        for (uint32_t t = first; t < last; t++) {
+            const Tile &tile = tiles[t];
+            for (int i = tile.i0; i < tile.i1; i++) {
+                const size_t offset = rgb.size();
+                rgb.resize(offset + static_cast<size_t>(tile.j1 - tile.j0) * 3);
+                quantize(framebuffer.data() + (static_cast<size_t>(i) * job.width + tile.j0) * 3, tile.j1 - tile.j0, rgb.data() + offset);
+            }
+        }
+        send_message(coordinator, MessageType::Pixels, {bytes_of(first), bytes_of(last), as_bytes(span(rgb))});
+        rendered += last - first;
+    }
+}
+
+// --- Coordinator ---
+
+// Renders job with worker_count workers connecting to listener, into rgb (width * height quantized pixels).
+// The workers build the hierarchy of spheres themselves, or map hierarchy when it is given.
+// A worker silent for timeout_ms while it sets up or holds ranges is lost, as one that leaves, and so are the workers
+// still missing timeout_ms after the last one connected : the frame is rendered by those present.
+inline DistributedStats render_distributed(const Socket &listener, const size_t worker_count, const RenderJob &job, const vector<Sphere> &spheres,
+                                           const vector<Light> &lights, uint8_t * rgb, const ObjectHierarchy * hierarchy = nullptr,
+                                           const BuildStats &hierarchy_stats = {}, const int timeout_ms = DISTRIBUTED_TIMEOUT_MS) {
+    const auto begin = chrono::steady_clock::now();
+    RenderJob sent = job;
+    sent.sphere_count = hierarchy != nullptr ? 0 : spheres.size();
+    sent.light_count = lights.size();
+    sent.hierarchy_shipped = hierarchy != nullptr;
+    string hierarchy_file;
+    if (hierarchy != nullptr) {
+        ostringstream out;
+        write_hierarchy(out, *hierarchy, hierarchy_key(spheres, job.build), hierarchy_stats);
+        hierarchy_file = std::move(out).str();
+    }
+
+    struct Worker {
+        Socket socket;
+        deque<pair<uint32_t, uint32_t>> ranges; // Sent and not back yet
+        bool alive = true;
+        bool ready = false;
+        chrono::steady_clock::time_point heard; // Last message, or when it was last given work
+    };
+    vector<Worker> workers(worker_count);
+    DistributedStats stats;
+    stats.workers.resize(worker_count);
+    const MessageLimits limits = coordinator_message_limits(job);
+
+    const vector<Tile> tiles = make_tiles(job.width, job.height);
+    const auto tile_count = static_cast<uint32_t>(tiles.size());
+    uint32_t next_tile = 0;
+    deque<pair<uint32_t, uint32_t>> reassigned; // Ranges of lost workers
+    uint32_t done_tiles = 0;
+    bool all_ready = false;
+    auto render_begin = begin;
+
+    const auto lose = [&](const size_t w) {
+        Worker &worker = workers[w];
+        worker.alive = false;
+        stats.workers[w].lost = true;
+        for (const auto &range : worker.ranges) {
+            reassigned.push_back(range);
+            stats.reassigned_tiles += range.second - range.first;
+        }
+        worker.ranges.clear();
+        worker.socket = Socket();
+    };
+    // Workers [0, accepted[ are connected, the others are awaited until timeout_ms pass without a new one
+    size_t accepted = 0;
+    size_t expected = worker_count;
+    auto accepted_at = begin;
+    const auto accept_worker = [&] {
+        const size_t w = accepted;
+        try {
+            workers[w].socket = accept_socket(listener);
+        } catch (const runtime_error &) {
+            return; // Gave up connecting, the listener stays polled
+        }
+        accepted++;
+        accepted_at = workers[w].heard = chrono::steady_clock::now();
+        set_timeout(workers[w].socket, timeout_ms);
+        // Shipped as each one connects, the next ones may still be starting
+        try {
+            send_message(workers[w].socket, MessageType::Scene,
+                         {bytes_of(sent), as_bytes(span(lights)), hierarchy != nullptr ? as_bytes(span(hierarchy_file)) : as_bytes(span(spheres))});
+        } catch (const runtime_error &) {
+            lose(w);
+        }
+    };
+    const auto feed = [&](const size_t w) {
+        Worker &worker = workers[w];
+        const uint32_t range_tiles = max(DISTRIBUTED_MIN_TILES, 2 * stats.workers[w].threads);
+        while (worker.alive && worker.ready && worker.ranges.size() < DISTRIBUTED_IN_FLIGHT && (!reassigned.empty() || next_tile < tile_count)) {
+            pair<uint32_t, uint32_t> range;
+            if (!reassigned.empty()) {
+                range = reassigned.front();
+                reassigned.pop_front();
+            } else {
+                range = {next_tile, min(tile_count, next_tile + range_tiles)};
+                next_tile = range.second;
+            }
+            if (worker.ranges.empty()) {
+                worker.heard = chrono::steady_clock::now(); // Idle until now
+            }
+            worker.ranges.push_back(range);
+            try {
+                send_message(worker.socket, MessageType::Tiles, {bytes_of(range.first), bytes_of(range.second)});
+            } catch (const runtime_error &) {
+                lose(w);
+            }
+        }
+    };
+
+    const auto waited_on = [](const Worker &worker) {
+        return worker.alive && (!worker.ready || !worker.ranges.empty());
+    };
+    vector<pollfd> polled;
+    vector<size_t> polled_workers;
+    while (done_tiles < tile_count) {
+        polled.clear();
+        polled_workers.clear();
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+        if (accepted < expected) {
+            polled.push_back({listener.get(), POLLIN, 0});
+            polled_workers.push_back(worker_count); // The listener
+            deadline = min(deadline, accepted_at + chrono::milliseconds(timeout_ms));
+        }
+        for (size_t w = 0; w < accepted; w++) {
+            if (workers[w].alive) {
+                polled.push_back({workers[w].socket.get(), POLLIN, 0});
+                polled_workers.push_back(w);
+            }
+            if (waited_on(workers[w])) {
+                deadline = min(deadline, workers[w].heard + chrono::milliseconds(timeout_ms));
+            }
+        }
+        if (polled.empty()) {
+            throw runtime_error(accepted == 0 ? "No worker connected" : "Every worker left before the frame was done");
+        }
+        const auto wait_ms = chrono::ceil<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        if (poll(polled.data(), polled.size(), static_cast<int>(max<int64_t>(0, wait_ms))) < 0) {
+            throw runtime_error("Cannot wait for the workers");
+        }
+
+        for (size_t p = 0; p < polled.size(); p++) {
+            if (polled[p].revents == 0) {
+                continue;
+            }
+            const size_t w = polled_workers[p];
+            if (w == worker_count) {
+                accept_worker();
+                continue;
+            }
+            Worker &worker = workers[w];
+            try {
+                Message message = receive_message(worker.socket, limits);
+                worker.heard = chrono::steady_clock::now();
+                if (message.type == MessageType::Ready && !worker.ready) {
+                    const auto ready = message.read<WorkerReady>();
+                    stats.workers[w].threads = ready.threads;
+                    stats.workers[w].setup_ms = ready.setup_ms;
+                    worker.ready = true;
+                } else if (message.type == MessageType::Pixels && !worker.ranges.empty()) {
+                    const auto first = message.read<uint32_t>();
+                    const auto last = message.read<uint32_t>();
+                    if (pair(first, last) != worker.ranges.front()) {
+                        throw runtime_error("Unexpected tiles");
+                    }
+                    for (uint32_t t = first; t < last; t++) {
+                        const Tile &tile = tiles[t];
+                        for (int i = tile.i0; i < tile.i1; i++) {
+                            const size_t row = static_cast<size_t>(tile.j1 - tile.j0) * 3;
+                            memcpy(rgb + (static_cast<size_t>(i) * job.width + tile.j0) * 3, message.read<uint8_t>(row), row);
+                        }
+                    }
+                    worker.ranges.pop_front();
+                    done_tiles += last - first;
+                    stats.workers[w].ranges++;
+                    stats.workers[w].tiles += last - first;
+                } else {
+                    throw runtime_error("Unexpected message");
+                }
+            } catch (const runtime_error &) {
+                lose(w);
+            }
+        }
+        // Stalled workers, and the ones that never came
+        for (size_t w = 0; w < accepted; w++) {
+            if (waited_on(workers[w]) && chrono::steady_clock::now() - workers[w].heard >= chrono::milliseconds(timeout_ms)) {
+                lose(w);
+            }
+        }
+        if (accepted < expected && chrono::steady_clock::now() - accepted_at >= chrono::milliseconds(timeout_ms)) {
+            for (size_t w = accepted; w < expected; w++) {
+                lose(w);
+            }
+            expected = accepted;
+        }
+        if (!all_ready && all_of(workers.begin(), workers.end(), [](const Worker &worker) { return !worker.alive || worker.ready; })) {
+            all_ready = true;
+            render_begin = chrono::steady_clock::now();
+            stats.setup_ms = chrono::duration<double, milli>(render_begin - begin).count();
+        }
+        // Lost ranges go to whoever has room first
+        for (size_t w = 0; w < accepted; w++) {
+            feed(w);
+        }
+    }
+
+    for (size_t w = 0; w < accepted; w++) {
+        if (Worker &worker = workers[w]; worker.alive) {
+            try {
+                send_message(worker.socket, MessageType::Done);
+            } catch (const runtime_error &) {
+                // Done anyway
+            }
+        }
+    }
+    stats.render_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - render_begin).count();
+    return stats;
+}
+
+#endif //DISTRIBUTED_H
@@ -0,0 +1,420 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// --- Quantization ---
+
+// Float RGB (already capped by the shading) to 8 bits, truncating like the P3 output always did
+inline void quantize(const float * src, const size_t pixels, uint8_t * dst) {
+    for (size_t i = 0; i < pixels * 3; i++) {
+        dst[i] = static_cast<uint8_t>(static_cast<int>(src[i]));
+    }
+}
+
+// --- Writers ---
+// An image is written as a sequence of row bands from top to bottom, so it never has to be held as a whole.
+
+enum class ImageFormat { PPM_ASCII, PPM_BINARY, QOI };
+
+class ImageWriter {
+public:
+    virtual ~ImageWriter() = default;
+
+    // rows * width quantized RGB pixels
+    virtual void writeRows(const uint8_t * rgb, int rows) = 0;
+
+    // Called once every row has been written
+    virtual void finish() {}
+};
+
+// Base for the writers that go to a file
+class FileImageWriter : public ImageWriter {
+public:
+    FileImageWriter(const string &path, const int width, const int height) : width(width), height(height) {
+        file = fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw runtime_error("Cannot open " + path);
+        }
+    }
+
+    ~FileImageWriter() override {
+        if (file != nullptr) {
+            fclose(file);
+        }
+    }
+
+    void finish() override {
+        fflush(file);
+    }
+
+protected:
+    FILE * file;
+    int width;
+    int height;
+
+    void write(const void * data, const size_t size) const {
+        if (fwrite(data, 1, size, file) != size) {
+            throw runtime_error("Image write failed");
+        }
+    }
+};
+
+// P3, the original text format
+class PPMAsciiWriter final : public FileImageWriter {
+public:
+    PPMAsciiWriter(const string &path, const int width, const int height) : FileImageWriter(path, width, height) {
+        const string header = "P3\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+        write(header.data(), header.size());
+    }
+
+    void writeRows(const uint8_t * rgb, const int rows) override {
+        // Formatted by hand, "255 " at most per component
+        text.resize(static_cast<size_t>(rows) * width * 3 * 4);
+        char * out = text.data();
+        for (size_t i = 0; i < static_cast<size_t>(rows) * width * 3; i++) {
+            const uint8_t v = rgb[i];
+            if (v >= 100) *out++ = static_cast<char>('0' + v / 100);
+            if (v >= 10) *out++ = static_cast<char>('0' + v / 10 % 10);
+            *out++ = static_cast<char>('0' + v % 10);
+            *out++ = ' ';
+        }
+        write(text.data(), out - text.data());
+    }
+
+private:
+    vector<char> text;
+};
+
+// P6, same header as P3 but raw bytes
+class PPMBinaryWriter final : public FileImageWriter {
+public:
+    PPMBinaryWriter(const string &path, const int width, const int height) : FileImageWriter(path, width, height) {
+        const string header = "P6\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+        write(header.data(), header.size());
+    }
+
+    void writeRows(const uint8_t * rgb, const int rows) override {
+        write(rgb, static_cast<size_t>(rows) * width * 3);
+    }
+};
+
+// QOI (https://qoiformat.org), lossless and a lot smaller than PPM on our flat backgrounds and smooth shading
+struct QOIPixel {
+    uint8_t r = 0, g = 0, b = 0, a = 255;
+
+    // The index of previously seen pixels starts as rgba 0, 0, 0, 0, unlike the previous pixel
+    static void clearIndex(QOIPixel (&index)[64]) {
+        fill(begin(index), end(index), QOIPixel{0, 0, 0, 0});
+    }
+
+    bool operator==(const QOIPixel &other) const {
+        return r == other.r && g == other.g && b == other.b && a == other.a;
+    }
+
+    [[nodiscard]] int hash() const {
+        return (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+    }
+};
+
+class QOIWriter final : public FileImageWriter {
+public:
+    QOIWriter(const string &path, const int width, const int height) : FileImageWriter(path, width, height) {
+        uint8_t header[14] = {'q', 'o', 'i', 'f'};
+        store_be32(header + 4, static_cast<uint32_t>(width));
+        store_be32(header + 8, static_cast<uint32_t>(height));
+        header[12] = 3; // RGB
+        header[13] = 0; // sRGB with linear alpha
+        write(header, sizeof header);
+        QOIPixel::clearIndex(index);
+    }
+
+    void writeRows(const uint8_t * rgb, const int rows) override {
+        const size_t pixels = static_cast<size_t>(rows) * width;
+        bytes.clear();
+        bytes.reserve(pixels * 4);
+
+        for (size_t i = 0; i < pixels; i++) {
+            const QOIPixel px = {rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2], 255};
+
+            if (px == previous) {
+                run++;
+                if (run == 62) {
+                    flushRun();
+                }
+                continue;
+            }
+            flushRun();
+
+            if (const int h = px.hash(); index[h] == px) {
+                bytes.push_back(static_cast<uint8_t>(h)); // QOI_OP_INDEX
+            } else {
+                index[h] = px;
+
+                const int dr = px.r - previous.r;
+                const int dg = px.g - previous.g;
+                const int db = px.b - previous.b;
+                const int8_t vr = static_cast<int8_t>(dr), vg = static_cast<int8_t>(dg), vb = static_cast<int8_t>(db);
+                const int dr_dg = vr - vg;
+                const int db_dg = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    bytes.push_back(static_cast<uint8_t>(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2))); // QOI_OP_DIFF
+                } else if (dr_dg > -9 && dr_dg < 8 && vg > -33 && vg < 32 && db_dg > -9 && db_dg < 8) {
+                    bytes.push_back(static_cast<uint8_t>(0x80 | (vg + 32))); // QOI_OP_LUMA
+                    bytes.push_back(static_cast<uint8_t>((dr_dg + 8) << 4 | (db_dg + 8)));
+                } else {
+                    bytes.insert(bytes.end(), {0xfe, px.r, px.g, px.b}); // QOI_OP_RGB
+                }
+            }
+            previous = px;
+        }
+        write(bytes.data(), bytes.size());
+    }
+
+    void finish() override {
+        bytes.clear();
+        flushRun();
+        bytes.insert(bytes.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+        write(bytes.data(), bytes.size());
+        FileImageWriter::finish();
+    }
+
+private:
+    QOIPixel previous;
+    QOIPixel index[64];
+    int run = 0;
+    vector<uint8_t> bytes;
+
+    void flushRun() {
+        if (run > 0) {
+            bytes.push_back(static_cast<uint8_t>(0xc0 | (run - 1))); // QOI_OP_RUN
+            run = 0;
+        }
+    }
+
+    static void store_be32(uint8_t * out, const uint32_t v) {
+        out[0] = static_cast<uint8_t>(v >> 24);
+        out[1] = static_cast<uint8_t>(v >> 16);
+        out[2] = static_cast<uint8_t>(v >> 8);
+        out[3] = static_cast<uint8_t>(v);
+    }
+};
+
+// RGB pixels of a QOI file, empty if it cannot be read
+inline vector<uint8_t> read_qoi(const string &path, int &width, int &height) {
+    FILE * file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return {};
+    }
+    vector<uint8_t> data;
+    uint8_t chunk[65536];
+    for (size_t read; (read = fread(chunk, 1, sizeof chunk, file)) > 0;) {
+        data.insert(data.end(), chunk, chunk + read);
+    }
+    fclose(file);
+
+    if (data.size() < 22 || data[0] != 'q' || data[1] != 'o' || data[2] != 'i' || data[3] != 'f') {
+        return {};
+    }
+    width = data[4] << 24 | data[5] << 16 | data[6] << 8 | data[7];
+    height = data[8] << 24 | data[9] << 16 | data[10] << 8 | data[11];
+
+    vector<uint8_t> rgb;
+    rgb.reserve(static_cast<size_t>(width) * height * 3);
+    QOIPixel px;
+    QOIPixel index[64];
+    QOIPixel::clearIndex(index);
+    size_t p = 14;
+    const size_t end = data.size() - 8;
+
+    while (rgb.size() < static_cast<size_t>(width) * height * 3 && p < end) {
+        const uint8_t b1 = data[p++];
+        int run = 1;
+        if (b1 == 0xfe) {
+            px.r = data[p++];
+            px.g = data[p++];
+            px.b = data[p++];
+        } else if (b1 == 0xff) {
+            px.r = data[p++];
+            px.g = data[p++];
+            px.b = data[p++];
+            px.a = data[p++];
+        } else if ((b1 & 0xc0) == 0x00) {
+            px = index[b1];
+        } else if ((b1 & 0xc0) == 0x40) {
+            px.r += ((b1 >> 4) & 0x03) - 2;
+            px.g += ((b1 >> 2) & 0x03) - 2;
+            px.b += (b1 & 0x03) - 2;
+        } else if ((b1 & 0xc0) == 0x80) {
+            const uint8_t b2 = data[p++];
+            const int vg = (b1 & 0x3f) - 32;
+            px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+            px.g += vg;
+            px.b += vg - 8 + (b2 & 0x0f);
+        } else {
+            run = (b1 & 0x3f) + 1;
+        }
+        index[px.hash()] = px;
+        for (int i = 0; i < run; i++) {
+            rgb.insert(rgb.end(), {px.r, px.g, px.b});
+        }
+    }
+    return rgb;
+}
+
+inline unique_ptr<ImageWriter> make_image_writer(const ImageFormat format, const string &path, const int width, const int height) {
+    switch (format) {
+        case ImageFormat::PPM_ASCII:
+            return make_unique<PPMAsciiWriter>(path, width, height);
+        case ImageFormat::PPM_BINARY:
+            return make_unique<PPMBinaryWriter>(path, width, height);
+        case ImageFormat::QOI:
+            return make_unique<QOIWriter>(path, width, height);
+    }
+    return nullptr;
+}
+
+// --- Heatmaps ---
+
+// Per pixel cost to RGB, black (no work) through blue, green and yellow to red (the 99th percentile and above)
+inline void quantize_heatmap(const float * cost, const size_t pixels, uint8_t * dst) {
+    vector<float> sorted(cost, cost + pixels);
+    const size_t rank = pixels == 0 ? 0 : min(pixels - 1, pixels * 99 / 100);
+    nth_element(sorted.begin(), sorted.begin() + static_cast<ptrdiff_t>(rank), sorted.end());
+    const float scale = pixels == 0 || sorted[rank] <= 0.0f ? 0.0f : 1.0f / sorted[rank];
+
+    constexpr float ramp[5][3] = {{0, 0, 0}, {0, 0, 255}, {0, 255, 0}, {255, 255, 0}, {255, 0, 0}};
+    for (size_t i = 0; i < pixels; i++) {
+        const float v = min(1.0f, cost[i] * scale) * 4.0f;
+        const int k = min(3, static_cast<int>(v));
+        const float f = v - static_cast<float>(k);
+        for (int c = 0; c < 3; c++) {
+            dst[i * 3 + c] = static_cast<uint8_t>(ramp[k][c] + (ramp[k + 1][c] - ramp[k][c]) * f);
+        }
+    }
+}
+
+// --- Asynchronous writing ---
+
+// Owns a writer and feeds it from a background thread, the renderer only pays for quantization and a move.
+// At most max_bands bands wait in the queue, a renderer faster than the disk blocks instead of piling them up.
+class AsyncImageWriter final : public ImageWriter {
+public:
+    AsyncImageWriter(unique_ptr<ImageWriter> writer, const int width, const size_t max_bands = 4)
+        : writer(std::move(writer)), width(width), max_bands(max(size_t{1}, max_bands)) {
+        worker = thread([this] { loop(); });
+    }
+
+    // Waits for the bands already queued, a write error going unreported : finish() is the one reporting it
+    ~AsyncImageWriter() override {
+        stop();
+    }
+
+    // Copies the rows, they can be overwritten as soon as this returns
+    void writeRows(const uint8_t * rgb, const int rows) override {
+        const size_t size = static_cast<size_t>(rows) * width * 3;
+        queueBand({vector<uint8_t>(rgb, rgb + size), rows});
+    }
+
+    // Same without the copy
+    void writeRows(vector<uint8_t> &&rgb, const int rows) {
+        queueBand({std::move(rgb), rows});
+    }
+
+    // Blocks until every band is written, rethrows a write error
+    void finish() override {
+        stop();
+        if (error) {
+            rethrow_exception(exchange(error, nullptr));
+        }
+    }
+
+private:
+    struct Band {
+        vector<uint8_t> rgb;
+        int rows;
+    };
+
+    unique_ptr<ImageWriter> writer;
+    int width;
+    size_t max_bands;
+    thread worker;
+    mutex mutex_;
+    condition_variable ready;
+    condition_variable room;
+    deque<Band> bands;
+    bool finished = false;
+    exception_ptr error;
+
+    void stop() {
+        {
+            lock_guard lock(mutex_);
+            if (finished) {
+                return;
+            }
+            finished = true;
+        }
+        ready.notify_all();
+        worker.join();
+    }
+
+    void queueBand(Band &&band) {
+        {
+            unique_lock lock(mutex_);
+            room.wait(lock, [this] { return bands.size() < max_bands; });
+            bands.push_back(std::move(band));
+        }
+        ready.notify_one();
+    }
+
+    void loop() {
+        while (true) {
+            Band band;
+            {
+                unique_lock lock(mutex_);
+                ready.wait(lock, [this] { return finished || !bands.empty(); });
+                if (bands.empty()) {
+                    break; // finished and nothing left
+                }
+                band = std::move(bands.front());
+                bands.pop_front();
+            }
+            room.notify_one();
+            try {
+                if (!error) {
+                    writer->writeRows(band.rgb.data(), band.rows);
+                }
+            } catch (...) {
+                error = current_exception();
+            }
+        }
+        try {
+            if (!error) {
+                writer->finish();
+            }
+        } catch (...) {
+            error = current_exception();
+        }
+    }
+};
+
+#endif //IMAGE_H
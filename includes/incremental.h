@@ -0,0 +1,381 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "util.h"
+#include "ray.h"
+#include "AABB.h"
+#include "intersection.h"
+#include "scene.h"
+#include "render.h"
+#include "scheduler.h"
+
+using namespace std;
+
+// Incremental re-rendering after scene edits : every tile records what its pixels depend on, an edit marks the
+// tiles it may change and only those are traced again, into the framebuffer of the previous frame.
+// A tile records the subtrees (regions) of the hierarchy holding the spheres its primary rays hit and the leaves
+// that blocked its shadow rays, and the box of its primary hit points.
+// - Moving, resizing or recolouring a sphere changes the tiles that saw it or were shadowed by it (their regions),
+//   and the tiles whose rays may reach its new place : primary rays of the tile frustum, or shadow rays going from
+//   the tile hit points to a light (a cone around them).
+//   With a light tree, shadow rays go to the clusters the shading selects : the cones go to every node of the tree.
+// - A light reaches every shaded point, so editing one changes every tile with a hit.
+// The sphere stays in its leaf and the boxes above it are refitted, region numbers keep their meaning. So are the
+// wide or quantized nodes above the leaf when traversal uses such a copy, its topology staying as collapsed.
+
+// Largest region, in spheres
+constexpr uint32_t REGION_SPHERES = 64;
+
+struct TileRecord {
+    vector<uint32_t> regions; // Sorted
+    AABB hits = AABB::empty(); // Of the primary hit points
+};
+
+// True when some point of the convex hull of apex and the ball (centre, radius) is within r of p, or close to it
+inline bool near_cone(const Point &apex, const Point &centre, const float radius, const Point &p, const float r) {
+    const Direction axis = centre - apex;
+    const float length = axis.length();
+    if (length <= radius) {
+        return true; // The apex is inside the ball
+    }
+    const Direction u = axis / length;
+    const Direction w = p - apex;
+    const float t = w.dot(u);
+    if (t < 0.0f) {
+        return w.length() <= r;
+    }
+    if (t > length + radius + r) {
+        return false;
+    }
+    // Distance to the lateral surface of the tangent cone, which holds the hull
+    const float sin_angle = radius / length;
+    const float cos_angle = sqrt(1.0f - sin_angle * sin_angle);
+    const float perpendicular = sqrt(max(0.0f, w.length_squared() - t * t));
+    return perpendicular * cos_angle - t * sin_angle <= r;
+}
+
+class IncrementalRenderer {
+public:
+    struct UpdateStats {
+        size_t dirty_tiles = 0;
+        size_t pixels = 0;
+        double ms = 0.0;
+    };
+
+    // The scene must not be instanced, its binary hierarchy is refitted in place by the edits, as is the wide or
+    // quantized copy in use, which must be built before
+    IncrementalRenderer(Scene &scene, const Camera &camera, vector<Tile> tiles, float * framebuffer)
+        : scene(scene), camera(camera), tiles(std::move(tiles)), framebuffer(framebuffer), records(this->tiles.size()),
+          dirty(this->tiles.size(), true) {
+        if (!scene.instances.empty()) {
+            throw invalid_argument("Incremental rendering needs every sphere in the scene hierarchy");
+        }
+        if (scene.root.nodes.empty()) {
+            return;
+        }
+        const ObjectHierarchy &root = scene.root;
+
+        // Sphere range of every subtree, children coming after their parent
+        vector<uint32_t> first(root.nodes.size());
+        vector<uint32_t> last(root.nodes.size());
+        parent.assign(root.nodes.size(), 0);
+        leaf_of.resize(root.spheres.size());
+        for (size_t n = root.nodes.size(); n-- > 0;) {
+            const HierarchyNode &node = root.nodes[n];
+            if (node.isLeaf()) {
+                first[n] = node.offset;
+                last[n] = node.offset + node.count;
+                for (uint32_t s = first[n]; s < last[n]; s++) {
+                    leaf_of[s] = static_cast<uint32_t>(n);
+                }
+            } else {
+                first[n] = first[n + 1];
+                last[n] = last[node.offset];
+                parent[n + 1] = static_cast<uint32_t>(n);
+                parent[node.offset] = static_cast<uint32_t>(n);
+            }
+        }
+
+        // Largest subtrees of at most REGION_SPHERES spheres, left to right
+        vector<uint32_t> stack = {0};
+        while (!stack.empty()) {
+            const uint32_t n = stack.back();
+            stack.pop_back();
+            if (root.nodes[n].isLeaf() || last[n] - first[n] <= REGION_SPHERES) {
+                region_first.push_back(first[n]);
+            } else {
+                stack.push_back(root.nodes[n].offset);
+                stack.push_back(n + 1);
+            }
+        }
+
+        stored.resize(root.indices.size());
+        for (uint32_t s = 0; s < root.indices.size(); s++) {
+            stored[root.indices[s]] = s;
+        }
+
+        // Binary node of every lane of the wide copy, found from the sphere range the lane covers
+        unordered_map<uint64_t, uint32_t> node_of_range;
+        for (uint32_t n = 0; n < root.nodes.size(); n++) {
+            node_of_range[static_cast<uint64_t>(first[n]) << 32 | last[n]] = n;
+        }
+        visitWideNodes([&](const auto &nodes) {
+            constexpr int N = sizeof(nodes[0].child) / sizeof(uint32_t);
+            vector<uint32_t> wide_first(nodes.size());
+            vector<uint32_t> wide_last(nodes.size());
+            lane_node.assign(nodes.size() * N, 0);
+            wide_parent.assign(nodes.size(), 0);
+            wide_of_leaf.assign(root.nodes.size(), 0);
+            // Children come after their parent here too
+            for (size_t w = nodes.size(); w-- > 0;) {
+                wide_first[w] = UINT32_MAX;
+                wide_last[w] = 0;
+                for (int lane = 0; lane < static_cast<int>(nodes[w].lanes); lane++) {
+                    const uint32_t child = nodes[w].child[lane];
+                    const bool leaf = nodes[w].count[lane] > 0;
+                    const uint32_t lane_first = leaf ? child : wide_first[child];
+                    const uint32_t lane_last = leaf ? child + nodes[w].count[lane] : wide_last[child];
+                    const uint32_t n = node_of_range.at(static_cast<uint64_t>(lane_first) << 32 | lane_last);
+                    lane_node[w * N + lane] = n;
+                    (leaf ? wide_of_leaf[n] : wide_parent[child]) = static_cast<uint32_t>(w);
+                    wide_first[w] = min(wide_first[w], lane_first);
+                    wide_last[w] = max(wide_last[w], lane_last);
+                }
+            }
+        });
+    }
+
+    [[nodiscard]] size_t regionCount() const {
+        return region_first.size();
+    }
+
+    // The sphere given at position index to the builder
+    [[nodiscard]] const Sphere &sphere(const uint32_t index) const {
+        return scene.root.spheres[stored[index]];
+    }
+
+    [[nodiscard]] size_t dirtyTiles() const {
+        return static_cast<size_t>(count(dirty.begin(), dirty.end(), true));
+    }
+
+    // Replaces the sphere given at position index to the builder
+    void setSphere(const uint32_t index, const Sphere &sphere) {
+        ObjectHierarchy &root = scene.root;
+        const uint32_t s = stored[index];
+
+        // Whoever saw the old sphere, or was shadowed by it
+        const uint32_t region = regionOf(s);
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (binary_search(records[t].regions.begin(), records[t].regions.end(), region)) {
+                dirty[t] = true;
+            }
+        }
+        markReachable(sphere);
+
+        root.spheres[s] = sphere;
+        root.arrays.x[s] = sphere.center.x;
+        root.arrays.y[s] = sphere.center.y;
+        root.arrays.z[s] = sphere.center.z;
+        root.arrays.radius2[s] = sq(sphere.radius);
+
+        // Boxes from the leaf up to the root
+        uint32_t n = leaf_of[s];
+        const HierarchyNode &leaf = root.nodes[n];
+        AABB aabb = AABB::empty();
+        for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+            aabb = aabb.unionAABB(sphere_to_aabb(root.spheres[i]));
+        }
+        root.nodes[n].aabb = aabb;
+        const uint32_t leaf_node = n;
+        while (n != 0) {
+            n = parent[n];
+            root.nodes[n].aabb = root.nodes[n + 1].aabb.unionAABB(root.nodes[root.nodes[n].offset].aabb);
+        }
+        refitWideNodes(leaf_node);
+    }
+
+    void setLight(const size_t index, const Light &light) {
+        scene.lights[index] = light;
+        if (!scene.light_tree.empty()) {
+            scene.useLightTree(scene.light_tree.options);
+        }
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (records[t].hits.pmin.x <= records[t].hits.pmax.x) {
+                dirty[t] = true;
+            }
+        }
+    }
+
+    // Traces the dirty tiles again (every tile the first time), recording what they depend on
+    UpdateStats update(TaskScheduler &scheduler) {
+        const auto begin = chrono::steady_clock::now();
+        vector<size_t> selected;
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (dirty[t]) {
+                selected.push_back(t);
+            }
+        }
+
+        vector<size_t> pixels(scheduler.threadCount());
+        scheduler.run(selected.size(), [&](const size_t k, const unsigned worker) {
+            const size_t t = selected[k];
+            renderTile(tiles[t], records[t]);
+            pixels[worker] += tiles[t].pixels();
+        });
+        for (const size_t t : selected) {
+            dirty[t] = false;
+        }
+
+        UpdateStats stats;
+        stats.dirty_tiles = selected.size();
+        for (const size_t p : pixels) {
+            stats.pixels += p;
+        }
+        stats.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        return stats;
+    }
+
+private:
+    Scene &scene;
+    Camera camera;
+    vector<Tile> tiles;
+    float * framebuffer; // camera.width RGB floats per row, the whole image
+    vector<TileRecord> records;
+    vector<bool> dirty;
+
+    vector<uint32_t> region_first; // First sphere of every region, increasing
+    vector<uint32_t> parent; // Of every node, the root being its own parent
+    vector<uint32_t> leaf_of; // Leaf of every stored sphere
+    vector<uint32_t> stored; // Position in root.spheres of the sphere given at each position to the builder
+    // Wide or quantized copy in use
+    vector<uint32_t> lane_node; // Binary node of every lane, N per wide node
+    vector<uint32_t> wide_parent; // Of every wide node, the root being its own parent
+    vector<uint32_t> wide_of_leaf; // Wide node holding every binary leaf in one of its lanes
+
+    // Calls f with the nodes of the wide or quantized copy traversal uses, if any
+    template<typename F>
+    void visitWideNodes(F &&f) {
+        if (!scene.quantized4.nodes8.empty()) {
+            f(scene.quantized4.nodes8);
+        } else if (!scene.quantized4.nodes16.empty()) {
+            f(scene.quantized4.nodes16);
+        } else if (!scene.quantized8.nodes8.empty()) {
+            f(scene.quantized8.nodes8);
+        } else if (!scene.quantized8.nodes16.empty()) {
+            f(scene.quantized8.nodes16);
+        } else if (!scene.wide4.nodes.empty()) {
+            f(scene.wide4.nodes);
+        } else if (!scene.wide8.nodes.empty()) {
+            f(scene.wide8.nodes);
+        }
+    }
+
+    // Lane bounds of the wide nodes from the one holding leaf up to the root, taken again from their binary nodes
+    void refitWideNodes(const uint32_t leaf) {
+        visitWideNodes([&](auto &nodes) {
+            using Node = remove_reference_t<decltype(nodes[0])>;
+            constexpr int N = sizeof(nodes[0].child) / sizeof(uint32_t);
+            for (uint32_t w = wide_of_leaf[leaf];; w = wide_parent[w]) {
+                WideNode<N> exact;
+                if constexpr (is_same_v<Node, WideNode<N>>) {
+                    exact = nodes[w];
+                } else {
+                    nodes[w].decode(exact);
+                }
+                for (int lane = 0; lane < static_cast<int>(exact.lanes); lane++) {
+                    exact.setChild(lane, scene.root.nodes[lane_node[w * N + lane]].aabb, exact.child[lane], exact.count[lane]);
+                }
+                if constexpr (is_same_v<Node, WideNode<N>>) {
+                    nodes[w] = exact;
+                } else {
+                    nodes[w] = quantize_node<N, remove_cvref_t<decltype(nodes[0].qmin[0][0])>>(exact);
+                }
+                if (w == 0) {
+                    break;
+                }
+            }
+        });
+    }
+
+    [[nodiscard]] uint32_t regionOf(const uint32_t sphere) const {
+        return static_cast<uint32_t>(upper_bound(region_first.begin(), region_first.end(), sphere) - region_first.begin() - 1);
+    }
+
+    // Tiles whose primary or shadow rays may pass through sphere
+    void markReachable(const Sphere &sphere) {
+        const float f = camera.focal;
+        const Point &c = sphere.center;
+        const float r = sphere.radius;
+        for (size_t t = 0; t < tiles.size(); t++) {
+            if (dirty[t]) {
+                continue;
+            }
+            const Tile &tile = tiles[t];
+            // Rays of the tile go from the image plane (z = 0) through the pixels [j0, j1] x [i0, i1], away from the focal point
+            const float x0 = static_cast<float>(2 * tile.j0 - camera.width);
+            const float x1 = static_cast<float>(2 * tile.j1 - camera.width);
+            const float y0 = static_cast<float>(2 * tile.i0 - camera.height);
+            const float y1 = static_cast<float>(2 * tile.i1 - camera.height);
+            const auto inside = [&](const float a, const float b, const float plane) {
+                // Side plane through the focal point and the image line coordinate = plane, a being the coordinate of c
+                return (a * f - plane * (c.z + f)) * b / sqrt(f * f + plane * plane) >= -r;
+            };
+            if (c.z + r >= 0.0f && inside(c.x, 1.0f, x0) && inside(c.x, -1.0f, x1) && inside(c.y, 1.0f, y0) && inside(c.y, -1.0f, y1)) {
+                dirty[t] = true;
+                continue;
+            }
+
+            const AABB &hits = records[t].hits;
+            if (hits.pmin.x > hits.pmax.x) {
+                continue; // Background only, no shadow ray
+            }
+            const Point centre = {(hits.pmin.x + hits.pmax.x) * 0.5f, (hits.pmin.y + hits.pmax.y) * 0.5f, (hits.pmin.z + hits.pmax.z) * 0.5f};
+            const float radius = (hits.pmax - hits.pmin).length() * 0.5f;
+            // Every light, or every cluster the light tree may select (its leaves being the lights)
+            const auto reached = [&](const Light &light) {
+                return near_cone(light.position, centre, radius, c, r);
+            };
+            dirty[t] = scene.light_tree.empty() ? any_of(scene.lights.begin(), scene.lights.end(), reached)
+                                                : any_of(scene.light_tree.nodes.begin(), scene.light_tree.nodes.end(),
+                                                         [&](const LightNode &node) { return reached(node.cluster); });
+        }
+    }
+
+    // render_tile one ray at a time, recording the regions of the hits and occluders
+    void renderTile(const Tile &tile, TileRecord &record) const {
+        record.regions.clear();
+        record.hits = AABB::empty();
+        vector<uint32_t> spheres;
+        for (int i = tile.i0; i < tile.i1; i++) {
+            for (int j = tile.j0; j < tile.j1; j++) {
+                const optional<Intersection> hit = intersect(scene, camera.primaryRay(i, j));
+                if (hit.has_value()) {
+                    spheres.push_back(static_cast<uint32_t>(hit->sphere - scene.root.spheres.data()));
+                    record.hits = record.hits.unionPoint(hit->intersection);
+                }
+                store_color(framebuffer + (static_cast<size_t>(i) * camera.width + j) * 3, shade(scene, hit, &spheres));
+            }
+        }
+        for (const uint32_t s : spheres) {
+            record.regions.push_back(regionOf(s));
+        }
+        sort(record.regions.begin(), record.regions.end());
+        record.regions.erase(unique(record.regions.begin(), record.regions.end()), record.regions.end());
+    }
+};
+
+#endif //INCREMENTAL_H
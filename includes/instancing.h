@@ -0,0 +1,250 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "util.h"
+#include "ray.h"
+#include "AABB.h"
+#include "intersection.h"
+
+using namespace std;
+
+// Two level hierarchy : prototypes are object hierarchies built once, instances place copies of them in the scene.
+// A small top level hierarchy over the instance boxes is traversed first, then rays entering an instance box are
+// moved into the space of its prototype and traverse the prototype's hierarchy.
+// Memory and build time follow the unique geometry, moving instances only rebuilds the top level.
+
+// Rotation, uniform scale then translation : spheres stay spheres
+struct InstanceTransform {
+    float rotation[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}; // Orthonormal
+    float scale = 1.0f;
+    Direction translation = {0, 0, 0};
+
+    static InstanceTransform translate(const Direction &translation) {
+        InstanceTransform transform;
+        transform.translation = translation;
+        return transform;
+    }
+
+    // Rotation of angle radians around the z axis
+    static InstanceTransform rotateZ(const float angle, const Direction &translation = {0, 0, 0}) {
+        InstanceTransform transform;
+        transform.rotation[0][0] = cos(angle);
+        transform.rotation[0][1] = -sin(angle);
+        transform.rotation[1][0] = sin(angle);
+        transform.rotation[1][1] = cos(angle);
+        transform.translation = translation;
+        return transform;
+    }
+
+    [[nodiscard]] Direction rotate(const Direction &d) const {
+        return {rotation[0][0] * d.x + rotation[0][1] * d.y + rotation[0][2] * d.z,
+                rotation[1][0] * d.x + rotation[1][1] * d.y + rotation[1][2] * d.z,
+                rotation[2][0] * d.x + rotation[2][1] * d.y + rotation[2][2] * d.z};
+    }
+
+    // Inverse rotation (the transpose)
+    [[nodiscard]] Direction unrotate(const Direction &d) const {
+        return {rotation[0][0] * d.x + rotation[1][0] * d.y + rotation[2][0] * d.z,
+                rotation[0][1] * d.x + rotation[1][1] * d.y + rotation[2][1] * d.z,
+                rotation[0][2] * d.x + rotation[1][2] * d.y + rotation[2][2] * d.z};
+    }
+
+    [[nodiscard]] Point toWorld(const Point &p) const {
+        return Point{0, 0, 0} + rotate((p - Point{0, 0, 0}) * scale) + translation;
+    }
+
+    // The direction stays normalized, distances along it are divided by scale
+    [[nodiscard]] Ray toObject(const Ray &ray) const {
+        return {Point{0, 0, 0} + unrotate(ray.origin - (Point{0, 0, 0} + translation)) * (1.0f / scale), unrotate(ray.direction)};
+    }
+};
+
+struct Instance {
+    uint32_t prototype;
+    InstanceTransform transform;
+    AABB bounds; // In world space
+};
+
+class InstanceHierarchy {
+public:
+    vector<ObjectHierarchy> prototypes;
+    vector<Instance> instances;
+    vector<HierarchyNode> nodes; // Top level, leaves index order
+    vector<uint32_t> order; // Instances in leaf order
+
+    [[nodiscard]] bool empty() const {
+        return instances.empty();
+    }
+
+    uint32_t addPrototype(ObjectHierarchy prototype) {
+        prototypes.push_back(std::move(prototype));
+        return static_cast<uint32_t>(prototypes.size() - 1);
+    }
+
+    // The top level has to be built again before tracing (see build)
+    uint32_t addInstance(const uint32_t prototype, const InstanceTransform &transform) {
+        instances.push_back({prototype, transform, worldBounds(prototype, transform)});
+        return static_cast<uint32_t>(instances.size() - 1);
+    }
+
+    void setTransform(const uint32_t instance, const InstanceTransform &transform) {
+        instances[instance].transform = transform;
+        instances[instance].bounds = worldBounds(instances[instance].prototype, transform);
+    }
+
+    // Builds the top level over the instance boxes, the prototypes are left untouched
+    void build() {
+        nodes.clear();
+        order.resize(instances.size());
+        for (uint32_t i = 0; i < instances.size(); i++) {
+            order[i] = i;
+        }
+        if (!instances.empty()) {
+            nodes.reserve(2 * instances.size());
+            buildNode(0, instances.size());
+        }
+    }
+
+    // Spheres seen by rays, every copy counted
+    [[nodiscard]] size_t sphereCount() const {
+        size_t count = 0;
+        for (const Instance &instance : instances) {
+            count += prototypes[instance.prototype].spheres.size();
+        }
+        return count;
+    }
+
+    // Spheres actually stored
+    [[nodiscard]] size_t uniqueSphereCount() const {
+        size_t count = 0;
+        for (const ObjectHierarchy &prototype : prototypes) {
+            count += prototype.spheres.size();
+        }
+        return count;
+    }
+
+private:
+    [[nodiscard]] AABB worldBounds(const uint32_t prototype, const InstanceTransform &transform) const {
+        const ObjectHierarchy &hierarchy = prototypes[prototype];
+        if (hierarchy.nodes.empty()) {
+            return AABB::empty();
+        }
+        const AABB &local = hierarchy.nodes[0].aabb;
+        AABB bounds = AABB::empty();
+        for (int corner = 0; corner < 8; corner++) {
+            const Point p = {corner & 1 ? local.pmax.x : local.pmin.x, corner & 2 ? local.pmax.y : local.pmin.y, corner & 4 ? local.pmax.z : local.pmin.z};
+            bounds = bounds.unionPoint(transform.toWorld(p));
+        }
+        return bounds;
+    }
+
+    // Median split over the instance box centres, a couple of instances per leaf
+    uint32_t buildNode(const size_t begin, const size_t end) {
+        AABB bounds = AABB::empty();
+        AABB centres = AABB::empty();
+        for (size_t i = begin; i < end; i++) {
+            const AABB &b = instances[order[i]].bounds;
+            bounds = bounds.unionAABB(b);
+            centres = centres.unionPoint(Point{(b.pmin.x + b.pmax.x) * 0.5f, (b.pmin.y + b.pmax.y) * 0.5f, (b.pmin.z + b.pmax.z) * 0.5f});
+        }
+
+        const auto index = static_cast<uint32_t>(nodes.size());
+        if (end - begin <= 2) {
+            nodes.emplace_back(bounds, static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin));
+            return index;
+        }
+
+        const size_t cut = begin + (end - begin) / 2;
+        const int axis = centres.largestAxis();
+        nth_element(order.begin() + static_cast<ptrdiff_t>(begin), order.begin() + static_cast<ptrdiff_t>(cut), order.begin() + static_cast<ptrdiff_t>(end),
+                    [&](const uint32_t a, const uint32_t b) {
+                        return instances[a].bounds.pmin[axis] + instances[a].bounds.pmax[axis] < instances[b].bounds.pmin[axis] + instances[b].bounds.pmax[axis];
+                    });
+
+        nodes.emplace_back(bounds, 0, 0);
+        buildNode(begin, cut);
+        nodes[index].offset = buildNode(cut, end);
+        return index;
+    }
+};
+
+// Closest hit among the instances before tmax, with its point and sphere centre in world space
+inline std::optional<Intersection> intersectInstances(const InstanceHierarchy &top, const Ray &ray, float tmax = INFINITY) {
+    if (top.nodes.empty()) {
+        return nullopt;
+    }
+
+    uint32_t stack[HIERARCHY_MAX_DEPTH];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    std::optional<Intersection> closest = nullopt;
+
+    while (stack_size > 0) {
+        const HierarchyNode &node = top.nodes[stack[--stack_size]];
+        if (!intersect_aabb(node.aabb, ray, tmax).has_value()) {
+            continue;
+        }
+        if (!node.isLeaf()) {
+            stack[stack_size++] = node.offset;
+            stack[stack_size++] = static_cast<uint32_t>(&node - top.nodes.data()) + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+            const Instance &instance = top.instances[top.order[i]];
+            if (!intersect_aabb(instance.bounds, ray, tmax).has_value()) {
+                continue;
+            }
+            const float scale = instance.transform.scale;
+            if (std::optional<Intersection> local = intersectObjectHierarchy(top.prototypes[instance.prototype], instance.transform.toObject(ray), 0, tmax / scale);
+                local.has_value()) {
+                tmax = local->t * scale;
+                closest = Intersection(tmax, ray.origin + ray.direction * tmax, local->sphere);
+                closest->center = instance.transform.toWorld(local->sphere->center);
+            }
+        }
+    }
+    return closest;
+}
+
+inline bool occludedInstances(const InstanceHierarchy &top, const Ray &ray, const float tmax) {
+    if (top.nodes.empty()) {
+        return false;
+    }
+
+    uint32_t stack[HIERARCHY_MAX_DEPTH];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        const HierarchyNode &node = top.nodes[stack[--stack_size]];
+        if (!intersect_aabb(node.aabb, ray, tmax).has_value()) {
+            continue;
+        }
+        if (!node.isLeaf()) {
+            stack[stack_size++] = node.offset;
+            stack[stack_size++] = static_cast<uint32_t>(&node - top.nodes.data()) + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+            const Instance &instance = top.instances[top.order[i]];
+            if (intersect_aabb(instance.bounds, ray, tmax).has_value() &&
+                occludedObjectHierarchy(top.prototypes[instance.prototype], instance.transform.toObject(ray), tmax / instance.transform.scale)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+#endif //INSTANCING_H
@@ -6,11 +6,18 @@
 #define INTERSECTION_H
 
 
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <span>
 #include <vector>
 
 #include "ray.h"
 #include "util.h"
 #include "AABB.h"
+#include "simd.h"
+#include "stats.h"
+#include "storage.h"
 
 using namespace std;
 
@@ -27,6 +34,8 @@ struct Light {
     float intensity;
 
     Light(const Point &position, const float &intensity) : position(position), intensity(intensity) {}
+
+    Light() : position(0, 0, 0), intensity(0) {}
 };
 
 
@@ -34,11 +43,13 @@ struct Intersection {
     float t;
     Point intersection;
     const Sphere * sphere;
+    Point center; // Of the sphere hit, in world space (the sphere itself may belong to an instance, see instancing.h)
 
-    Intersection(const float &t, const Point &intersection, const Sphere * sphere) : t(t), intersection(intersection), sphere(sphere) {}
+    Intersection(const float &t, const Point &intersection, const Sphere * sphere) : t(t), intersection(intersection), sphere(sphere), center(sphere->center) {}
 };
 
-inline std::optional<Intersection> intersect_sphere(const Sphere &s, const Ray &r) {
+// Hits farther than tmax are ignored
+inline std::optional<Intersection> intersect_sphere(const Sphere &s, const Ray &r, const float tmax = INFINITY) {
     float t = -INFINITY;
     const Direction oc = r.origin - s.center;
 
@@ -62,7 +73,7 @@ inline std::optional<Intersection> intersect_sphere(const Sphere &s, const Ray &
             t = t2;
         }
 
-        if(t >= 0.0) {
+        if(t >= 0.0 && t <= tmax) {
             return Intersection( t, r.origin + r.direction * t, &s);
         }else {
             return nullopt;
@@ -72,11 +83,33 @@ inline std::optional<Intersection> intersect_sphere(const Sphere &s, const Ray &
     return nullopt;
 }
 
-inline std::optional<Intersection> intersect_spheres(const vector<Sphere>& spheres, const Ray &r) {
-    float closest = INFINITY;
+// Any intersection with 0 <= t <= tmax, without computing where
+inline bool hit_sphere(const Sphere &s, const Ray &r, const float tmax) {
+    const Direction oc = r.origin - s.center;
+
+    const float a = r.direction.length_squared();
+    const float b = 2.0f * oc.dot(r.direction);
+    const float c = oc.length_squared() - sq(s.radius);
+
+    const float delta = b * b - 4.0f * a * c;
+    if (delta < 0.0f) {
+        return false;
+    }
+
+    const float sqdelta = sqrt(delta);
+    const float t1 = (-b - sqdelta) / (2.0f * a);
+    const float t2 = (-b + sqdelta) / (2.0f * a);
+
+    // t1 <= t2, the first hit in front of the origin is t1 unless the origin is inside the sphere
+    const float t = t1 >= 0.0f ? t1 : t2;
+    return t >= 0.0f && t <= tmax;
+}
+
+inline std::optional<Intersection> intersect_spheres(const span<const Sphere> spheres, const Ray &r, const float tmax = INFINITY) {
+    float closest = tmax;
     std::optional<Intersection> closest_intersection = nullopt;
-    for (auto sphere : spheres) {
-        if (std::optional<Intersection> int_i = intersect_sphere(sphere, r); int_i.has_value()) {
+    for (const Sphere &sphere : spheres) {
+        if (std::optional<Intersection> int_i = intersect_sphere(sphere, r, closest); int_i.has_value()) {
             if(int_i.value().t < closest && int_i.value().t >= 0) {
                 closest = int_i.value().t;
                 closest_intersection = int_i;
@@ -96,101 +129,197 @@ inline AABB sphere_to_aabb(const Sphere &sphere){
     return AABB{pmin, pmax};
 }
 
-class ObjectHierarchy {
-public:
-    bool isLeaf;
+// One node of the flattened hierarchy (32 bytes).
+// Nodes are stored in depth-first order : the first child of an interior node is always the next node,
+// offset gives the index of the second one. For a leaf, offset is the index of its first sphere.
+struct HierarchyNode {
     AABB aabb;
-    vector<Sphere> spheres;
-    vector<ObjectHierarchy> childs;
+    uint32_t offset;
+    uint32_t count; // Number of spheres in the leaf, 0 for interior nodes
 
-    ObjectHierarchy(const AABB &aabb, const vector<Sphere> &spheres) : isLeaf(true), aabb(aabb), spheres(spheres) {}
-    ObjectHierarchy(const AABB &aabb, const vector<ObjectHierarchy> &childs): isLeaf(false), aabb(aabb), childs(childs) {}
+    HierarchyNode(const AABB &aabb, const uint32_t offset, const uint32_t count) : aabb(aabb), offset(offset), count(count) {}
 
+    [[nodiscard]] bool isLeaf() const {
+        return count > 0;
+    }
 };
 
-// Comparison functions
-inline bool compare_sphere_X(const Sphere &s1, const Sphere &s2) {
-    return s1.center.x < s2.center.x;
-}
-inline bool compare_sphere_Y(const Sphere &s1, const Sphere &s2) {
-    return s1.center.y < s2.center.y;
-}
-inline bool compare_sphere_Z(const Sphere &s1, const Sphere &s2) {
-    return s1.center.z < s2.center.z;
+// Deepest hierarchy the traversal stack can handle, the builders never go deeper
+constexpr int HIERARCHY_MAX_DEPTH = 128;
+
+// Levels of the hierarchy, a lone root being 1, its interior nodes having their children after them in nodes
+inline int hierarchy_depth(const span<const HierarchyNode> nodes) {
+    vector<int> depth(nodes.size(), 1);
+    int deepest = nodes.empty() ? 0 : 1;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i].isLeaf()) {
+            depth[i + 1] = max(depth[i + 1], depth[i] + 1);
+            depth[nodes[i].offset] = max(depth[nodes[i].offset], depth[i] + 1);
+            deepest = max(deepest, depth[i] + 1);
+        }
+    }
+    return deepest;
 }
 
-inline ObjectHierarchy build_hierarchy(vector<Sphere> &spheres) {
+// Copy of the spheres geometry as structure of arrays, in the same order, for the leaf kernels
+struct SphereArrays {
+    Storage<float> x, y, z, radius2; // Followed by LEAF_KERNEL_PADDING unused entries
+};
 
-    // Creating the smallest bounding box that contains all the spheres
-    AABB aabb = sphere_to_aabb(spheres[0]);
-    for (auto sphere : spheres) {
-        aabb = aabb.unionAABB(sphere_to_aabb(sphere));
+class ObjectHierarchy {
+public:
+    // Built in memory or mapped from a cache file (see bvh_cache.h)
+    Storage<HierarchyNode> nodes; // Root is nodes[0]
+    Storage<Sphere> spheres; // Every leaf is a contiguous range of this array
+    Storage<uint32_t> indices; // Position of each sphere in the array given to the builder
+    SphereArrays arrays;
+
+    [[nodiscard]] span<const Sphere> leafSpheres(const HierarchyNode &node) const {
+        return {spheres.data() + node.offset, node.count};
     }
 
-    if (spheres.size() < LEAF_SIZE){
-        return {aabb, spheres}; // Leaf
-    } else {
-        switch (aabb.largestAxis()) {
-            case Axis::X:
-                sort(spheres.begin(), spheres.end(), compare_sphere_X);
-            case Axis::Y:
-                sort(spheres.begin(), spheres.end(), compare_sphere_Y);
-            case Axis::Z:
-                sort(spheres.begin(), spheres.end(), compare_sphere_Z);
+    // To be called whenever spheres changes
+    void updateArrays() {
+        const size_t size = spheres.size() + LEAF_KERNEL_PADDING;
+        arrays.x.assign(size, 0.0f);
+        arrays.y.assign(size, 0.0f);
+        arrays.z.assign(size, 0.0f);
+        arrays.radius2.assign(size, 0.0f);
+        for (size_t i = 0; i < spheres.size(); i++) {
+            arrays.x[i] = spheres[i].center.x;
+            arrays.y[i] = spheres[i].center.y;
+            arrays.z[i] = spheres[i].center.z;
+            arrays.radius2[i] = sq(spheres[i].radius);
         }
     }
+};
 
-    vector<Sphere> left_spheres;
-    vector<Sphere> right_spheres;
-    const int cut = spheres.size() / 2;
-
-    left_spheres.reserve(cut);
-    for(int i = 0; i < cut; i++) {
-        left_spheres.push_back(spheres[i]);
+// Index in spheres of the closest sphere of spheres[first, first + count[ hit before t (t is then updated), or -1.
+// Uses the widest SIMD kernel available.
+inline int64_t intersect_leaf_index(const ObjectHierarchy &obj, const uint32_t first, const uint32_t count, const Ray &ray, float &t) {
+    if (const int i = leaf_kernel(obj.arrays.x.data() + first, obj.arrays.y.data() + first, obj.arrays.z.data() + first, obj.arrays.radius2.data() + first, count, ray, t); i >= 0) {
+        return first + i;
     }
-    right_spheres.reserve(spheres.size() - cut);
-    for(int i = cut; i < spheres.size(); i++) {
-        right_spheres.push_back(spheres[i]);
-    }
-
-    vector<ObjectHierarchy> childs;
-    childs.push_back(build_hierarchy(left_spheres));
-    childs.push_back(build_hierarchy(right_spheres));
+    return -1;
+}
 
-    return {aabb, childs}; // Node
+inline std::optional<Intersection> intersect_leaf(const ObjectHierarchy &obj, const uint32_t first, const uint32_t count, const Ray &ray, const float tmax) {
+    float t = tmax;
+    if (const int64_t i = intersect_leaf_index(obj, first, count, ray, t); i >= 0) {
+        return Intersection(t, ray.origin + ray.direction * t, &obj.spheres[i]);
+    }
+    return nullopt;
 }
 
-inline std::optional<Intersection> intersectObjectHierarchy(const ObjectHierarchy &obj, const Ray &ray) {
-    if(!intersect_aabb(obj.aabb, ray).has_value()) {
+// Closest hit, visiting the nearest child first and skipping every subtree farther than the closest hit found so far.
+// start and tmax restrict the search to one subtree and to hits closer than tmax.
+inline std::optional<Intersection> intersectObjectHierarchy(const ObjectHierarchy &obj, const Ray &ray, const uint32_t start = 0, float tmax = INFINITY) {
+    RT_STAT(primary, boxes, !obj.nodes.empty());
+    if (obj.nodes.empty() || !intersect_aabb(obj.nodes[start].aabb, ray, tmax).has_value()) {
         return nullopt;
     }
-    if(obj.isLeaf) {
-        return intersect_spheres(obj.spheres, ray);
-    }
 
-
-    std::optional<Intersection> itleft = intersectObjectHierarchy(obj.childs[0], ray);
-    std::optional<Intersection> itright = intersectObjectHierarchy(obj.childs[1], ray);
-
-    if(itleft.has_value()) {
-        if(itright.has_value()) { // Both aabb intersects
-            // So we take the closest one
-            if ( itright.value().t < itleft.value().t) return itright;
+    struct StackEntry {
+        uint32_t node;
+        float tmin;
+    };
+    StackEntry stack[HIERARCHY_MAX_DEPTH];
+    int stack_size = 0;
+
+    std::optional<Intersection> closest = nullopt;
+    uint32_t index = start;
+
+    while (true) {
+        const HierarchyNode &node = obj.nodes[index];
+
+        if (node.isLeaf()) {
+            RT_STAT(primary, leaves, 1);
+            RT_STAT(primary, spheres, node.count);
+            if (std::optional<Intersection> it = intersect_leaf(obj, node.offset, node.count, ray, tmax); it.has_value()) {
+                tmax = it.value().t;
+                closest = it;
+            }
+        } else {
+            RT_STAT(primary, nodes, 1);
+            RT_STAT(primary, boxes, 2);
+            const uint32_t left = index + 1;
+            const uint32_t right = node.offset;
+            const optional<float> tleft = intersect_aabb(obj.nodes[left].aabb, ray, tmax);
+            const optional<float> tright = intersect_aabb(obj.nodes[right].aabb, ray, tmax);
+
+            if (tleft.has_value() && tright.has_value()) {
+                // Both children are hit, the farthest one waits on the stack
+                if (tright.value() < tleft.value()) {
+                    stack[stack_size++] = {left, tleft.value()};
+                    index = right;
+                } else {
+                    stack[stack_size++] = {right, tright.value()};
+                    index = left;
+                }
+                continue;
+            }
+            if (tleft.has_value()) {
+                index = left;
+                continue;
+            }
+            if (tright.has_value()) {
+                index = right;
+                continue;
+            }
         }
-        return itleft;
+
+        // Next subtree that may still contain a closer hit
+        do {
+            if (stack_size == 0) {
+                return closest;
+            }
+            stack_size--;
+        } while (stack[stack_size].tmin > tmax);
+        index = stack[stack_size].node;
     }
-    return itright;
 }
 
-struct Scene {
-    ObjectHierarchy root;
-    vector<Light> lights;
+// Spheres [first, first + count[ of a hierarchy, the content of one leaf
+struct LeafRange {
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+// True as soon as any sphere is hit with t <= tmax, in no particular order.
+// The leaf holding that sphere is written to occluder when given.
+inline bool occludedObjectHierarchy(const ObjectHierarchy &obj, const Ray &ray, const float tmax, LeafRange * occluder = nullptr) {
+    if (obj.nodes.empty()) {
+        return false;
+    }
 
-    Scene(ObjectHierarchy root, const vector<Light>& lights) : root(std::move(root)), lights(lights) {}
+    uint32_t stack[HIERARCHY_MAX_DEPTH];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
 
-    void addLight(const Light& light) {
-        lights.push_back(light);
+    while (stack_size > 0) {
+        const HierarchyNode &node = obj.nodes[stack[--stack_size]];
+        RT_STAT(shadow, boxes, 1);
+        if (!intersect_aabb(node.aabb, ray, tmax).has_value()) {
+            continue;
+        }
+
+        if (node.isLeaf()) {
+            RT_STAT(shadow, leaves, 1);
+            RT_STAT(shadow, spheres, node.count);
+            float t = tmax;
+            if (intersect_leaf_index(obj, node.offset, node.count, ray, t) >= 0) {
+                if (occluder != nullptr) {
+                    *occluder = {node.offset, node.count};
+                }
+                return true;
+            }
+        } else {
+            RT_STAT(shadow, nodes, 1);
+            stack[stack_size++] = node.offset;
+            stack[stack_size++] = static_cast<uint32_t>(&node - obj.nodes.data()) + 1;
+        }
     }
-};
+    return false;
+}
 
 #endif //INTERSECTION_H
@@ -0,0 +1,382 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef LBVH_H
+#define LBVH_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "util.h"
+#include "AABB.h"
+#include "intersection.h"
+
+using namespace std;
+
+// Linear hierarchy builder (LBVH) : the build latency matters more than the tree quality.
+// Sphere centres are mapped to 63 bit Morton codes (21 bits per axis) over the cube holding every centre, codes are
+// sorted with a parallel radix sort, and the tree is cut from the sorted codes : each node splits its range where its
+// highest differing bit flips, a binary search, subtrees being emitted by different threads. Optional treelet passes
+// then restructure every group of up to 7 subtrees into the SAH optimal binary tree over them (Karras and Aila), which
+// recovers most of the quality lost to spatial median splits.
+
+// Below this many spheres, spawning a task costs more than it saves
+constexpr size_t LBVH_PARALLEL_THRESHOLD = 16384;
+// Subtrees restructured at once by a treelet pass
+constexpr int TREELET_LEAVES = 7;
+
+// task(chunk, begin, end) over threads contiguous chunks of [0, count[, always cut the same way
+template<typename Task>
+void for_each_chunk(const size_t count, const unsigned threads, const Task &task) {
+    vector<future<void>> helpers;
+    for (unsigned t = 1; t < threads; t++) {
+        helpers.push_back(async(launch::async, [&, t] {
+            task(t, count * t / threads, count * (t + 1) / threads);
+        }));
+    }
+    task(0u, size_t{0}, count / threads);
+    for (future<void> &helper : helpers) {
+        helper.get();
+    }
+}
+
+// Bits of v spread 3 bits apart
+inline uint64_t expand_bits_21(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+// Least significant digit radix sort of keys, 8 bits at a time, values following their keys.
+// Every thread counts then scatters its own chunk, passes on a digit all keys share are skipped.
+inline void radix_sort(vector<uint64_t> &keys, vector<uint32_t> &values, const unsigned threads) {
+    const size_t n = keys.size();
+    const auto chunks = static_cast<unsigned>(clamp<size_t>(n / LBVH_PARALLEL_THRESHOLD, 1, max(1u, threads)));
+    vector<uint64_t> sorted_keys(n);
+    vector<uint32_t> sorted_values(n);
+    vector<array<size_t, 256>> offsets(chunks);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        for_each_chunk(n, chunks, [&](const unsigned chunk, const size_t begin, const size_t end) {
+            array<size_t, 256> &histogram = offsets[chunk];
+            histogram.fill(0);
+            for (size_t i = begin; i < end; i++) {
+                histogram[keys[i] >> shift & 0xff]++;
+            }
+        });
+
+        // Chunk c writes digit d after every smaller digit and after the d digits of the chunks before it
+        size_t position = 0;
+        bool shared_digit = false;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t total = 0;
+            for (unsigned c = 0; c < chunks; c++) {
+                const size_t count = offsets[c][digit];
+                offsets[c][digit] = position + total;
+                total += count;
+            }
+            shared_digit |= total == n;
+            position += total;
+        }
+        if (shared_digit) {
+            continue; // Already ordered on this digit
+        }
+
+        for_each_chunk(n, chunks, [&](const unsigned chunk, const size_t begin, const size_t end) {
+            array<size_t, 256> &offset = offsets[chunk];
+            for (size_t i = begin; i < end; i++) {
+                const size_t to = offset[keys[i] >> shift & 0xff]++;
+                sorted_keys[to] = keys[i];
+                sorted_values[to] = values[i];
+            }
+        });
+        keys.swap(sorted_keys);
+        values.swap(sorted_values);
+    }
+}
+
+struct LinearBuilder {
+    // Node of the intermediate tree, children linked by index so that treelets can be rewired in place
+    struct Node {
+        AABB aabb = AABB::empty();
+        uint32_t left = 0;
+        uint32_t right = 0;
+        uint32_t first = 0; // Leaf spheres are codes[first, first + count[
+        uint32_t count = 0; // 0 for interior nodes
+        uint32_t size = 1; // Nodes in the subtree
+        uint32_t height = 1; // Levels of the subtree
+        uint32_t spheres = 0; // Spheres in the subtree
+        float cost = 0.0f; // SAH cost of the subtree, not divided by the root area
+    };
+
+    const Storage<Sphere> &input;
+    float traversal_cost;
+    float intersection_cost;
+    vector<uint64_t> codes;
+    vector<uint32_t> order; // Sphere of each code
+    vector<Node> nodes;
+    atomic<uint32_t> next_node = 0;
+
+    void setInterior(Node &node, const uint32_t left, const uint32_t right) const {
+        node.left = left;
+        node.right = right;
+        node.count = 0;
+        node.aabb = nodes[left].aabb.unionAABB(nodes[right].aabb);
+        node.size = 1 + nodes[left].size + nodes[right].size;
+        node.height = 1 + max(nodes[left].height, nodes[right].height);
+        node.spheres = nodes[left].spheres + nodes[right].spheres;
+        node.cost = traversal_cost * node.aabb.area() + nodes[left].cost + nodes[right].cost;
+    }
+
+    void computeCodes(const unsigned threads) {
+        const size_t n = input.size();
+        const auto chunks = static_cast<unsigned>(clamp<size_t>(n / LBVH_PARALLEL_THRESHOLD, 1, max(1u, threads)));
+
+        vector<AABB> chunk_bounds(chunks, AABB::empty());
+        for_each_chunk(n, chunks, [&](const unsigned chunk, const size_t begin, const size_t end) {
+            AABB bounds = AABB::empty();
+            for (size_t i = begin; i < end; i++) {
+                bounds = bounds.unionPoint(input[i].center);
+            }
+            chunk_bounds[chunk] = bounds;
+        });
+        AABB centres = AABB::empty();
+        for (const AABB &bounds : chunk_bounds) {
+            centres = centres.unionAABB(bounds);
+        }
+
+        // The same scale on every axis : Morton splits are then midpoint splits of cubes
+        const Direction extent = centres.pmax - centres.pmin;
+        const float largest = max({extent.x, extent.y, extent.z});
+        constexpr auto cells = static_cast<float>((1 << 21) - 1);
+        const float scale = largest > 0.0f ? cells / largest : 0.0f;
+        const auto cell = [&](const float x) {
+            return static_cast<uint64_t>(min(x, cells)); // The scaling may round the farthest centre past the last cell
+        };
+        codes.resize(n);
+        order.resize(n);
+        for_each_chunk(n, chunks, [&](unsigned, const size_t begin, const size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const Direction p = (input[i].center - centres.pmin) * scale;
+                codes[i] = expand_bits_21(cell(p.x)) << 2 | expand_bits_21(cell(p.y)) << 1 | expand_bits_21(cell(p.z));
+                order[i] = static_cast<uint32_t>(i);
+            }
+        });
+    }
+
+    // First code of [begin, end[ on the upper side of its highest differing bit, the middle if every code is the same
+    [[nodiscard]] size_t split(const size_t begin, const size_t end) const {
+        if (codes[begin] == codes[end - 1]) {
+            return begin + (end - begin) / 2;
+        }
+        const int bit = 63 - countl_zero(codes[begin] ^ codes[end - 1]);
+        return static_cast<size_t>(partition_point(codes.begin() + static_cast<ptrdiff_t>(begin), codes.begin() + static_cast<ptrdiff_t>(end),
+                                                   [bit](const uint64_t code) { return (code >> bit & 1) == 0; }) - codes.begin());
+    }
+
+    // Subtree of codes[begin, end[, bounds are gathered on the way back up
+    uint32_t emit(const size_t begin, const size_t end, const unsigned threads) {
+        const uint32_t index = next_node++;
+        Node &node = nodes[index];
+        const size_t count = end - begin;
+
+        if (count < LEAF_SIZE) {
+            node.first = static_cast<uint32_t>(begin);
+            node.count = static_cast<uint32_t>(count);
+            node.spheres = node.count;
+            for (size_t i = begin; i < end; i++) {
+                node.aabb = node.aabb.unionAABB(sphere_to_aabb(input[order[i]]));
+            }
+            node.cost = intersection_cost * static_cast<float>(count) * node.aabb.area();
+            return index;
+        }
+
+        const size_t cut = split(begin, end);
+        uint32_t left, right;
+        if (threads > 1 && count >= LBVH_PARALLEL_THRESHOLD) {
+            auto right_task = async(launch::async, [&] {
+                return emit(cut, end, threads / 2);
+            });
+            left = emit(begin, cut, threads - threads / 2);
+            right = right_task.get();
+        } else {
+            left = emit(begin, cut, 1);
+            right = emit(cut, end, 1);
+        }
+        setInterior(node, left, right);
+        return index;
+    }
+
+    // Rewires the treelet rooted at root, depth levels down the tree, into the binary tree of least SAH cost over the
+    // same subtrees, unless that tree would not fit the traversal stacks
+    void restructure(const uint32_t root, const int depth) {
+        // Grown from root by opening the largest subtree until TREELET_LEAVES subtrees hang from it
+        uint32_t leaves[TREELET_LEAVES] = {nodes[root].left, nodes[root].right};
+        uint32_t interiors[TREELET_LEAVES - 1] = {root};
+        int leaf_count = 2;
+        int interior_count = 1;
+        while (leaf_count < TREELET_LEAVES) {
+            int largest = -1;
+            for (int l = 0; l < leaf_count; l++) {
+                if (nodes[leaves[l]].count == 0 && (largest < 0 || nodes[leaves[l]].aabb.area() > nodes[leaves[largest]].aabb.area())) {
+                    largest = l;
+                }
+            }
+            if (largest < 0) {
+                break;
+            }
+            const uint32_t opened = leaves[largest];
+            interiors[interior_count++] = opened;
+            leaves[largest] = nodes[opened].left;
+            leaves[leaf_count++] = nodes[opened].right;
+        }
+        if (leaf_count < 3) {
+            return; // A single topology
+        }
+
+        // Best tree of every subset of the subtrees, smaller subsets first
+        const int full = (1 << leaf_count) - 1;
+        float cost[1 << TREELET_LEAVES];
+        float lo[3][1 << TREELET_LEAVES]; // Bounds of each subset
+        float hi[3][1 << TREELET_LEAVES];
+        int best_split[1 << TREELET_LEAVES];
+        for (int set = 1; set <= full; set++) {
+            const int lowest = set & -set;
+            if (set == lowest) {
+                const Node &leaf = nodes[leaves[countr_zero(static_cast<unsigned>(set))]];
+                for (int axis = 0; axis < 3; axis++) {
+                    lo[axis][set] = leaf.aabb.pmin[axis];
+                    hi[axis][set] = leaf.aabb.pmax[axis];
+                }
+                cost[set] = leaf.cost;
+                continue;
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                lo[axis][set] = min(lo[axis][lowest], lo[axis][set ^ lowest]);
+                hi[axis][set] = max(hi[axis][lowest], hi[axis][set ^ lowest]);
+            }
+            cost[set] = INFINITY;
+            // Each partition once : the first part holds the lowest subtree
+            for (int part = (set - 1) & set; part > 0; part = (part - 1) & set) {
+                if ((part & lowest) != 0 && cost[part] + cost[set ^ part] < cost[set]) {
+                    cost[set] = cost[part] + cost[set ^ part];
+                    best_split[set] = part;
+                }
+            }
+            cost[set] += traversal_cost * AABB({lo[0][set], lo[1][set], lo[2][set]}, {hi[0][set], hi[1][set], hi[2][set]}).area();
+        }
+        if (cost[full] >= nodes[root].cost * (1.0f - 1e-4f)) {
+            return;
+        }
+        // Chains are often cheapest, passes after passes could deepen the tree without bound
+        int height[1 << TREELET_LEAVES];
+        for (int set = 1; set <= full; set++) {
+            height[set] = (set & (set - 1)) == 0 ? static_cast<int>(nodes[leaves[countr_zero(static_cast<unsigned>(set))]].height)
+                                                 : 1 + max(height[best_split[set]], height[set ^ best_split[set]]);
+        }
+        if (depth - 1 + height[full] > HIERARCHY_MAX_DEPTH) {
+            return;
+        }
+
+        // Interior nodes of the old treelet are reused for the new one, its root staying in place
+        int free_interior = 1;
+        const auto place = [&](const auto &self, const int set) -> uint32_t {
+            if ((set & (set - 1)) == 0) {
+                return leaves[countr_zero(static_cast<unsigned>(set))];
+            }
+            const uint32_t index = set == full ? root : interiors[free_interior++];
+            const uint32_t left = self(self, best_split[set]);
+            const uint32_t right = self(self, set ^ best_split[set]);
+            setInterior(nodes[index], left, right);
+            return index;
+        };
+        place(place, full);
+    }
+
+    // Every treelet, children before their parent, index being depth levels down the tree (1 for the root)
+    void optimize(const uint32_t index, const unsigned threads, const int depth = 1) {
+        const Node &node = nodes[index];
+        if (node.count > 0) {
+            return;
+        }
+        if (threads > 1 && node.spheres >= LBVH_PARALLEL_THRESHOLD) {
+            auto right_task = async(launch::async, [&] {
+                optimize(node.right, threads / 2, depth + 1);
+            });
+            optimize(node.left, threads - threads / 2, depth + 1);
+            right_task.get();
+        } else {
+            optimize(node.left, 1, depth + 1);
+            optimize(node.right, 1, depth + 1);
+        }
+        setInterior(nodes[index], node.left, node.right); // The children may have changed
+        restructure(index, depth);
+    }
+
+    // Depth-first layout of build_hierarchy, every subtree knowing where its nodes and spheres go
+    void flatten(const uint32_t index, const uint32_t out, const uint32_t sphere_out, HierarchyNode * out_nodes, uint32_t * out_indices,
+                 const vector<uint32_t> &input_indices, const unsigned threads) const {
+        const Node &node = nodes[index];
+        if (node.count > 0) {
+            out_nodes[out] = HierarchyNode(node.aabb, sphere_out, node.count);
+            for (uint32_t i = 0; i < node.count; i++) {
+                out_indices[sphere_out + i] = input_indices[order[node.first + i]];
+            }
+            return;
+        }
+
+        const uint32_t right_out = out + 1 + nodes[node.left].size;
+        const uint32_t right_sphere_out = sphere_out + nodes[node.left].spheres;
+        out_nodes[out] = HierarchyNode(node.aabb, right_out, 0);
+        if (threads > 1 && node.spheres >= LBVH_PARALLEL_THRESHOLD) {
+            auto right_task = async(launch::async, [&] {
+                flatten(node.right, right_out, right_sphere_out, out_nodes, out_indices, input_indices, threads / 2);
+            });
+            flatten(node.left, out + 1, sphere_out, out_nodes, out_indices, input_indices, threads - threads / 2);
+            right_task.get();
+        } else {
+            flatten(node.left, out + 1, sphere_out, out_nodes, out_indices, input_indices, 1);
+            flatten(node.right, right_out, right_sphere_out, out_nodes, out_indices, input_indices, 1);
+        }
+    }
+};
+
+// Builds the hierarchy of hierarchy.spheres, hierarchy.indices being reordered into leaf order.
+// treelet_passes restructuring passes follow the linear build (0 : none).
+inline void build_lbvh(ObjectHierarchy &hierarchy, const unsigned threads, const int treelet_passes, const float traversal_cost, const float intersection_cost) {
+    const size_t n = hierarchy.spheres.size();
+    LinearBuilder builder{hierarchy.spheres, traversal_cost, intersection_cost, {}, {}, {}, 0};
+
+    builder.computeCodes(threads);
+    radix_sort(builder.codes, builder.order, threads);
+
+    // At most one leaf per sphere, so fewer than 2n nodes
+    builder.nodes.resize(2 * n);
+    const unsigned build_threads = static_cast<unsigned>(clamp<size_t>(n / LBVH_PARALLEL_THRESHOLD, 1, max(1u, threads)));
+    builder.emit(0, n, build_threads);
+    for (int pass = 0; pass < treelet_passes; pass++) {
+        builder.optimize(0, build_threads);
+    }
+
+    const vector<uint32_t> input_indices(hierarchy.indices.begin(), hierarchy.indices.end());
+    vector<HierarchyNode> nodes(builder.nodes[0].size, HierarchyNode(AABB::empty(), 0, 0));
+    vector<uint32_t> indices(n);
+    builder.flatten(0, 0, 0, nodes.data(), indices.data(), input_indices, build_threads);
+    // Morton splits use at most 63 levels before the midpoint splits of equal codes, restructuring never goes past the limit
+    assert(hierarchy_depth(nodes) <= HIERARCHY_MAX_DEPTH);
+    hierarchy.nodes = std::move(nodes);
+    hierarchy.indices = std::move(indices);
+}
+
+#endif //LBVH_H
@@ -0,0 +1,163 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "util.h"
+#include "AABB.h"
+#include "intersection.h"
+
+using namespace std;
+
+// Light hierarchy : lights grouped in a binary tree of boxes, every node knowing the total intensity under it.
+// A shaded point only descends into the clusters that can matter to it : a cluster is shaded as a single light
+// (its total intensity at the intensity weighted centre of its lights) once it is far enough, and dropped when even
+// its whole intensity at the nearest point of its box falls below the cutoff.
+// The lights actually shaded, one shadow ray each, are bounded by max_lights whatever the number of lights.
+
+struct LightTreeOptions {
+    int max_lights = 8; // Clusters shaded per point, up to LIGHT_TREE_MAX_CUT
+    float cutoff = 0.0f; // Clusters whose intensity / distance^2 bound is below it are skipped
+};
+
+constexpr int LIGHT_TREE_MAX_CUT = 64;
+
+// Same depth-first layout as HierarchyNode : first child next, offset is the second child or the first light of a leaf
+struct LightNode {
+    AABB bounds; // Of the light positions
+    Light cluster; // Total intensity at the weighted centre, the light itself for a leaf
+    uint32_t offset;
+    uint32_t count; // Lights in the leaf, 0 for interior nodes
+
+    [[nodiscard]] bool isLeaf() const {
+        return count > 0;
+    }
+};
+
+class LightTree {
+public:
+    vector<LightNode> nodes;
+    vector<Light> lights; // In leaf order
+    LightTreeOptions options;
+
+    LightTree() = default;
+
+    LightTree(vector<Light> scene_lights, const LightTreeOptions &options) : lights(std::move(scene_lights)), options(options) {
+        this->options.max_lights = clamp(options.max_lights, 1, LIGHT_TREE_MAX_CUT);
+        if (!lights.empty()) {
+            nodes.reserve(2 * lights.size());
+            build(0, lights.size());
+        }
+    }
+
+    [[nodiscard]] bool empty() const {
+        return nodes.empty();
+    }
+
+    // Clusters lighting p on a surface of normal N, at most options.max_lights of them, written to selected.
+    // Returns their number.
+    int select(const Point &p, const Direction &N, Light * selected) const {
+        struct Candidate {
+            uint32_t node;
+            float bound;
+        };
+        Candidate cut[LIGHT_TREE_MAX_CUT + 1];
+        int count = 0;
+        const auto add = [&](const uint32_t n) {
+            if (const float b = bound(nodes[n], p, N); b > 0.0f && b >= options.cutoff) {
+                cut[count++] = {n, b};
+            }
+        };
+
+        if (!nodes.empty()) {
+            add(0);
+        }
+        // Splits the most important cluster until the cut is full or made of single lights
+        while (count < options.max_lights) {
+            int largest = -1;
+            for (int k = 0; k < count; k++) {
+                if (!nodes[cut[k].node].isLeaf() && (largest < 0 || cut[k].bound > cut[largest].bound)) {
+                    largest = k;
+                }
+            }
+            if (largest < 0) {
+                break;
+            }
+            const uint32_t n = cut[largest].node;
+            cut[largest] = cut[--count];
+            add(n + 1);
+            add(nodes[n].offset);
+        }
+
+        int selected_count = 0;
+        for (int k = 0; k < count; k++) {
+            const LightNode &node = nodes[cut[k].node];
+            if (node.isLeaf()) {
+                for (uint32_t l = node.offset; l < node.offset + node.count; l++) {
+                    selected[selected_count++] = lights[l];
+                }
+            } else {
+                selected[selected_count++] = node.cluster;
+            }
+        }
+        return selected_count;
+    }
+
+private:
+    // Upper bound of intensity / distance^2 over the lights of node, 0 when they are all behind the surface
+    static float bound(const LightNode &node, const Point &p, const Direction &N) {
+        const Point &lo = node.bounds.pmin;
+        const Point &hi = node.bounds.pmax;
+        // Lights behind the tangent plane are hidden by the sphere itself
+        const float facing = max(N.x * (lo.x - p.x), N.x * (hi.x - p.x)) + max(N.y * (lo.y - p.y), N.y * (hi.y - p.y)) +
+                             max(N.z * (lo.z - p.z), N.z * (hi.z - p.z));
+        if (facing <= 0.0f) {
+            return 0.0f;
+        }
+        const float dx = max({lo.x - p.x, 0.0f, p.x - hi.x});
+        const float dy = max({lo.y - p.y, 0.0f, p.y - hi.y});
+        const float dz = max({lo.z - p.z, 0.0f, p.z - hi.z});
+        const float distance2 = sq(dx) + sq(dy) + sq(dz);
+        return distance2 > 0.0f ? node.cluster.intensity / distance2 : INFINITY;
+    }
+
+    // Median split on the largest axis, as the median object hierarchy builder
+    uint32_t build(const size_t begin, const size_t end) {
+        AABB bounds = AABB::empty();
+        float intensity = 0.0f;
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+        for (size_t l = begin; l < end; l++) {
+            bounds = bounds.unionPoint(lights[l].position);
+            intensity += lights[l].intensity;
+            x += lights[l].position.x * lights[l].intensity;
+            y += lights[l].position.y * lights[l].intensity;
+            z += lights[l].position.z * lights[l].intensity;
+        }
+        const Point centre = intensity > 0.0f ? Point(x / intensity, y / intensity, z / intensity) : lights[begin].position;
+
+        const auto index = static_cast<uint32_t>(nodes.size());
+        if (end - begin == 1) {
+            nodes.push_back({bounds, lights[begin], static_cast<uint32_t>(begin), 1});
+            return index;
+        }
+
+        const size_t cut = begin + (end - begin) / 2;
+        const int axis = bounds.largestAxis();
+        nth_element(lights.begin() + static_cast<ptrdiff_t>(begin), lights.begin() + static_cast<ptrdiff_t>(cut), lights.begin() + static_cast<ptrdiff_t>(end),
+                    [axis](const Light &a, const Light &b) { return a.position[axis] < b.position[axis]; });
+
+        nodes.push_back({bounds, Light(centre, intensity), 0, 0});
+        build(begin, cut);
+        nodes[index].offset = build(cut, end);
+        return index;
+    }
+};
+
+#endif //LIGHT_TREE_H
@@ -0,0 +1,84 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Read only memory mapping of a whole file, unmapped on destruction.
+// Pages are only read from disk when touched, so opening a large file costs nothing until it is used.
+// advice tells the kernel how the pages will be read (madvise).
+class MappedFile {
+public:
+    explicit MappedFile(const string &path, const int advice = MADV_SEQUENTIAL) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Cannot open " + path);
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error("Cannot stat " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void * mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("Cannot map " + path);
+            }
+            data_ = static_cast<const uint8_t *>(mapping);
+            madvise(mapping, size_, advice);
+        }
+        close(fd); // The mapping keeps the file alive
+    }
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            munmap(const_cast<uint8_t *>(data_), size_);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept : data_(other.data_), size_(other.size_) {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    [[nodiscard]] const uint8_t * data() const {
+        return data_;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return size_;
+    }
+
+    // count objects of type T at offset, checked against the size of the file
+    template<typename T>
+    [[nodiscard]] const T * array(const uint64_t offset, const uint64_t count) const {
+        if (offset > size_ || count > (size_ - offset) / sizeof(T) || offset % alignof(T) != 0) {
+            throw runtime_error("Truncated or corrupted file");
+        }
+        return reinterpret_cast<const T *>(data_ + offset);
+    }
+
+private:
+    const uint8_t * data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif //MAPPED_FILE_H
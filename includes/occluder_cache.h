@@ -0,0 +1,110 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef OCCLUDER_CACHE_H
+#define OCCLUDER_CACHE_H
+
+#include <bit>
+#include <cstdint>
+
+#include "util.h"
+#include "ray.h"
+#include "intersection.h"
+#include "scene.h"
+
+using namespace std;
+
+// Last occluder cache : neighbouring points shaded by the same light are usually hidden from it by the same sphere.
+// Every thread remembers, per light, the leaf that blocked its last shadow ray towards that light and tests it first :
+// a hit skips the traversal, a miss falls back to it. A remembered leaf is only a guess, any sphere it holds that
+// blocks the ray is a genuine occluder, so the answer never depends on the cache.
+
+struct OccluderCacheStats {
+    uint64_t lookups = 0; // Shadow rays that went through the cache
+    uint64_t hits = 0; // Blocked by the remembered leaf, no traversal
+    uint64_t misses = 0; // A leaf was remembered but did not block the ray
+
+    OccluderCacheStats &operator+=(const OccluderCacheStats &other) {
+        lookups += other.lookups;
+        hits += other.hits;
+        misses += other.misses;
+        return *this;
+    }
+
+    [[nodiscard]] double hitRate() const {
+        return lookups > 0 ? static_cast<double>(hits) / static_cast<double>(lookups) : 0.0;
+    }
+};
+
+// Entries per thread, lights are mapped to them by position (direct mapped)
+constexpr int OCCLUDER_CACHE_SIZE = 256;
+
+struct OccluderCache {
+    struct Entry {
+        Point light = {NAN, NAN, NAN}; // Never equal to a light, the entry starts empty
+        LeafRange leaf;
+    };
+
+    const ObjectHierarchy * hierarchy = nullptr; // Entries refer to its spheres
+    Entry entries[OCCLUDER_CACHE_SIZE];
+    OccluderCacheStats stats;
+
+    Entry &entry(const ObjectHierarchy &scene_hierarchy, const Point &light) {
+        if (hierarchy != &scene_hierarchy) {
+            // Another scene, its leaves mean nothing here
+            hierarchy = &scene_hierarchy;
+            for (Entry &e : entries) {
+                e = {};
+            }
+        }
+        uint64_t hash = bit_cast<uint32_t>(light.x) * 0x9e3779b97f4a7c15ull;
+        hash ^= bit_cast<uint32_t>(light.y) * 0xc2b2ae3d27d4eb4full;
+        hash ^= bit_cast<uint32_t>(light.z) * 0x165667b19e3779f9ull;
+        return entries[(hash >> 32) % OCCLUDER_CACHE_SIZE];
+    }
+};
+
+inline thread_local OccluderCache occluder_cache;
+
+// Cache counters of the calling thread since the last call
+inline OccluderCacheStats take_occluder_stats() {
+    const OccluderCacheStats stats = occluder_cache.stats;
+    occluder_cache.stats = {};
+    return stats;
+}
+
+// occluded(scene, ray, tmax, occluder) for a shadow ray towards light, trying the last occluder of that light first
+inline bool occluded_cached(const Scene &scene, const Point &light, const Ray &ray, const float tmax, LeafRange * occluder = nullptr) {
+    OccluderCache::Entry &e = occluder_cache.entry(scene.root, light);
+    occluder_cache.stats.lookups++;
+
+    if (e.light == light && e.leaf.first + e.leaf.count <= scene.root.spheres.size()) {
+        RT_STAT(shadow, leaves, 1);
+        RT_STAT(shadow, spheres, e.leaf.count);
+        float t = tmax;
+        if (intersect_leaf_index(scene.root, e.leaf.first, e.leaf.count, ray, t) >= 0) {
+            RT_STAT(shadow, rays, 1); // Counted by occluded() otherwise
+            occluder_cache.stats.hits++;
+            if (occluder != nullptr) {
+                *occluder = e.leaf;
+            }
+            return true;
+        }
+        occluder_cache.stats.misses++;
+    }
+
+    LeafRange leaf;
+    if (occluded(scene, ray, tmax, &leaf)) {
+        if (leaf.count > 0) {
+            e = {light, leaf}; // Nothing to remember when the occluder belongs to an instance
+        }
+        if (occluder != nullptr) {
+            *occluder = leaf;
+        }
+        return true;
+    }
+    return false;
+}
+
+#endif //OCCLUDER_CACHE_H
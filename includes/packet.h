@@ -0,0 +1,187 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+
+#include "AABB.h"
+#include "intersection.h"
+#include "scene.h"
+
+using namespace std;
+
+// Coherent rays (a tile of PACKET_WIDTH x PACKET_WIDTH primary rays) traverse the binary hierarchy together :
+// every node is fetched once for the whole packet, each ray having its own active bit in a mask.
+constexpr int PACKET_WIDTH = 8;
+constexpr int PACKET_SIZE = PACKET_WIDTH * PACKET_WIDTH;
+// Once fewer rays than this are still active in a subtree, they finish it one by one
+constexpr int PACKET_MIN_ACTIVE = 4;
+
+// Bounds of the origins and inverse directions of a packet, for a conservative whole packet box test
+struct PacketBounds {
+    Point omin, omax;
+    Point imin, imax;
+    bool usable; // False when a direction component changes sign or is zero somewhere in the packet
+
+    PacketBounds(const Ray * rays, const int count) : omin(rays[0].origin), omax(rays[0].origin),
+                                                      imin(inverse(rays[0])), imax(imin), usable(true) {
+        for (int i = 0; i < count; i++) {
+            const Point inv = inverse(rays[i]);
+            omin = omin.minp(rays[i].origin);
+            omax = omax.maxp(rays[i].origin);
+            imin = imin.minp(inv);
+            imax = imax.maxp(inv);
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            usable = usable && isfinite(imin[axis]) && isfinite(imax[axis]) && (imin[axis] > 0 || imax[axis] < 0);
+        }
+    }
+
+    static Point inverse(const Ray &ray) {
+        return {ray.inv_direction.x, ray.inv_direction.y, ray.inv_direction.z};
+    }
+
+    // False only if no ray of the packet can hit the box (interval arithmetic on the slab test)
+    [[nodiscard]] bool mayHit(const AABB &box) const {
+        if (!usable) {
+            return true;
+        }
+        float tnear = -INFINITY;
+        float tfar = INFINITY;
+        for (int axis = 0; axis < 3; axis++) {
+            // [box.pmin - omax, box.pmax - omin] * [imin, imax]
+            const float d[2] = {box.pmin[axis] - omax[axis], box.pmax[axis] - omin[axis]};
+            const float inv[2] = {imin[axis], imax[axis]};
+            float lo = INFINITY;
+            float hi = -INFINITY;
+            for (const float a : d) {
+                for (const float b : inv) {
+                    lo = min(lo, a * b);
+                    hi = max(hi, a * b);
+                }
+            }
+            tnear = max(tnear, lo);
+            tfar = min(tfar, hi);
+        }
+        return tnear <= tfar && tfar >= 0.0f;
+    }
+};
+
+// Rays of mask hitting the box before their own tmax
+inline uint64_t packet_box_mask(const AABB &box, const Ray * rays, uint64_t mask, const float * tmax) {
+    uint64_t hits = 0;
+    while (mask != 0) {
+        const int i = countr_zero(mask);
+        mask &= mask - 1;
+        if (intersect_aabb(box, rays[i], tmax[i]).has_value()) {
+            hits |= uint64_t{1} << i;
+        }
+    }
+    return hits;
+}
+
+// Closest hit of each of the count (<= PACKET_SIZE) rays, identical to intersectObjectHierarchy ray by ray
+inline void intersectPacket(const ObjectHierarchy &obj, const Ray * rays, const int count, optional<Intersection> * results) {
+    float tmax[PACKET_SIZE];
+    int64_t hit[PACKET_SIZE];
+    fill_n(tmax, count, INFINITY);
+    fill_n(hit, count, -1);
+
+    if (!obj.nodes.empty() && count > 0) {
+        const PacketBounds bounds = PacketBounds(rays, count);
+
+        struct StackEntry {
+            uint32_t node;
+            uint64_t mask; // Rays that hit the parent
+        };
+        StackEntry stack[HIERARCHY_MAX_DEPTH + 1];
+        int stack_size = 0;
+        stack[stack_size++] = {0, count == PACKET_SIZE ? ~uint64_t{0} : (uint64_t{1} << count) - 1};
+
+        while (stack_size > 0) {
+            const StackEntry entry = stack[--stack_size];
+            const HierarchyNode &node = obj.nodes[entry.node];
+
+            if (!bounds.mayHit(node.aabb)) {
+                continue;
+            }
+            RT_STAT(primary, boxes, popcount(entry.mask));
+            uint64_t mask = packet_box_mask(node.aabb, rays, entry.mask, tmax);
+            if (mask == 0) {
+                continue;
+            }
+
+            if (popcount(mask) < PACKET_MIN_ACTIVE) {
+                // The packet diverged, the remaining rays finish the subtree on their own
+                while (mask != 0) {
+                    const int i = countr_zero(mask);
+                    mask &= mask - 1;
+                    if (const optional<Intersection> it = intersectObjectHierarchy(obj, rays[i], entry.node, tmax[i]); it.has_value()) {
+                        tmax[i] = it.value().t;
+                        hit[i] = it.value().sphere - obj.spheres.data();
+                    }
+                }
+                continue;
+            }
+
+            if (node.isLeaf()) {
+                RT_STAT(primary, leaves, popcount(mask));
+                RT_STAT(primary, spheres, popcount(mask) * node.count);
+                while (mask != 0) {
+                    const int i = countr_zero(mask);
+                    mask &= mask - 1;
+                    if (const int64_t sphere = intersect_leaf_index(obj, node.offset, node.count, rays[i], tmax[i]); sphere >= 0) {
+                        hit[i] = sphere;
+                    }
+                }
+                continue;
+            }
+
+            RT_STAT(primary, nodes, popcount(mask));
+
+            // Nearest child first for the first active ray, the others are coherent enough to agree
+            const uint32_t left = entry.node + 1;
+            const uint32_t right = node.offset;
+            const Ray &ray = rays[countr_zero(mask)];
+            const Direction between = (obj.nodes[right].aabb.pmin - obj.nodes[left].aabb.pmin) + (obj.nodes[right].aabb.pmax - obj.nodes[left].aabb.pmax);
+            if (between.dot(ray.direction) >= 0) {
+                stack[stack_size++] = {right, mask};
+                stack[stack_size++] = {left, mask};
+            } else {
+                stack[stack_size++] = {left, mask};
+                stack[stack_size++] = {right, mask};
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (hit[i] >= 0) {
+            results[i] = Intersection(tmax[i], rays[i].origin + rays[i].direction * tmax[i], &obj.spheres[hit[i]]);
+        } else {
+            results[i] = nullopt;
+        }
+    }
+}
+
+// Packets always go through the binary hierarchy, which every scene has
+inline void intersect_packet(const Scene &scene, const Ray * rays, const int count, optional<Intersection> * results) {
+    RT_STAT(primary, rays, count);
+    intersectPacket(scene.root, rays, count, results);
+    // Instances are traced one ray at a time, only closer hits replace those of root
+    if (!scene.instances.empty()) {
+        for (int i = 0; i < count; i++) {
+            if (optional<Intersection> hit = intersectInstances(scene.instances, rays[i], results[i].has_value() ? results[i]->t : INFINITY); hit.has_value()) {
+                results[i] = hit;
+            }
+        }
+    }
+}
+
+#endif //PACKET_H
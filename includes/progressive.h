@@ -0,0 +1,168 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "util.h"
+#include "scene.h"
+#include "render.h"
+#include "scheduler.h"
+
+using namespace std;
+
+// Progressive preview : a first image from a coarse grid of pixels, then finer and finer grids until every pixel is
+// traced or the time budget runs out.
+// The first pass traces one pixel every first_step in both directions. Each following level halves the step and
+// traces the three missing pixels of every 2x2 cell of the grid, one pass per position, each pass covering the whole
+// image evenly. A traced pixel paints the step x step block below and to its right until a finer pass traces it
+// (nearest upsampling). Once the step is 1, every pixel has been shaded exactly as render_tile shades it.
+// A pass cut by the budget resumes where it stopped on the next call to refine().
+
+struct ProgressiveOptions {
+    int first_step = 16; // Power of 2, spacing of the pixels of the first pass
+    double budget_ms = 50.0; // Per call to refine()
+};
+
+// What the output callback receives after every pass
+struct ProgressiveFrame {
+    const float * framebuffer; // camera.width RGB floats per row, every pixel set
+    int step; // Block size of the finest pass so far
+    size_t pass;
+    size_t pass_count;
+    size_t traced; // Pixels shaded since the last reset
+    double ms; // Since the start of the call to refine()
+    bool complete; // Every pixel shaded
+};
+
+class ProgressiveRenderer {
+public:
+    ProgressiveRenderer(const Scene &scene, const Camera &camera, float * framebuffer, const ProgressiveOptions &options = {})
+        : scene(scene), camera(camera), framebuffer(framebuffer), options(options) {
+        if (this->options.first_step < 1 || (this->options.first_step & (this->options.first_step - 1)) != 0) {
+            throw invalid_argument("The first step of a progressive render must be a power of 2");
+        }
+        // Block size and position within the cells of twice its size of every pass
+        passes.push_back({this->options.first_step, 0, 0});
+        for (int step = this->options.first_step / 2; step >= 1; step /= 2) {
+            passes.push_back({step, step, step});
+            passes.push_back({step, 0, step});
+            passes.push_back({step, step, 0});
+        }
+        reset(camera);
+    }
+
+    // Starts again from the coarse grid, for a new point of view
+    void reset(const Camera &new_camera) {
+        camera = new_camera;
+        pass = 0;
+        traced = 0;
+        startPass();
+    }
+
+    [[nodiscard]] bool complete() const {
+        return pass == passes.size();
+    }
+
+    [[nodiscard]] size_t passCount() const {
+        return passes.size();
+    }
+
+    // Refines the image until the budget is spent or it is complete, output being called after every finished pass
+    // and once more if the budget cut a pass. Returns the frame of the last output.
+    ProgressiveFrame refine(TaskScheduler &scheduler, const function<void(const ProgressiveFrame &)> &output = nullptr) {
+        const auto begin = chrono::steady_clock::now();
+        const auto deadline = begin + chrono::duration<double, milli>(options.budget_ms);
+        const auto frame = [&] {
+            const int step = pass == 0 ? passes[0].step : passes[pass - 1].step;
+            return ProgressiveFrame{framebuffer, step, pass, passes.size(), traced, chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count(),
+                                    complete()};
+        };
+
+        atomic<bool> progressed = false; // Every call traces at least one row
+        bool cut = false;
+        while (!complete() && !cut) {
+            const Pass &p = passes[pass];
+            const int cell = pass == 0 ? p.step : 2 * p.step;
+            vector<size_t> row_pixels(rows.size(), 0);
+            // Rows started after the deadline are left for the next call
+            scheduler.run(rows.size(), [&](const size_t r, unsigned) {
+                if (row_done[r] || (pass > 0 && progressed && chrono::steady_clock::now() >= deadline)) {
+                    return;
+                }
+                row_pixels[r] = traceRow(rows[r], p, cell);
+                row_done[r] = 1;
+                progressed = true;
+            });
+            for (const size_t pixels : row_pixels) {
+                traced += pixels;
+            }
+            cut = count(row_done.begin(), row_done.end(), 0) > 0;
+            if (!cut) {
+                pass++;
+                if (!complete()) {
+                    startPass();
+                }
+                cut = chrono::steady_clock::now() >= deadline;
+            }
+            if (output) {
+                output(frame());
+            }
+        }
+        return frame();
+    }
+
+private:
+    struct Pass {
+        int step;
+        int di, dj; // Position of the traced pixel within its cell
+    };
+
+    const Scene &scene;
+    Camera camera;
+    float * framebuffer;
+    ProgressiveOptions options;
+    vector<Pass> passes;
+    size_t pass = 0;
+    size_t traced = 0;
+    vector<int> rows; // Of the current pass
+    vector<uint8_t> row_done;
+
+    void startPass() {
+        const Pass &p = passes[pass];
+        const int cell = pass == 0 ? p.step : 2 * p.step;
+        rows.clear();
+        for (int i = p.di; i < camera.height; i += cell) {
+            rows.push_back(i);
+        }
+        row_done.assign(rows.size(), 0);
+    }
+
+    // Pixels of row i traced by pass p, each painting its block, returns the number of pixels traced
+    size_t traceRow(const int i, const Pass &p, const int cell) const {
+        size_t pixels = 0;
+        const int i1 = min(i + p.step, camera.height);
+        for (int j = p.dj; j < camera.width; j += cell) {
+            const Color c = shade(scene, intersect(scene, camera.primaryRay(i, j)));
+            const int j1 = min(j + p.step, camera.width);
+            for (int y = i; y < i1; y++) {
+                for (int x = j; x < j1; x++) {
+                    store_color(framebuffer + (static_cast<size_t>(y) * camera.width + x) * 3, c);
+                }
+            }
+            pixels++;
+        }
+        return pixels;
+    }
+};
+
+#endif //PROGRESSIVE_H
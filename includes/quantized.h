@@ -0,0 +1,235 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef QUANTIZED_H
+#define QUANTIZED_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "AABB.h"
+#include "intersection.h"
+#include "wide.h"
+
+using namespace std;
+
+// Quantized hierarchy : a wide hierarchy whose children bounds are stored on 8 or 16 bits, relative to the box of
+// their node (an origin and a power of two step per axis). A 4 wide node takes 72 bytes with 8 bit bounds against
+// 160 for WideNode<4>. Bounds are rounded outwards, so a decoded box always contains the exact one and no hit is lost;
+// rays only visit a few more nodes. Traversal decodes each node into a WideNode and runs the usual slab test.
+
+static_assert(LEAF_SIZE < 256, "Leaf sizes are stored on 8 bits");
+
+template<int N, typename Q>
+struct QuantizedNode {
+    float origin[3]; // Lowest corner of the node box
+    float step[3]; // Powers of two, exact multiples of them are exactly representable
+    Q qmin[3][N]; // Child bounds : origin + q * step
+    Q qmax[3][N];
+    uint32_t child[N]; // Index of a QuantizedNode, or first sphere of a leaf
+    uint8_t count[N]; // Number of spheres of a leaf child, 0 for an inner child
+    uint8_t lanes;
+
+    // Bounds of the children as floats, into the layout the slab tests read
+    void decode(WideNode<N> &node) const {
+        for (int lane = 0; lane < N; lane++) {
+            node.min_x[lane] = origin[0] + static_cast<float>(qmin[0][lane]) * step[0];
+            node.min_y[lane] = origin[1] + static_cast<float>(qmin[1][lane]) * step[1];
+            node.min_z[lane] = origin[2] + static_cast<float>(qmin[2][lane]) * step[2];
+            node.max_x[lane] = origin[0] + static_cast<float>(qmax[0][lane]) * step[0];
+            node.max_y[lane] = origin[1] + static_cast<float>(qmax[1][lane]) * step[1];
+            node.max_z[lane] = origin[2] + static_cast<float>(qmax[2][lane]) * step[2];
+            node.child[lane] = child[lane];
+            node.count[lane] = count[lane];
+        }
+        node.lanes = lanes;
+    }
+};
+
+// Only one of the two arrays is filled, depending on the number of bits
+template<int N>
+struct QuantizedHierarchy {
+    vector<QuantizedNode<N, uint8_t>> nodes8;
+    vector<QuantizedNode<N, uint16_t>> nodes16;
+
+    [[nodiscard]] bool empty() const {
+        return nodes8.empty() && nodes16.empty();
+    }
+
+    [[nodiscard]] size_t bytes() const {
+        return nodes8.size() * sizeof(QuantizedNode<N, uint8_t>) + nodes16.size() * sizeof(QuantizedNode<N, uint16_t>);
+    }
+};
+
+// Quantized copy of a wide node, bounds rounded outwards
+template<int N, typename Q>
+QuantizedNode<N, Q> quantize_node(const WideNode<N> &wide) {
+    constexpr auto levels = static_cast<float>(numeric_limits<Q>::max());
+    const float * mins[3] = {wide.min_x, wide.min_y, wide.min_z};
+    const float * maxs[3] = {wide.max_x, wide.max_y, wide.max_z};
+
+    QuantizedNode<N, Q> node{};
+    node.lanes = static_cast<uint8_t>(wide.lanes);
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = INFINITY;
+        float hi = -INFINITY;
+        for (int lane = 0; lane < static_cast<int>(wide.lanes); lane++) {
+            lo = min(lo, mins[axis][lane]);
+            hi = max(hi, maxs[axis][lane]);
+        }
+        // Smallest power of two step with which levels steps cover the box
+        const float extent = max(hi - lo, numeric_limits<float>::min());
+        float step = ldexp(1.0f, static_cast<int>(ceil(log2(extent / levels))));
+        while (lo + levels * step < hi) {
+            step *= 2.0f; // extent itself was rounded
+        }
+        node.origin[axis] = lo;
+        node.step[axis] = step;
+
+        const auto decoded = [&](const float q) {
+            return lo + q * step;
+        };
+        for (int lane = 0; lane < N; lane++) {
+            if (lane >= static_cast<int>(wide.lanes)) {
+                node.qmin[axis][lane] = 0;
+                node.qmax[axis][lane] = 0;
+                continue;
+            }
+            // Rounded outwards, then corrected for the rounding of the decoding itself
+            float qlo = max(0.0f, floor((mins[axis][lane] - lo) / step));
+            while (qlo > 0.0f && decoded(qlo) > mins[axis][lane]) {
+                qlo--;
+            }
+            float qhi = min(levels, ceil((maxs[axis][lane] - lo) / step));
+            while (qhi < levels && decoded(qhi) < maxs[axis][lane]) {
+                qhi++;
+            }
+            node.qmin[axis][lane] = static_cast<Q>(qlo);
+            node.qmax[axis][lane] = static_cast<Q>(qhi);
+        }
+    }
+    for (int lane = 0; lane < N; lane++) {
+        node.child[lane] = wide.child[lane];
+        node.count[lane] = static_cast<uint8_t>(wide.count[lane]);
+    }
+    return node;
+}
+
+// Nodes keep the indices of the wide hierarchy, only their bounds change
+template<int N>
+QuantizedHierarchy<N> quantize_hierarchy(const WideHierarchy<N> &wide, const int bits) {
+    QuantizedHierarchy<N> quantized;
+    if (bits == 8) {
+        quantized.nodes8.reserve(wide.nodes.size());
+        for (const WideNode<N> &node : wide.nodes) {
+            quantized.nodes8.push_back(quantize_node<N, uint8_t>(node));
+        }
+    } else {
+        quantized.nodes16.reserve(wide.nodes.size());
+        for (const WideNode<N> &node : wide.nodes) {
+            quantized.nodes16.push_back(quantize_node<N, uint16_t>(node));
+        }
+    }
+    return quantized;
+}
+
+// --- Traversal, as for wide hierarchies ---
+
+template<int N, typename Q>
+std::optional<Intersection> intersectQuantizedNodes(const vector<QuantizedNode<N, Q>> &nodes, const ObjectHierarchy &obj, const Ray &ray) {
+    WideStackEntry stack[HIERARCHY_MAX_DEPTH * (N - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, -INFINITY};
+
+    std::optional<Intersection> closest = nullopt;
+    float tmax = INFINITY;
+    alignas(32) float tmin[N];
+    WideNode<N> node;
+
+    while (stack_size > 0) {
+        const WideStackEntry entry = stack[--stack_size];
+        if (entry.tmin > tmax) {
+            continue; // Farther than the closest hit
+        }
+
+        if (entry.count > 0) {
+            RT_STAT(primary, leaves, 1);
+            RT_STAT(primary, spheres, entry.count);
+            if (std::optional<Intersection> it = intersect_leaf(obj, entry.child, entry.count, ray, tmax); it.has_value()) {
+                tmax = it.value().t;
+                closest = it;
+            }
+            continue;
+        }
+
+        nodes[entry.child].decode(node);
+        RT_STAT(primary, nodes, 1);
+        RT_STAT(primary, boxes, node.lanes);
+        push_wide_children(node, wide_slab_test(node, ray, tmax, tmin), tmin, stack, stack_size);
+    }
+    return closest;
+}
+
+template<int N, typename Q>
+bool occludedQuantizedNodes(const vector<QuantizedNode<N, Q>> &nodes, const ObjectHierarchy &obj, const Ray &ray, const float tmax, LeafRange * occluder) {
+    uint32_t stack[HIERARCHY_MAX_DEPTH * (N - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    alignas(32) float tmin[N];
+    WideNode<N> node;
+
+    while (stack_size > 0) {
+        nodes[stack[--stack_size]].decode(node);
+        RT_STAT(shadow, nodes, 1);
+        RT_STAT(shadow, boxes, node.lanes);
+        int mask = wide_slab_test(node, ray, tmax, tmin);
+
+        while (mask != 0) {
+            const int lane = countr_zero(static_cast<unsigned>(mask));
+            mask &= mask - 1;
+
+            if (node.count[lane] > 0) {
+                RT_STAT(shadow, leaves, 1);
+                RT_STAT(shadow, spheres, node.count[lane]);
+                float t = tmax;
+                if (intersect_leaf_index(obj, node.child[lane], node.count[lane], ray, t) >= 0) {
+                    if (occluder != nullptr) {
+                        *occluder = {node.child[lane], node.count[lane]};
+                    }
+                    return true;
+                }
+            } else {
+                stack[stack_size++] = node.child[lane];
+            }
+        }
+    }
+    return false;
+}
+
+template<int N>
+std::optional<Intersection> intersectQuantizedHierarchy(const QuantizedHierarchy<N> &quantized, const ObjectHierarchy &obj, const Ray &ray) {
+    if (!quantized.nodes8.empty()) {
+        return intersectQuantizedNodes(quantized.nodes8, obj, ray);
+    }
+    if (!quantized.nodes16.empty()) {
+        return intersectQuantizedNodes(quantized.nodes16, obj, ray);
+    }
+    return nullopt;
+}
+
+template<int N>
+bool occludedQuantizedHierarchy(const QuantizedHierarchy<N> &quantized, const ObjectHierarchy &obj, const Ray &ray, const float tmax, LeafRange * occluder = nullptr) {
+    if (!quantized.nodes8.empty()) {
+        return occludedQuantizedNodes(quantized.nodes8, obj, ray, tmax, occluder);
+    }
+    if (!quantized.nodes16.empty()) {
+        return occludedQuantizedNodes(quantized.nodes16, obj, ray, tmax, occluder);
+    }
+    return false;
+}
+
+#endif //QUANTIZED_H
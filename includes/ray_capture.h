@@ -0,0 +1,254 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef RAY_CAPTURE_H
+#define RAY_CAPTURE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ray.h"
+#include "intersection.h"
+#include "mapped_file.h"
+#include "scene_file.h"
+#include "bvh_cache.h"
+#include "scheduler.h"
+
+using namespace std;
+
+// Rays of a render saved to a file, to time traversal kernels on them alone (see ray_replay.cpp).
+// While ray_capture_enabled is set, render_tile records every primary ray and visibility() every shadow ray, with the
+// answer the scene gave, into buffers of the calling thread that the renderer takes after each tile
+// (take_captured_rays), so that the file holds them in tile order whatever the thread count.
+// The file is a header followed by blocks of rays of one kind, its header naming the scene they were traced in.
+
+constexpr char RAY_CAPTURE_MAGIC[8] = {'R', 'T', 'R', 'A', 'Y', 'S', '\0', '\0'};
+constexpr uint32_t RAY_CAPTURE_VERSION = 1;
+
+enum class RayKind : uint32_t { Primary, Shadow };
+
+struct CapturedRay {
+    float origin[3];
+    float direction[3];
+    float tmax; // INFINITY for primary rays
+    float result; // Primary : distance to the closest hit, INFINITY for a miss. Shadow : 1 when blocked, 0 otherwise
+
+    [[nodiscard]] Ray ray() const {
+        return {Point(origin[0], origin[1], origin[2]), Direction(direction[0], direction[1], direction[2])};
+    }
+};
+
+static_assert(is_trivially_copyable_v<CapturedRay> && sizeof(CapturedRay) == 8 * sizeof(float), "CapturedRay is stored as is");
+
+struct CapturedRays {
+    vector<CapturedRay> primary;
+    vector<CapturedRay> shadow;
+};
+
+// Set while no render runs
+inline bool ray_capture_enabled = false;
+
+inline thread_local CapturedRays captured_rays;
+
+inline CapturedRay make_captured_ray(const Ray &ray, const float tmax, const float result) {
+    return {{ray.origin.x, ray.origin.y, ray.origin.z}, {ray.direction.x, ray.direction.y, ray.direction.z}, tmax, result};
+}
+
+inline void capture_primary(const Ray &ray, const optional<Intersection> &hit) {
+    if (ray_capture_enabled) {
+        captured_rays.primary.push_back(make_captured_ray(ray, INFINITY, hit.has_value() ? hit->t : INFINITY));
+    }
+}
+
+inline void capture_shadow(const Ray &ray, const float tmax, const bool blocked) {
+    if (ray_capture_enabled) {
+        captured_rays.shadow.push_back(make_captured_ray(ray, tmax, blocked ? 1.0f : 0.0f));
+    }
+}
+
+// Rays captured by the calling thread since the last call
+inline CapturedRays take_captured_rays() {
+    return exchange(captured_rays, {});
+}
+
+// Identifies the scene : spheres and lights in their input order
+inline uint64_t scene_key(const SceneDescription &scene) {
+    const uint64_t key = hash_bytes(scene.spheres.data(), scene.spheres.size() * sizeof(Sphere));
+    return hash_bytes(scene.lights.data(), scene.lights.size() * sizeof(Light), key);
+}
+
+struct RayCaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t ray_size; // sizeof(CapturedRay) when the file was written
+    uint64_t scene_key;
+    uint64_t primary_count;
+    uint64_t shadow_count;
+    int32_t width;
+    int32_t height;
+};
+
+// A block : its kind and ray count, then the rays
+struct RayBlockHeader {
+    RayKind kind;
+    uint32_t count;
+};
+
+class RayCaptureWriter {
+public:
+    RayCaptureWriter(const string &path, const uint64_t key, const int width, const int height) : path(path), out(path, ios::binary) {
+        if (!out) {
+            throw runtime_error("Cannot open " + path);
+        }
+        memcpy(header.magic, RAY_CAPTURE_MAGIC, sizeof header.magic);
+        header.version = RAY_CAPTURE_VERSION;
+        header.ray_size = sizeof(CapturedRay);
+        header.scene_key = key;
+        header.width = width;
+        header.height = height;
+        // Rewritten with the counts by finish()
+        out.write(reinterpret_cast<const char *>(&header), sizeof header);
+    }
+
+    // Closes the file like finish(), an error going unreported
+    ~RayCaptureWriter() {
+        close();
+    }
+
+    void write(const CapturedRays &rays) {
+        writeBlock(RayKind::Primary, rays.primary);
+        writeBlock(RayKind::Shadow, rays.shadow);
+        header.primary_count += rays.primary.size();
+        header.shadow_count += rays.shadow.size();
+    }
+
+    void finish() {
+        if (!close()) {
+            throw runtime_error("Cannot write " + path);
+        }
+    }
+
+    [[nodiscard]] const RayCaptureHeader &counts() const {
+        return header;
+    }
+
+private:
+    string path;
+    ofstream out;
+    RayCaptureHeader header{};
+
+    // False when the file could not be written, ofstream reporting errors through its state only
+    bool close() {
+        if (!out.is_open()) {
+            return true;
+        }
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(&header), sizeof header);
+        out.close();
+        return !out.fail();
+    }
+
+    void writeBlock(const RayKind kind, const vector<CapturedRay> &rays) {
+        for (size_t first = 0; first < rays.size(); first += UINT32_MAX) {
+            const RayBlockHeader block{kind, static_cast<uint32_t>(min<size_t>(UINT32_MAX, rays.size() - first))};
+            out.write(reinterpret_cast<const char *>(&block), sizeof block);
+            out.write(reinterpret_cast<const char *>(rays.data() + first), static_cast<streamsize>(block.count * sizeof(CapturedRay)));
+        }
+    }
+};
+
+struct RayCapture {
+    RayCaptureHeader header;
+    CapturedRays rays;
+};
+
+inline RayCapture load_ray_capture(const string &path) {
+    const MappedFile file(path);
+    if (file.size() < sizeof(RayCaptureHeader) || memcmp(file.data(), RAY_CAPTURE_MAGIC, sizeof RAY_CAPTURE_MAGIC) != 0) {
+        throw runtime_error(path + " is not a ray capture");
+    }
+    RayCapture capture{*file.array<RayCaptureHeader>(0, 1), {}};
+    if (capture.header.version != RAY_CAPTURE_VERSION || capture.header.ray_size != sizeof(CapturedRay)) {
+        throw runtime_error(path + " was written by an incompatible version");
+    }
+    const uint64_t most = file.size() / sizeof(CapturedRay);
+    capture.rays.primary.reserve(min(capture.header.primary_count, most));
+    capture.rays.shadow.reserve(min(capture.header.shadow_count, most));
+
+    // Blocks follow each other, a header being 8 bytes and a ray 32, everything stays 4 byte aligned
+    uint64_t offset = sizeof(RayCaptureHeader);
+    while (offset < file.size()) {
+        const RayBlockHeader &block = *file.array<RayBlockHeader>(offset, 1);
+        if (block.kind != RayKind::Primary && block.kind != RayKind::Shadow) {
+            throw runtime_error(path + " is corrupted");
+        }
+        offset += sizeof(RayBlockHeader);
+        const CapturedRay * rays = file.array<CapturedRay>(offset, block.count);
+        offset += block.count * sizeof(CapturedRay);
+        vector<CapturedRay> &kind = block.kind == RayKind::Primary ? capture.rays.primary : capture.rays.shadow;
+        kind.insert(kind.end(), rays, rays + block.count);
+    }
+    if (capture.rays.primary.size() != capture.header.primary_count || capture.rays.shadow.size() != capture.header.shadow_count) {
+        throw runtime_error(path + " is truncated");
+    }
+    return capture;
+}
+
+// --- Replay ---
+
+// Rays per replay task
+constexpr size_t REPLAY_CHUNK = 4096;
+
+struct ReplayStats {
+    size_t rays = 0;
+    size_t agreeing = 0; // Giving the captured answer
+    double ms = 0.0;
+
+    [[nodiscard]] double mraysPerSecond() const {
+        return static_cast<double>(rays) / max(1e-9, ms) / 1000.0;
+    }
+
+    [[nodiscard]] double agreement() const {
+        return rays == 0 ? 1.0 : static_cast<double>(agreeing) / static_cast<double>(rays);
+    }
+};
+
+// Same miss or blocking answer, hit distances within float rounding of another traversal order
+inline bool replay_agrees(const RayKind kind, const float captured, const float result) {
+    if (kind == RayKind::Shadow || isinf(captured) || isinf(result)) {
+        return captured == result;
+    }
+    return abs(captured - result) <= 1e-4f * max(1.0f, abs(captured));
+}
+
+// Times kernel(rays, count, results) over rays, REPLAY_CHUNK at a time on the threads of scheduler, then compares
+// its results (same meaning as CapturedRay::result) with the captured ones
+template<typename Kernel>
+ReplayStats replay_rays(TaskScheduler &scheduler, const vector<CapturedRay> &rays, const RayKind kind, const Kernel &kernel) {
+    vector<float> results(rays.size());
+    const auto begin = chrono::steady_clock::now();
+    scheduler.run((rays.size() + REPLAY_CHUNK - 1) / REPLAY_CHUNK, [&](const size_t chunk, unsigned) {
+        const size_t first = chunk * REPLAY_CHUNK;
+        kernel(rays.data() + first, min(REPLAY_CHUNK, rays.size() - first), results.data() + first);
+    });
+    ReplayStats stats;
+    stats.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    stats.rays = rays.size();
+    for (size_t r = 0; r < rays.size(); r++) {
+        stats.agreeing += replay_agrees(kind, rays[r].result, results[r]);
+    }
+    return stats;
+}
+
+#endif //RAY_CAPTURE_H
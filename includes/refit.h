@@ -0,0 +1,357 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef REFIT_H
+#define REFIT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "AABB.h"
+#include "builder.h"
+#include "intersection.h"
+
+using namespace std;
+
+// Refit : when spheres move, the tree is kept and only its boxes are recomputed, bottom-up, in one linear pass.
+// Boxes grow as the spheres they group drift apart, so the SAH cost of the tree is tracked against its cost when built :
+// subtrees that degraded too much are rebuilt in place, the whole tree if it degraded as a whole.
+
+struct RefitOptions {
+    float rebuild_threshold = 1.3f; // SAH cost of a subtree over its cost when built, above which it is rebuilt
+    float full_rebuild_threshold = 1.6f; // Same for the whole tree
+    unsigned threads = max(1u, thread::hardware_concurrency());
+};
+
+struct RefitStats {
+    double refit_ms = 0.0;
+    double rebuild_ms = 0.0;
+    float sah_cost = 0.0f;
+    float degradation = 1.0f; // SAH cost over the cost after the last full build
+    size_t rebuilt_subtrees = 0;
+    bool full_rebuild = false;
+};
+
+// Subtrees are cut at most this deep, so that a rebuilt subtree (at most HIERARCHY_MAX_DEPTH - 8 levels) still fits the traversal stack
+constexpr int REFIT_MAX_SUBTREE_DEPTH = 6;
+
+class HierarchyRefitter {
+public:
+    // hierarchy must outlive the refitter, it is modified in place by refit()
+    explicit HierarchyRefitter(ObjectHierarchy &hierarchy, const BuildOptions &build = {}, const RefitOptions &options = {})
+        : hierarchy(hierarchy), build(build), options(options) {
+        partition();
+        resetReferences();
+    }
+
+    // Moves the spheres to their new geometry (given in the order they were first given to the builder) and refits
+    RefitStats refit(const span<const Sphere> spheres) {
+        RefitStats stats;
+        auto begin = chrono::steady_clock::now();
+
+        if (spheres.size() != hierarchy.spheres.size() || hierarchy.nodes.empty()) {
+            rebuild(spheres, stats);
+            return stats;
+        }
+
+        // Writable pointers taken once, a mapped hierarchy is copied here rather than by every thread
+        Pointers p{hierarchy.nodes.data(), hierarchy.spheres.data(), hierarchy.indices.data(),
+                   {hierarchy.arrays.x.data(), hierarchy.arrays.y.data(), hierarchy.arrays.z.data(), hierarchy.arrays.radius2.data()}};
+
+        // Subtrees are independent, top nodes only depend on subtree roots
+        forEach(subtrees.size(), [&](const size_t k) {
+            Subtree &subtree = subtrees[k];
+            subtree.weighted_cost = refitRange(p, spheres, subtree);
+            subtree.cost = subtree.weighted_cost / max(p.nodes[subtree.root].aabb.area(), 1e-30f);
+        });
+        double weighted = 0.0;
+        for (const Subtree &subtree : subtrees) {
+            weighted += subtree.weighted_cost;
+        }
+        for (const uint32_t n : top_nodes) {
+            weighted += refitNode(p, n);
+        }
+        stats.sah_cost = static_cast<float>(weighted / max(p.nodes[0].aabb.area(), 1e-30f));
+        stats.degradation = stats.sah_cost / reference_cost;
+        stats.refit_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+
+        if (stats.degradation > options.full_rebuild_threshold) {
+            rebuild(spheres, stats);
+            return stats;
+        }
+
+        vector<size_t> degraded;
+        for (size_t k = 0; k < subtrees.size(); k++) {
+            if (subtrees[k].cost > options.rebuild_threshold * subtrees[k].reference) {
+                degraded.push_back(k);
+            }
+        }
+        if (!degraded.empty()) {
+            begin = chrono::steady_clock::now();
+            rebuildSubtrees(degraded);
+            stats.rebuilt_subtrees = degraded.size();
+            stats.sah_cost = sah_cost(hierarchy, build.traversal_cost, build.intersection_cost);
+            stats.degradation = stats.sah_cost / reference_cost;
+            stats.rebuild_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        }
+        return stats;
+    }
+
+private:
+    // Contiguous piece of the tree : nodes [root, node_end[ and spheres [sphere_begin, sphere_end[
+    struct Subtree {
+        uint32_t root, node_end;
+        uint32_t sphere_begin, sphere_end;
+        float reference = 0.0f; // SAH cost (relative to the subtree root) when built
+        float cost = 0.0f;
+        double weighted_cost = 0.0; // Sum of area * cost over the nodes
+    };
+
+    struct Pointers {
+        HierarchyNode * nodes;
+        Sphere * spheres;
+        uint32_t * indices;
+        float * arrays[4];
+    };
+
+    ObjectHierarchy &hierarchy;
+    BuildOptions build;
+    RefitOptions options;
+    vector<Subtree> subtrees; // In depth-first order
+    vector<uint32_t> top_nodes; // Nodes above the subtrees, children before parents
+    float reference_cost = 1.0f;
+
+    [[nodiscard]] float nodeCost(const HierarchyNode &node) const {
+        return node.isLeaf() ? build.intersection_cost * static_cast<float>(node.count) : build.traversal_cost;
+    }
+
+    // Cuts the tree into enough subtrees to keep every thread busy, splitting the largest one each time
+    void partition() {
+        subtrees.clear();
+        top_nodes.clear();
+        if (hierarchy.nodes.empty()) {
+            return;
+        }
+        const Storage<HierarchyNode> &nodes = hierarchy.nodes;
+
+        struct Candidate {
+            uint32_t root;
+            int depth;
+        };
+        vector<Candidate> frontier = {{0, 0}};
+        const size_t target = max<size_t>(32, options.threads * 4);
+
+        const auto sphere_count = [&](const uint32_t root) {
+            return subtreeSpheres(root).second - subtreeSpheres(root).first;
+        };
+        while (frontier.size() < target) {
+            size_t largest = frontier.size();
+            for (size_t i = 0; i < frontier.size(); i++) {
+                if (!nodes[frontier[i].root].isLeaf() && frontier[i].depth < REFIT_MAX_SUBTREE_DEPTH &&
+                    (largest == frontier.size() || sphere_count(frontier[i].root) > sphere_count(frontier[largest].root))) {
+                    largest = i;
+                }
+            }
+            if (largest == frontier.size()) {
+                break;
+            }
+            const Candidate split = frontier[largest];
+            top_nodes.push_back(split.root);
+            frontier[largest] = {split.root + 1, split.depth + 1};
+            frontier.push_back({nodes[split.root].offset, split.depth + 1});
+        }
+
+        sort(frontier.begin(), frontier.end(), [](const Candidate &a, const Candidate &b) { return a.root < b.root; });
+        for (const Candidate &candidate : frontier) {
+            const auto [sphere_begin, sphere_end] = subtreeSpheres(candidate.root);
+            subtrees.push_back({candidate.root, subtreeEnd(candidate.root), sphere_begin, sphere_end});
+        }
+        sort(top_nodes.begin(), top_nodes.end(), greater());
+    }
+
+    // Reference costs are those of the tree as it is now
+    void resetReferences() {
+        for (Subtree &subtree : subtrees) {
+            subtree.reference = subtreeCost(subtree);
+        }
+        reference_cost = max(sah_cost(hierarchy, build.traversal_cost, build.intersection_cost), 1e-30f);
+    }
+
+    [[nodiscard]] float subtreeCost(const Subtree &subtree) const {
+        const Storage<HierarchyNode> &nodes = hierarchy.nodes;
+        double weighted = 0.0;
+        for (uint32_t n = subtree.root; n < subtree.node_end; n++) {
+            weighted += nodes[n].aabb.area() * nodeCost(nodes[n]);
+        }
+        return static_cast<float>(weighted / max(nodes[subtree.root].aabb.area(), 1e-30f));
+    }
+
+    // One past the last node of the subtree of root, the last node in depth-first order being its rightmost leaf
+    [[nodiscard]] uint32_t subtreeEnd(uint32_t root) const {
+        while (!hierarchy.nodes[root].isLeaf()) {
+            root = hierarchy.nodes[root].offset;
+        }
+        return root + 1;
+    }
+
+    // Range of spheres under root, from its leftmost leaf to its rightmost one
+    [[nodiscard]] pair<uint32_t, uint32_t> subtreeSpheres(const uint32_t root) const {
+        uint32_t left = root;
+        while (!hierarchy.nodes[left].isLeaf()) {
+            left++;
+        }
+        const HierarchyNode &right = hierarchy.nodes[subtreeEnd(root) - 1];
+        return {hierarchy.nodes[left].offset, right.offset + right.count};
+    }
+
+    // New box of node n from its spheres or its children (already refitted), returns its area times its cost
+    double refitNode(const Pointers &p, const uint32_t n) const {
+        HierarchyNode &node = p.nodes[n];
+        if (node.isLeaf()) {
+            AABB aabb = AABB::empty();
+            for (uint32_t s = node.offset; s < node.offset + node.count; s++) {
+                aabb = aabb.unionAABB(sphere_to_aabb(p.spheres[s]));
+            }
+            node.aabb = aabb;
+        } else {
+            node.aabb = p.nodes[n + 1].aabb.unionAABB(p.nodes[node.offset].aabb);
+        }
+        return node.aabb.area() * nodeCost(node);
+    }
+
+    // Copies the new geometry of the subtree spheres, then refits its nodes from the last one up
+    double refitRange(const Pointers &p, const span<const Sphere> spheres, const Subtree &subtree) const {
+        for (uint32_t s = subtree.sphere_begin; s < subtree.sphere_end; s++) {
+            const Sphere &sphere = spheres[p.indices[s]];
+            p.spheres[s] = sphere;
+            p.arrays[0][s] = sphere.center.x;
+            p.arrays[1][s] = sphere.center.y;
+            p.arrays[2][s] = sphere.center.z;
+            p.arrays[3][s] = sq(sphere.radius);
+        }
+        double weighted = 0.0;
+        for (uint32_t n = subtree.node_end; n-- > subtree.root;) {
+            weighted += refitNode(p, n);
+        }
+        return weighted;
+    }
+
+    // task(0) ... task(count - 1) over the refit threads
+    template<typename Task>
+    void forEach(const size_t count, const Task &task) const {
+        atomic<size_t> next = 0;
+        const auto work = [&] {
+            for (size_t k; (k = next++) < count;) {
+                task(k);
+            }
+        };
+        vector<future<void>> helpers;
+        for (size_t t = 1; t < min<size_t>(options.threads, count); t++) {
+            helpers.push_back(async(launch::async, work));
+        }
+        work();
+        for (future<void> &helper : helpers) {
+            helper.get();
+        }
+    }
+
+    void rebuild(const span<const Sphere> spheres, RefitStats &stats) {
+        const auto begin = chrono::steady_clock::now();
+        BuildStats build_stats;
+        hierarchy = build_hierarchy(vector(spheres.begin(), spheres.end()), build, &build_stats);
+        partition();
+        resetReferences();
+        stats.full_rebuild = true;
+        stats.sah_cost = build_stats.sah_cost;
+        stats.degradation = 1.0f;
+        stats.rebuild_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    }
+
+    // Rebuilds the degraded subtrees from their current spheres and splices them into a new node array
+    void rebuildSubtrees(const vector<size_t> &degraded) {
+        vector<ObjectHierarchy> rebuilt(subtrees.size());
+        vector<char> is_rebuilt(subtrees.size(), 0);
+        for (const size_t k : degraded) {
+            is_rebuilt[k] = 1;
+        }
+
+        BuildOptions subtree_build = build;
+        subtree_build.threads = 1;
+        const Storage<Sphere> &current = hierarchy.spheres;
+        forEach(degraded.size(), [&](const size_t i) {
+            const Subtree &subtree = subtrees[degraded[i]];
+            rebuilt[degraded[i]] = build_hierarchy(vector(current.begin() + subtree.sphere_begin, current.begin() + subtree.sphere_end), subtree_build);
+        });
+
+        // Spheres of a rebuilt subtree are reordered within its range, with the input positions following them
+        const Storage<uint32_t> &old_indices = hierarchy.indices;
+        vector<uint32_t> indices(old_indices.begin(), old_indices.end());
+        vector<Sphere> spheres(current.begin(), current.end());
+        for (const size_t k : degraded) {
+            const Subtree &subtree = subtrees[k];
+            for (uint32_t j = 0; j < subtree.sphere_end - subtree.sphere_begin; j++) {
+                spheres[subtree.sphere_begin + j] = rebuilt[k].spheres[j];
+                indices[subtree.sphere_begin + j] = old_indices[subtree.sphere_begin + rebuilt[k].indices[j]];
+            }
+        }
+
+        vector<HierarchyNode> nodes;
+        nodes.reserve(hierarchy.nodes.size());
+        splice(0, nodes, rebuilt, is_rebuilt);
+
+        hierarchy.nodes = std::move(nodes);
+        hierarchy.spheres = std::move(spheres);
+        hierarchy.indices = std::move(indices);
+        hierarchy.updateArrays();
+
+        // The subtrees are cut at the same places, only the rebuilt ones get a new reference
+        vector<float> references;
+        for (const Subtree &subtree : subtrees) {
+            references.push_back(subtree.reference);
+        }
+        partition();
+        for (size_t k = 0; k < subtrees.size() && k < references.size(); k++) {
+            subtrees[k].reference = is_rebuilt[k] ? subtreeCost(subtrees[k]) : references[k];
+        }
+    }
+
+    // Appends the subtree of the old node n to nodes, rebuilt subtrees replacing the old ones, and returns its new index
+    uint32_t splice(const uint32_t n, vector<HierarchyNode> &nodes, const vector<ObjectHierarchy> &rebuilt, const vector<char> &is_rebuilt) const {
+        const auto base = static_cast<uint32_t>(nodes.size());
+        const auto subtree = lower_bound(subtrees.begin(), subtrees.end(), n, [](const Subtree &s, const uint32_t root) { return s.root < root; });
+
+        if (subtree != subtrees.end() && subtree->root == n) {
+            const auto k = static_cast<size_t>(subtree - subtrees.begin());
+            if (is_rebuilt[k]) {
+                for (HierarchyNode node : rebuilt[k].nodes) {
+                    node.offset += node.isLeaf() ? subtree->sphere_begin : base;
+                    nodes.push_back(node);
+                }
+            } else {
+                for (uint32_t i = subtree->root; i < subtree->node_end; i++) {
+                    HierarchyNode node = hierarchy.nodes[i];
+                    if (!node.isLeaf()) {
+                        node.offset = node.offset - subtree->root + base;
+                    }
+                    nodes.push_back(node);
+                }
+            }
+            return base;
+        }
+
+        nodes.push_back(hierarchy.nodes[n]);
+        splice(n + 1, nodes, rebuilt, is_rebuilt);
+        const uint32_t right = splice(hierarchy.nodes[n].offset, nodes, rebuilt, is_rebuilt);
+        nodes[base].offset = right;
+        return base;
+    }
+};
+
+#endif //REFIT_H
@@ -0,0 +1,213 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <algorithm>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "util.h"
+#include "ray.h"
+#include "intersection.h"
+#include "scene.h"
+#include "light_tree.h"
+#include "occluder_cache.h"
+#include "packet.h"
+#include "stats.h"
+#include "ray_capture.h"
+
+using namespace std;
+
+// Pinhole camera looking down +z, the image plane being z = 0 with pixels 2 units apart
+struct Camera {
+    int width;
+    int height;
+    float focal = 10000.0;
+
+    Camera(const int width, const int height) : width(width), height(height) {}
+
+    // Primary ray through the corner of pixel (i, j), i being the row, or (di, dj) pixels further inside the pixel
+    [[nodiscard]] Ray primaryRay(const int i, const int j, const float di = 0.0f, const float dj = 0.0f) const {
+        const auto y = static_cast<float>(i) + di;
+        const auto x = static_cast<float>(j) + dj;
+
+        const Point pixel = Point{static_cast<float>(x * 2.0 - width),static_cast<float>(y * 2.0 - height),0.0};
+
+        const Point focalPoint = Point{0.0,0.0,-focal};
+        const Direction direction = pixel - focalPoint;
+
+        return {pixel, direction.normalize()};
+    }
+};
+
+inline Color background() {
+    return {40.0f, 40.0f, 40.0f};
+}
+
+/*Calculates light visibility for a given light and point, the leaf of the blocking sphere being written to occluder*/
+inline float visibility(const Scene& S, const Light &l, const Point p, LeafRange * occluder = nullptr) {
+    const Direction to_light = l.position - p;
+    const float light_distance = to_light.length();
+    const Direction dir = to_light / light_distance;
+    const auto r = Ray(p + dir * 0.1, dir);
+
+    // The ray starts 0.1 away from p, anything closer to p than the light blocks it
+    const bool blocked = S.cache_occluders ? occluded_cached(S, l.position, r, light_distance - 0.1f, occluder)
+                                           : occluded(S, r, light_distance - 0.1f, occluder);
+    capture_shadow(r, light_distance - 0.1f, blocked);
+    return blocked ? 0 : 1;
+}
+
+/*Sum of the contributions of lights to a hit of normal N.
+  The first sphere of every leaf blocking a shadow ray is appended to occluders when given.*/
+inline Color direct_lighting(const Scene &S, const Intersection &hit, const Direction &N, const span<const Light> lights,
+                             vector<uint32_t> * occluders = nullptr) {
+    Color v = Color::black();
+
+    for (const Light &l : lights) {
+        // Occluded lights contribute nothing, no need to shade them
+        LeafRange occluder;
+        const float light_visibility = visibility(S, l, hit.intersection, occluders != nullptr ? &occluder : nullptr);
+        if (light_visibility == 0) {
+            if (occluders != nullptr && occluder.count > 0 && (occluders->empty() || occluders->back() != occluder.first)) {
+                occluders->push_back(occluder.first);
+            }
+            continue;
+        }
+
+        const Direction to_light = l.position - hit.intersection;
+        const float light_distance = to_light.length_squared();
+
+        const float cos = to_light.normalize().dot(N);
+
+        const Color light_contribution = (hit.sphere->albedo * (cos / light_distance)) * l.intensity;
+
+        v = v + light_contribution * light_visibility;
+    }
+    return v;
+}
+
+/*Direct lighting of a primary hit, or the background*/
+inline Color shade(const Scene &S, const optional<Intersection> &it_m, vector<uint32_t> * occluders = nullptr) {
+    if (!it_m.has_value()) {
+        return background();
+    }
+
+    const Direction N = (it_m.value().intersection - it_m.value().center).normalize();
+
+    Color v;
+    if (S.light_tree.empty()) {
+        v = direct_lighting(S, it_m.value(), N, S.lights, occluders);
+    } else {
+        // Only the clusters of lights that matter to this point are shaded
+        Light selected[LIGHT_TREE_MAX_CUT];
+        const int count = S.light_tree.select(it_m.value().intersection, N, selected);
+        v = direct_lighting(S, it_m.value(), N, span<const Light>(selected, count), occluders);
+    }
+    v.cap();
+    return v;
+}
+
+inline void store_color(float * pixel, const Color &c) {
+    pixel[0] = c.red;
+    pixel[1] = c.green;
+    pixel[2] = c.blue;
+}
+
+// --- Tiles ---
+
+// Multiple of PACKET_WIDTH so that tiles split into whole packets
+constexpr int TILE_SIZE = 32;
+
+// Pixels [i0, i1[ x [j0, j1[ of the image
+struct Tile {
+    int i0, j0, i1, j1;
+
+    [[nodiscard]] int pixels() const {
+        return (i1 - i0) * (j1 - j0);
+    }
+};
+
+// Tiles covering rows [first_row, last_row[ (the whole image by default)
+inline vector<Tile> make_tiles(const int width, const int height, const int size = TILE_SIZE, const int first_row = 0, int last_row = -1) {
+    if (last_row < 0) {
+        last_row = height;
+    }
+    vector<Tile> tiles;
+    for (int i = first_row; i < last_row; i += size) {
+        for (int j = 0; j < width; j += size) {
+            tiles.push_back({i, j, min(i + size, last_row), min(j + size, width)});
+        }
+    }
+    return tiles;
+}
+
+// Renders a tile into framebuffer (camera.width RGB floats per row, starting at row first_row),
+// tracing primary rays as packets or one by one.
+// With RT_STATS, cost (laid out like framebuffer, one float per pixel) receives the traversal cost of each pixel.
+inline void render_tile(const Scene &S, const Camera &camera, const Tile &tile, float * framebuffer, const bool packets,
+                        const int first_row = 0, float * cost = nullptr) {
+    const auto offset = [&](const int i, const int j) {
+        return static_cast<size_t>(i - first_row) * camera.width + j;
+    };
+    const auto pixel = [&](const int i, const int j) {
+        return framebuffer + offset(i, j) * 3;
+    };
+    const bool count = ray_stats_enabled && cost != nullptr;
+
+    if (!packets) {
+        for (int i = tile.i0; i < tile.i1; i++) {
+            for (int j = tile.j0; j < tile.j1; j++) {
+                const uint64_t before = ray_stats_cost();
+                const Ray ray = camera.primaryRay(i, j);
+                const optional<Intersection> hit = intersect(S, ray);
+                capture_primary(ray, hit);
+                store_color(pixel(i, j), shade(S, hit));
+                if (count) {
+                    cost[offset(i, j)] = static_cast<float>(ray_stats_cost() - before);
+                }
+            }
+        }
+        return;
+    }
+
+    vector<Ray> rays;
+    rays.reserve(PACKET_SIZE);
+    optional<Intersection> hits[PACKET_SIZE];
+    for (int pi = tile.i0; pi < tile.i1; pi += PACKET_WIDTH) {
+        for (int pj = tile.j0; pj < tile.j1; pj += PACKET_WIDTH) {
+            const int ph = min(PACKET_WIDTH, tile.i1 - pi);
+            const int pw = min(PACKET_WIDTH, tile.j1 - pj);
+
+            rays.clear();
+            for (int i = 0; i < ph; i++) {
+                for (int j = 0; j < pw; j++) {
+                    rays.push_back(camera.primaryRay(pi + i, pj + j));
+                }
+            }
+            const uint64_t before = ray_stats_cost();
+            intersect_packet(S, rays.data(), ph * pw, hits);
+            // The packet traversal is shared evenly between its rays
+            const float packet_cost = static_cast<float>(ray_stats_cost() - before) / static_cast<float>(ph * pw);
+            for (int k = 0; k < ph * pw; k++) {
+                capture_primary(rays[k], hits[k]);
+            }
+
+            for (int i = 0; i < ph; i++) {
+                for (int j = 0; j < pw; j++) {
+                    const uint64_t before_shading = ray_stats_cost();
+                    store_color(pixel(pi + i, pj + j), shade(S, hits[i * pw + j]));
+                    if (count) {
+                        cost[offset(pi + i, pj + j)] = packet_cost + static_cast<float>(ray_stats_cost() - before_shading);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif //RENDER_H
@@ -0,0 +1,171 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <optional>
+#include <vector>
+
+#include "intersection.h"
+#include "wide.h"
+#include "quantized.h"
+#include "light_tree.h"
+#include "instancing.h"
+
+using namespace std;
+
+struct Scene {
+    ObjectHierarchy root;
+    vector<Light> lights;
+
+    // Optional collapsed copies of root, traversal uses the one that is built (see useWideHierarchy)
+    WideHierarchy<4> wide4;
+    WideHierarchy<8> wide8;
+
+    // Optional quantized copies, used before the wide ones when built (see useQuantizedHierarchy)
+    QuantizedHierarchy<4> quantized4;
+    QuantizedHierarchy<8> quantized8;
+
+    // Instanced geometry, traced on top of root (see instancing.h)
+    InstanceHierarchy instances;
+
+    // Optional hierarchy over lights, shading goes through it when it is built (see useLightTree)
+    LightTree light_tree;
+
+    // Shadow rays first test the leaf that last blocked the same light (see occluder_cache.h)
+    bool cache_occluders = false;
+
+    Scene(ObjectHierarchy root, const vector<Light>& lights) : root(std::move(root)), lights(lights) {}
+
+    void addLight(const Light& light) {
+        lights.push_back(light);
+    }
+
+    // Shades at most options.max_lights clusters of lights per point instead of every light
+    void useLightTree(const LightTreeOptions &options) {
+        light_tree = LightTree(lights, options);
+    }
+
+    // Traverses the hierarchy with 2 (binary), 4 or 8 children per node.
+    // 8 needs AVX, 4 is used instead without it. Returns the width actually used.
+    int useWideHierarchy(int width) {
+#ifdef RT_X86_SIMD
+        if (width == 8 && !__builtin_cpu_supports("avx")) {
+            width = 4;
+        }
+#endif
+        wide4 = width == 4 ? collapse_hierarchy<4>(root) : WideHierarchy<4>{};
+        wide8 = width == 8 ? collapse_hierarchy<8>(root) : WideHierarchy<8>{};
+        return width == 4 || width == 8 ? width : 2;
+    }
+
+    // Wide hierarchy of width 4 or 8 with children bounds quantized on bits (8 or 16) bits, the float wide copy being
+    // dropped once quantized. Returns the width actually used.
+    int useQuantizedHierarchy(const int width, const int bits) {
+        const int used = useWideHierarchy(width == 8 ? 8 : 4);
+        quantized4 = used == 4 ? quantize_hierarchy(wide4, bits) : QuantizedHierarchy<4>{};
+        quantized8 = used == 8 ? quantize_hierarchy(wide8, bits) : QuantizedHierarchy<8>{};
+        wide4 = {};
+        wide8 = {};
+        return used;
+    }
+
+    // To be called whenever root changes (refit), collapses it again into the wide copy in use
+    void updateWideHierarchy() {
+        if (!wide4.nodes.empty()) {
+            wide4 = collapse_hierarchy<4>(root);
+        }
+        if (!wide8.nodes.empty()) {
+            wide8 = collapse_hierarchy<8>(root);
+        }
+        if (!quantized4.empty()) {
+            quantized4 = quantize_hierarchy(collapse_hierarchy<4>(root), quantized4.nodes8.empty() ? 16 : 8);
+        }
+        if (!quantized8.empty()) {
+            quantized8 = quantize_hierarchy(collapse_hierarchy<8>(root), quantized8.nodes8.empty() ? 16 : 8);
+        }
+    }
+
+    // Bytes taken by each part of the scene geometry
+    struct Memory {
+        size_t nodes, spheres, arrays, indices, wide, quantized;
+
+        [[nodiscard]] size_t total() const {
+            return nodes + spheres + arrays + indices + wide + quantized;
+        }
+    };
+
+    [[nodiscard]] Memory memory() const {
+        Memory bytes = {0, 0, 0, 0, wide4.nodes.size() * sizeof(WideNode<4>) + wide8.nodes.size() * sizeof(WideNode<8>),
+                        quantized4.bytes() + quantized8.bytes()};
+        // Instance prototypes are counted once, however many copies of them there are
+        const auto add = [&](const ObjectHierarchy &hierarchy) {
+            bytes.nodes += hierarchy.nodes.size() * sizeof(HierarchyNode);
+            bytes.spheres += hierarchy.spheres.size() * sizeof(Sphere);
+            bytes.arrays += (hierarchy.arrays.x.size() + hierarchy.arrays.y.size() + hierarchy.arrays.z.size() + hierarchy.arrays.radius2.size()) * sizeof(float);
+            bytes.indices += hierarchy.indices.size() * sizeof(uint32_t);
+        };
+        add(root);
+        for (const ObjectHierarchy &prototype : instances.prototypes) {
+            add(prototype);
+        }
+        bytes.nodes += instances.nodes.size() * sizeof(HierarchyNode) + instances.instances.size() * sizeof(Instance);
+        return bytes;
+    }
+};
+
+// Closest hit in root, through the copy of it in use
+inline std::optional<Intersection> intersectRoot(const Scene &scene, const Ray &ray) {
+    if (!scene.quantized8.empty()) {
+        return intersectQuantizedHierarchy(scene.quantized8, scene.root, ray);
+    }
+    if (!scene.quantized4.empty()) {
+        return intersectQuantizedHierarchy(scene.quantized4, scene.root, ray);
+    }
+    if (!scene.wide8.nodes.empty()) {
+        return intersectWideHierarchy(scene.wide8, scene.root, ray);
+    }
+    if (!scene.wide4.nodes.empty()) {
+        return intersectWideHierarchy(scene.wide4, scene.root, ray);
+    }
+    return intersectObjectHierarchy(scene.root, ray);
+}
+
+inline bool occludedRoot(const Scene &scene, const Ray &ray, const float tmax, LeafRange * occluder) {
+    if (!scene.quantized8.empty()) {
+        return occludedQuantizedHierarchy(scene.quantized8, scene.root, ray, tmax, occluder);
+    }
+    if (!scene.quantized4.empty()) {
+        return occludedQuantizedHierarchy(scene.quantized4, scene.root, ray, tmax, occluder);
+    }
+    if (!scene.wide8.nodes.empty()) {
+        return occludedWideHierarchy(scene.wide8, scene.root, ray, tmax, occluder);
+    }
+    if (!scene.wide4.nodes.empty()) {
+        return occludedWideHierarchy(scene.wide4, scene.root, ray, tmax, occluder);
+    }
+    return occludedObjectHierarchy(scene.root, ray, tmax, occluder);
+}
+
+// Closest hit in the scene
+inline std::optional<Intersection> intersect(const Scene &scene, const Ray &ray) {
+    RT_STAT(primary, rays, 1);
+    std::optional<Intersection> hit = intersectRoot(scene, ray);
+    if (!scene.instances.empty()) {
+        if (std::optional<Intersection> instance_hit = intersectInstances(scene.instances, ray, hit.has_value() ? hit->t : INFINITY); instance_hit.has_value()) {
+            hit = instance_hit;
+        }
+    }
+    return hit;
+}
+
+// Shadow ray query : is anything in the scene between the ray origin and tmax.
+// The leaf of the blocking sphere is written to occluder when given and when it belongs to root.
+inline bool occluded(const Scene &scene, const Ray &ray, const float tmax, LeafRange * occluder = nullptr) {
+    RT_STAT(shadow, rays, 1);
+    return occludedRoot(scene, ray, tmax, occluder) || (!scene.instances.empty() && occludedInstances(scene.instances, ray, tmax));
+}
+
+#endif //SCENE_H
@@ -0,0 +1,198 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "intersection.h"
+#include "mapped_file.h"
+
+using namespace std;
+
+// Everything needed to render a scene, before its hierarchy is built
+struct SceneDescription {
+    vector<Sphere> spheres;
+    vector<Light> lights;
+    // Image size, 0 when the scene leaves it to the command line
+    int width = 0;
+    int height = 0;
+    float focal = 10000.0f;
+};
+
+// --- Binary format ---
+// A header followed by the sphere and light arrays, stored exactly as Sphere and Light are laid out in memory
+// (little endian floats), so that loading is a copy out of the mapping with no per element parsing.
+
+constexpr char SCENE_FILE_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t SCENE_FILE_VERSION = 1;
+// Arrays start on cache line boundaries
+constexpr uint64_t SCENE_FILE_ALIGNMENT = 64;
+
+static_assert(is_trivially_copyable_v<Sphere> && sizeof(Sphere) == 7 * sizeof(float), "Sphere is stored as is in scene files");
+static_assert(is_trivially_copyable_v<Light> && sizeof(Light) == 4 * sizeof(float), "Light is stored as is in scene files");
+
+struct SceneFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sphere_size; // sizeof(Sphere) when the file was written
+    uint64_t sphere_count;
+    uint64_t sphere_offset; // In bytes from the start of the file
+    uint64_t light_count;
+    uint64_t light_offset;
+    int32_t width;
+    int32_t height;
+    float focal;
+    uint32_t reserved;
+};
+
+inline uint64_t align_offset(const uint64_t offset) {
+    return (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT * SCENE_FILE_ALIGNMENT;
+}
+
+inline void save_scene_file(const string &path, const SceneDescription &scene) {
+    SceneFileHeader header{};
+    memcpy(header.magic, SCENE_FILE_MAGIC, sizeof header.magic);
+    header.version = SCENE_FILE_VERSION;
+    header.sphere_size = sizeof(Sphere);
+    header.sphere_count = scene.spheres.size();
+    header.sphere_offset = align_offset(sizeof(SceneFileHeader));
+    header.light_count = scene.lights.size();
+    header.light_offset = align_offset(header.sphere_offset + scene.spheres.size() * sizeof(Sphere));
+    header.width = scene.width;
+    header.height = scene.height;
+    header.focal = scene.focal;
+
+    ofstream out(path, ios::binary);
+    if (!out) {
+        throw runtime_error("Cannot open " + path);
+    }
+    const auto pad_to = [&](const uint64_t offset) {
+        const vector<char> zeros(offset - static_cast<uint64_t>(out.tellp()), 0);
+        out.write(zeros.data(), static_cast<streamsize>(zeros.size()));
+    };
+    out.write(reinterpret_cast<const char *>(&header), sizeof header);
+    pad_to(header.sphere_offset);
+    out.write(reinterpret_cast<const char *>(scene.spheres.data()), static_cast<streamsize>(scene.spheres.size() * sizeof(Sphere)));
+    pad_to(header.light_offset);
+    out.write(reinterpret_cast<const char *>(scene.lights.data()), static_cast<streamsize>(scene.lights.size() * sizeof(Light)));
+    if (!out) {
+        throw runtime_error("Scene write failed");
+    }
+}
+
+inline bool is_scene_file(const MappedFile &file) {
+    return file.size() >= sizeof(SceneFileHeader) && memcmp(file.data(), SCENE_FILE_MAGIC, sizeof SCENE_FILE_MAGIC) == 0;
+}
+
+inline SceneDescription load_scene_file(const MappedFile &file, const string &path) {
+    if (!is_scene_file(file)) {
+        throw runtime_error(path + " is not a scene file");
+    }
+    const SceneFileHeader &header = *file.array<SceneFileHeader>(0, 1);
+    if (header.version != SCENE_FILE_VERSION || header.sphere_size != sizeof(Sphere)) {
+        throw runtime_error(path + " was written by an incompatible version");
+    }
+
+    const Sphere * spheres = file.array<Sphere>(header.sphere_offset, header.sphere_count);
+    const Light * lights = file.array<Light>(header.light_offset, header.light_count);
+
+    SceneDescription scene;
+    // A single copy out of the page cache, the builder needs its own array to reorder anyway
+    scene.spheres.assign(spheres, spheres + header.sphere_count);
+    scene.lights.assign(lights, lights + header.light_count);
+    scene.width = header.width;
+    scene.height = header.height;
+    scene.focal = header.focal;
+    return scene;
+}
+
+// --- Text format ---
+// One element per line, # starts a comment :
+//   camera <width> <height> [focal]
+//   sphere <radius> <x> <y> <z> <red> <green> <blue>
+//   light <x> <y> <z> <intensity>
+
+inline SceneDescription parse_scene_text(istream &in) {
+    SceneDescription scene;
+    string line;
+    for (int number = 1; getline(in, line); number++) {
+        if (const size_t comment = line.find('#'); comment != string::npos) {
+            line.resize(comment);
+        }
+        istringstream fields(line);
+        string kind;
+        if (!(fields >> kind)) {
+            continue; // Blank line
+        }
+
+        bool ok;
+        if (kind == "camera") {
+            ok = static_cast<bool>(fields >> scene.width >> scene.height);
+            if (ok && !(fields >> scene.focal)) {
+                scene.focal = 10000.0f;
+                fields.clear(ios::eofbit);
+            }
+        } else if (kind == "sphere") {
+            float radius, x, y, z, r, g, b;
+            ok = static_cast<bool>(fields >> radius >> x >> y >> z >> r >> g >> b);
+            if (ok) {
+                scene.spheres.emplace_back(radius, Point(x, y, z), Color(r, g, b));
+            }
+        } else if (kind == "light") {
+            float x, y, z, intensity;
+            ok = static_cast<bool>(fields >> x >> y >> z >> intensity);
+            if (ok) {
+                scene.lights.emplace_back(Point(x, y, z), intensity);
+            }
+        } else {
+            throw runtime_error("Line " + to_string(number) + " : unknown element " + kind);
+        }
+
+        string extra;
+        if (!ok || fields >> extra) {
+            throw runtime_error("Line " + to_string(number) + " : malformed " + kind);
+        }
+    }
+    return scene;
+}
+
+inline void write_scene_text(ostream &out, const SceneDescription &scene) {
+    // Enough digits for the floats to read back identical
+    out << setprecision(numeric_limits<float>::max_digits10);
+    if (scene.width > 0 && scene.height > 0) {
+        out << "camera " << scene.width << " " << scene.height << " " << scene.focal << "\n";
+    }
+    for (const Light &l : scene.lights) {
+        out << "light " << l.position.x << " " << l.position.y << " " << l.position.z << " " << l.intensity << "\n";
+    }
+    for (const Sphere &s : scene.spheres) {
+        out << "sphere " << s.radius << " " << s.center.x << " " << s.center.y << " " << s.center.z << " "
+            << s.albedo.red << " " << s.albedo.green << " " << s.albedo.blue << "\n";
+    }
+}
+
+// Binary or text, told apart by the magic number
+inline SceneDescription load_scene(const string &path) {
+    if (const MappedFile file(path); is_scene_file(file)) {
+        return load_scene_file(file, path);
+    }
+    ifstream in(path);
+    if (!in) {
+        throw runtime_error("Cannot open " + path);
+    }
+    return parse_scene_text(in);
+}
+
+#endif //SCENE_FILE_H
@@ -0,0 +1,132 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <chrono>
+#include <vector>
+
+#include "util.h"
+#include "intersection.h"
+#include "builder.h"
+#include "scene.h"
+#include "scene_file.h"
+
+using namespace std;
+
+// --- Some scenes --
+/*
+Scene Cornell_box() {
+    Scene S = Scene();
+
+    // Box
+    S.addSphere( Sphere(1e5, Point{ 1e5+1,40.8,81.6 }, Color::white()) ); //left
+    S.addSphere( Sphere(1e5, Point{ -1e5+99,40.8,81.6 }, Color::white()) ); //Right
+    S.addSphere( Sphere(1e5, Point{ 50,40.8, 1e5 }, Color::white()) ); //Back
+    S.addSphere( Sphere(1e5, Point{ 50, 1e5, 81.6 }, Color::white()) ); //Bottom
+    S.addSphere( Sphere(1e5, Point{ 50,-1e5+81.6,81.6 }, Color::white()) ); //Top
+
+    // Spheres
+    S.addSphere( Sphere(16.5, Point{ 27,16.5,47 }, Color(0, 255, 255)) ); //left
+    S.addSphere( Sphere(16.5, Point{ 73,16.5,78}, Color(255, 0, 255)) ); //right
+
+    // Lights
+    S.addLight( Light(Point{ 0, 0,50 }, 100000));
+
+    return S;
+}
+
+Scene very_simple() {
+    Scene S = Scene();
+
+    S.addLight( Light(Point{ 200,250,-100 }, 100000));
+    S.addLight( Light(Point{ -200,-250, -100 }, 100000));
+
+    S.addSphere( Sphere(200, Point{ 0,0,300 }, Color::white()) );
+    S.addSphere( Sphere(150, Point{ -400,-200,320 }, Color(200, 0, 0) ));
+    return S;
+}
+*/
+
+// Builds the hierarchy of a loaded or generated scene
+inline Scene build_scene(SceneDescription description, const BuildOptions &options = {}, BuildStats * stats = nullptr) {
+    return {build_hierarchy(std::move(description.spheres), options, stats), description.lights};
+}
+
+// The 3 lights of the benchmark cube, whatever its size
+inline vector<Light> n_sphere_lights() {
+    return {{{5000.f, 0.f, 0.f}, 400000.f}, {{1.f, -1000.f, 0.f}, 100000.f}, {{-1000.f, 1000.f, 0.f}, 100000.f}};
+}
+
+// Cube of 8 * n^3 spheres lit by 3 lights, the scene of every benchmark
+inline SceneDescription n_sphere_description(const int n) {
+    SceneDescription scene;
+
+    const float d = 300.0f / static_cast<float>(n);
+    const float radius = 80.f / static_cast<float>(n);
+
+    for (int i = -n; i < n; i++) {
+        for (int j = -n; j < n; j++) {
+            for (int k = -n; k < n; k++) {
+                scene.spheres.emplace_back(radius, Point(static_cast<float>(i) * d, static_cast<float>(j) * d, static_cast<float>(k) * d), Color::white());
+            }
+        }
+    }
+
+    scene.lights = n_sphere_lights();
+    return scene;
+}
+
+// Replaces the lights of scene by count lights spread over the half of a sphere facing the camera,
+// sharing the intensity of the default lights
+inline void scatter_lights(SceneDescription &scene, const int count, const float radius = 2000.0f) {
+    scene.lights.clear();
+    const float golden_angle = 2.39996323f;
+    for (int l = 0; l < count; l++) {
+        // Fibonacci lattice : even spacing without randomness
+        const float z = -(static_cast<float>(l) + 0.5f) / static_cast<float>(count);
+        const float r = sqrt(1.0f - z * z);
+        const float phi = golden_angle * static_cast<float>(l);
+        scene.lights.push_back({{radius * r * cos(phi), radius * r * sin(phi), radius * z}, 2400000.0f / static_cast<float>(count)});
+    }
+}
+
+// The same cube as n_sphere_description, made of copies of a single block of cluster^3 spheres (cluster divides 2n)
+inline Scene n_sphere_instanced_scene(const int n, const int cluster, const BuildOptions &options = {}, BuildStats * stats = nullptr) {
+    const float d = 300.0f / static_cast<float>(n);
+    const float radius = 80.f / static_cast<float>(n);
+
+    vector<Sphere> block;
+    for (int i = 0; i < cluster; i++) {
+        for (int j = 0; j < cluster; j++) {
+            for (int k = 0; k < cluster; k++) {
+                block.emplace_back(radius, Point(static_cast<float>(i) * d, static_cast<float>(j) * d, static_cast<float>(k) * d), Color::white());
+            }
+        }
+    }
+
+    const auto begin = chrono::steady_clock::now();
+    Scene S = Scene(ObjectHierarchy{}, n_sphere_lights());
+    const uint32_t prototype = S.instances.addPrototype(build_hierarchy(std::move(block), options, stats));
+    for (int i = -n; i < n; i += cluster) {
+        for (int j = -n; j < n; j += cluster) {
+            for (int k = -n; k < n; k += cluster) {
+                S.instances.addInstance(prototype, InstanceTransform::translate({static_cast<float>(i) * d, static_cast<float>(j) * d, static_cast<float>(k) * d}));
+            }
+        }
+    }
+    S.instances.build();
+    if (stats != nullptr) {
+        stats->build_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        stats->nodes += S.instances.nodes.size();
+    }
+    return S;
+}
+
+inline Scene n_sphere_scene(const int n, const BuildOptions &options = {}, BuildStats * stats = nullptr) {
+    return build_scene(n_sphere_description(n), options, stats);
+}
+
+#endif //SCENES_H
@@ -0,0 +1,181 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct ThreadStats {
+    size_t tasks = 0; // Tasks run by the thread
+    size_t stolen = 0; // Among them, tasks taken from another thread's deque
+    double busy_ms = 0.0; // Time spent running tasks
+};
+
+// Fixed pool of threads, each with its own deque of task indices.
+// A thread pops from the back of its deque and, once it is empty, steals from the front of the others,
+// so that expensive tasks (dense regions of the image) do not leave the other threads idle.
+// The thread calling run() works as thread 0.
+class TaskScheduler {
+public:
+    explicit TaskScheduler(const unsigned threads) : workers(max(1u, threads)), thread_stats(max(1u, threads)) {
+        for (unsigned i = 0; i < workers.size(); i++) {
+            workers[i] = make_unique<Worker>();
+        }
+        for (unsigned i = 1; i < workers.size(); i++) {
+            threads_.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~TaskScheduler() {
+        {
+            lock_guard lock(batch_mutex);
+            stopping = true;
+        }
+        batch_start.notify_all();
+        for (thread &t : threads_) {
+            t.join();
+        }
+    }
+
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    [[nodiscard]] unsigned threadCount() const {
+        return static_cast<unsigned>(workers.size());
+    }
+
+    // Accumulated over every run
+    [[nodiscard]] const vector<ThreadStats> &stats() const {
+        return thread_stats;
+    }
+
+    // Calls task(index, thread) for every index of [0, count[ and returns once they are all done
+    void run(const size_t count, const function<void(size_t, unsigned)> &task) {
+        // Contiguous ranges per thread, neighbouring tiles tend to cost the same
+        const size_t n = workers.size();
+        for (size_t w = 0; w < n; w++) {
+            lock_guard lock(workers[w]->tasks_mutex);
+            for (size_t i = count * w / n; i < count * (w + 1) / n; i++) {
+                workers[w]->tasks.push_back(i);
+            }
+        }
+
+        {
+            lock_guard lock(batch_mutex);
+            current_task = &task;
+            arrived = 0;
+            generation++;
+        }
+        batch_start.notify_all();
+
+        work(0, task);
+
+        // Every helper must have joined the batch and left it before task goes out of scope
+        unique_lock lock(batch_mutex);
+        batch_done.wait(lock, [this] { return arrived == threads_.size() && running == 0; });
+        current_task = nullptr;
+    }
+
+private:
+    struct Worker {
+        mutex tasks_mutex;
+        deque<size_t> tasks;
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads_;
+    vector<ThreadStats> thread_stats;
+
+    mutex batch_mutex;
+    condition_variable batch_start;
+    condition_variable batch_done;
+    const function<void(size_t, unsigned)> *current_task = nullptr;
+    size_t arrived = 0; // Helper threads that joined the current batch
+    size_t running = 0; // Helper threads inside work()
+    size_t generation = 0;
+    bool stopping = false;
+
+    optional<size_t> popOwn(const unsigned id) {
+        lock_guard lock(workers[id]->tasks_mutex);
+        if (workers[id]->tasks.empty()) {
+            return nullopt;
+        }
+        const size_t task = workers[id]->tasks.back();
+        workers[id]->tasks.pop_back();
+        return task;
+    }
+
+    optional<size_t> steal(const unsigned id) {
+        for (size_t k = 1; k < workers.size(); k++) {
+            Worker &victim = *workers[(id + k) % workers.size()];
+            lock_guard lock(victim.tasks_mutex);
+            if (!victim.tasks.empty()) {
+                const size_t task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return nullopt;
+    }
+
+    void work(const unsigned id, const function<void(size_t, unsigned)> &task) {
+        ThreadStats &stats = thread_stats[id];
+
+        while (true) {
+            optional<size_t> next = popOwn(id);
+            if (!next.has_value()) {
+                next = steal(id);
+                if (!next.has_value()) {
+                    break;
+                }
+                stats.stolen++;
+            }
+
+            const auto begin = chrono::steady_clock::now();
+            task(next.value(), id);
+            stats.busy_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+            stats.tasks++;
+        }
+    }
+
+    void workerLoop(const unsigned id) {
+        size_t seen = 0;
+        while (true) {
+            const function<void(size_t, unsigned)> *task;
+            {
+                unique_lock lock(batch_mutex);
+                batch_start.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                task = current_task;
+                arrived++;
+                running++;
+            }
+
+            work(id, *task);
+
+            {
+                lock_guard lock(batch_mutex);
+                running--;
+            }
+            batch_done.notify_all();
+        }
+    }
+};
+
+#endif //SCHEDULER_H
@@ -0,0 +1,194 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "ray.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Leaf kernels : closest sphere of a leaf stored as structure of arrays (center x/y/z and radius squared).
+// Every kernel does the exact same float operations as intersect_sphere, so all of them return bit identical t.
+// Returns the index of the closest sphere hit with t < tmax (and updates tmax), or -1.
+using LeafKernel = int (*)(const float * x, const float * y, const float * z, const float * radius2, uint32_t count, const Ray &r, float &tmax);
+
+inline int leaf_kernel_scalar(const float * x, const float * y, const float * z, const float * radius2, const uint32_t count, const Ray &r, float &tmax) {
+    const float a = r.direction.length_squared();
+    int closest = -1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const Direction oc = Direction{r.origin.x - x[i], r.origin.y - y[i], r.origin.z - z[i]};
+        const float b = 2.0f * oc.dot(r.direction);
+        const float c = oc.length_squared() - radius2[i];
+
+        const float delta = b * b - 4.0f * a * c;
+        if (delta < 0.0f) {
+            continue;
+        }
+        const float sqdelta = sqrt(delta);
+        const float t1 = (-b - sqdelta) / (2.0f * a);
+        const float t2 = (-b + sqdelta) / (2.0f * a);
+
+        if (const float t = t1 >= 0.0f ? t1 : t2; t >= 0.0f && t < tmax) {
+            tmax = t;
+            closest = static_cast<int>(i);
+        }
+    }
+    return closest;
+}
+
+#ifdef RT_X86_SIMD
+
+// Lowest index among the lanes holding the smallest t (ties go to the first sphere, like the scalar loop)
+inline int reduce_closest(const float * t, const int * index, const int lanes, float &tmax) {
+    int closest = -1;
+    for (int lane = 0; lane < lanes; lane++) {
+        if (index[lane] < 0) {
+            continue;
+        }
+        if (closest < 0 || t[lane] < tmax || (t[lane] == tmax && index[lane] < closest)) {
+            tmax = t[lane];
+            closest = index[lane];
+        }
+    }
+    return closest;
+}
+
+__attribute__((target("sse2")))
+inline int leaf_kernel_sse(const float * x, const float * y, const float * z, const float * radius2, const uint32_t count, const Ray &r, float &tmax) {
+    const float a_scalar = r.direction.length_squared();
+    const __m128 ox = _mm_set1_ps(r.origin.x), oy = _mm_set1_ps(r.origin.y), oz = _mm_set1_ps(r.origin.z);
+    const __m128 dx = _mm_set1_ps(r.direction.x), dy = _mm_set1_ps(r.direction.y), dz = _mm_set1_ps(r.direction.z);
+    const __m128 four_a = _mm_set1_ps(4.0f * a_scalar);
+    const __m128 two_a = _mm_set1_ps(2.0f * a_scalar);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128i lane_index = _mm_setr_epi32(0, 1, 2, 3);
+
+    __m128 best_t = _mm_set1_ps(tmax);
+    __m128i best_index = _mm_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 4) {
+        const __m128i index = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), lane_index);
+        const __m128 active = _mm_castsi128_ps(_mm_cmplt_epi32(index, _mm_set1_epi32(static_cast<int>(count))));
+
+        // Lanes past count read the padding at the end of the arrays
+        const __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(x + i));
+        const __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(y + i));
+        const __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(z + i));
+
+        const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        const __m128 b = _mm_mul_ps(two, dot);
+        const __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+        const __m128 c = _mm_sub_ps(oc2, _mm_loadu_ps(radius2 + i));
+
+        const __m128 delta = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(four_a, c));
+        const __m128 sqdelta = _mm_sqrt_ps(delta);
+        const __m128 minus_b = _mm_xor_ps(b, sign);
+        const __m128 t1 = _mm_div_ps(_mm_sub_ps(minus_b, sqdelta), two_a);
+        const __m128 t2 = _mm_div_ps(_mm_add_ps(minus_b, sqdelta), two_a);
+
+        const __m128 t1_front = _mm_cmpge_ps(t1, zero);
+        const __m128 t = _mm_or_ps(_mm_and_ps(t1_front, t1), _mm_andnot_ps(t1_front, t2));
+
+        const __m128 hit = _mm_and_ps(_mm_and_ps(active, _mm_cmpge_ps(delta, zero)),
+                                      _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, best_t)));
+        best_t = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, best_t));
+        best_index = _mm_or_si128(_mm_and_si128(_mm_castps_si128(hit), index), _mm_andnot_si128(_mm_castps_si128(hit), best_index));
+    }
+
+    alignas(16) float t[4];
+    alignas(16) int index[4];
+    _mm_store_ps(t, best_t);
+    _mm_store_si128(reinterpret_cast<__m128i *>(index), best_index);
+    return reduce_closest(t, index, 4, tmax);
+}
+
+__attribute__((target("avx2")))
+inline int leaf_kernel_avx2(const float * x, const float * y, const float * z, const float * radius2, const uint32_t count, const Ray &r, float &tmax) {
+    const float a_scalar = r.direction.length_squared();
+    const __m256 ox = _mm256_set1_ps(r.origin.x), oy = _mm256_set1_ps(r.origin.y), oz = _mm256_set1_ps(r.origin.z);
+    const __m256 dx = _mm256_set1_ps(r.direction.x), dy = _mm256_set1_ps(r.direction.y), dz = _mm256_set1_ps(r.direction.z);
+    const __m256 four_a = _mm256_set1_ps(4.0f * a_scalar);
+    const __m256 two_a = _mm256_set1_ps(2.0f * a_scalar);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 best_t = _mm256_set1_ps(tmax);
+    __m256i best_index = _mm256_set1_epi32(-1);
+
+    for (uint32_t i = 0; i < count; i += 8) {
+        const __m256i index = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), lane_index);
+        const __m256 active = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count)), index));
+
+        // Lanes past count read the padding at the end of the arrays
+        const __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(x + i));
+        const __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(y + i));
+        const __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(z + i));
+
+        const __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+        const __m256 b = _mm256_mul_ps(two, dot);
+        const __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+        const __m256 c = _mm256_sub_ps(oc2, _mm256_loadu_ps(radius2 + i));
+
+        const __m256 delta = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(four_a, c));
+        const __m256 sqdelta = _mm256_sqrt_ps(delta);
+        const __m256 minus_b = _mm256_xor_ps(b, sign);
+        const __m256 t1 = _mm256_div_ps(_mm256_sub_ps(minus_b, sqdelta), two_a);
+        const __m256 t2 = _mm256_div_ps(_mm256_add_ps(minus_b, sqdelta), two_a);
+
+        const __m256 t = _mm256_blendv_ps(t2, t1, _mm256_cmp_ps(t1, zero, _CMP_GE_OQ));
+
+        const __m256 hit = _mm256_and_ps(_mm256_and_ps(active, _mm256_cmp_ps(delta, zero, _CMP_GE_OQ)),
+                                         _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, best_t, _CMP_LT_OQ)));
+        best_t = _mm256_blendv_ps(best_t, t, hit);
+        best_index = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_index), _mm256_castsi256_ps(index), hit));
+    }
+
+    // Smallest t over the 8 lanes stays in registers, only the index of the tie break goes through memory
+    __m256 min_t = _mm256_min_ps(best_t, _mm256_permute2f128_ps(best_t, best_t, 1));
+    min_t = _mm256_min_ps(min_t, _mm256_shuffle_ps(min_t, min_t, _MM_SHUFFLE(1, 0, 3, 2)));
+    min_t = _mm256_min_ps(min_t, _mm256_shuffle_ps(min_t, min_t, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    const __m256i candidates = _mm256_or_si256(
+        _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(best_t, min_t, _CMP_EQ_OQ)), best_index),
+        _mm256_andnot_si256(_mm256_castps_si256(_mm256_cmp_ps(best_t, min_t, _CMP_EQ_OQ)), _mm256_set1_epi32(-1)));
+    alignas(32) float t[8];
+    alignas(32) int index[8];
+    _mm256_store_ps(t, best_t);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(index), candidates);
+    return reduce_closest(t, index, 8, tmax);
+}
+
+#endif
+
+// Widest kernel supported by the CPU running the program
+inline LeafKernel select_leaf_kernel() {
+#ifdef RT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return leaf_kernel_avx2;
+    }
+    return leaf_kernel_sse;
+#else
+    return leaf_kernel_scalar;
+#endif
+}
+
+inline const LeafKernel leaf_kernel = select_leaf_kernel();
+
+// Number of floats readable past the last sphere by the widest kernel
+constexpr uint32_t LEAF_KERNEL_PADDING = 8;
+
+#endif //SIMD_H
@@ -0,0 +1,83 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+
+// Traversal statistics, counted only when compiled with RT_STATS (CMake option RAY_TRACER_STATS).
+// Every thread counts into its own thread_local RayStats, the renderer collects them with take_ray_stats().
+
+struct TraversalCounters {
+    uint64_t rays = 0;
+    uint64_t nodes = 0; // Inner nodes visited
+    uint64_t boxes = 0; // Ray box tests
+    uint64_t leaves = 0; // Leaves visited
+    uint64_t spheres = 0; // Ray sphere tests
+
+    TraversalCounters &operator+=(const TraversalCounters &other) {
+        rays += other.rays;
+        nodes += other.nodes;
+        boxes += other.boxes;
+        leaves += other.leaves;
+        spheres += other.spheres;
+        return *this;
+    }
+};
+
+// Closest hit queries count as primary rays, any hit queries as shadow rays
+struct RayStats {
+    TraversalCounters primary;
+    TraversalCounters shadow;
+
+    RayStats &operator+=(const RayStats &other) {
+        primary += other.primary;
+        shadow += other.shadow;
+        return *this;
+    }
+
+    // Work of the traversals, box and sphere tests costing about the same
+    [[nodiscard]] uint64_t cost() const {
+        return primary.boxes + primary.spheres + shadow.boxes + shadow.spheres;
+    }
+};
+
+#ifdef RT_STATS
+
+constexpr bool ray_stats_enabled = true;
+
+inline thread_local RayStats ray_stats;
+
+#define RT_STAT(kind, counter, n) (ray_stats.kind.counter += (n))
+
+// Counters of the calling thread since the last call
+inline RayStats take_ray_stats() {
+    const RayStats stats = ray_stats;
+    ray_stats = {};
+    return stats;
+}
+
+// Cost counted so far by the calling thread
+inline uint64_t ray_stats_cost() {
+    return ray_stats.cost();
+}
+
+#else
+
+constexpr bool ray_stats_enabled = false;
+
+#define RT_STAT(kind, counter, n) ((void)0)
+
+inline RayStats take_ray_stats() {
+    return {};
+}
+
+inline uint64_t ray_stats_cost() {
+    return 0;
+}
+
+#endif
+
+#endif //STATS_H
@@ -0,0 +1,177 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "mapped_file.h"
+
+using namespace std;
+
+// Array of T that either owns its elements (a vector) or reads them in place from a memory mapped file.
+// Reading works the same way in both cases. Any non const access to a mapped array first copies it into
+// a vector of its own (the file is never written), so builders and refits can keep treating it as a vector.
+template<typename T>
+class Storage {
+public:
+    Storage() = default;
+
+    Storage(vector<T> elements) : owned(std::move(elements)) { // NOLINT(*-explicit-constructor)
+        sync();
+    }
+
+    // count elements at data, kept alive by file
+    Storage(shared_ptr<const MappedFile> file, const T * data, const size_t count) : file(std::move(file)), ptr(data), count(count) {}
+
+    Storage(const Storage &other) : owned(other.owned), file(other.file), ptr(other.ptr), count(other.count) {
+        if (!file) {
+            sync();
+        }
+    }
+
+    Storage(Storage &&other) noexcept : owned(std::move(other.owned)), file(std::move(other.file)), ptr(other.ptr), count(other.count) {
+        if (!file) {
+            sync();
+        }
+        other.ptr = nullptr;
+        other.count = 0;
+    }
+
+    Storage &operator=(Storage other) noexcept {
+        owned.swap(other.owned);
+        file.swap(other.file);
+        swap(ptr, other.ptr);
+        swap(count, other.count);
+        if (!file) {
+            sync();
+        }
+        return *this;
+    }
+
+    Storage &operator=(vector<T> elements) {
+        file.reset();
+        owned = std::move(elements);
+        sync();
+        return *this;
+    }
+
+    // True while the elements are read from a file
+    [[nodiscard]] bool isMapped() const {
+        return file != nullptr;
+    }
+
+    // --- Reading ---
+
+    [[nodiscard]] const T * data() const {
+        return ptr;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return count;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return count == 0;
+    }
+
+    const T &operator[](const size_t i) const {
+        return ptr[i];
+    }
+
+    [[nodiscard]] const T * begin() const {
+        return ptr;
+    }
+
+    [[nodiscard]] const T * end() const {
+        return ptr + count;
+    }
+
+    // --- Writing, copies a mapped array first ---
+
+    T * data() {
+        detach();
+        return owned.data();
+    }
+
+    T &operator[](const size_t i) {
+        detach();
+        return owned[i];
+    }
+
+    T * begin() {
+        detach();
+        return owned.data();
+    }
+
+    T * end() {
+        detach();
+        return owned.data() + owned.size();
+    }
+
+    template<typename... Args>
+    void emplace_back(Args &&... args) {
+        detach();
+        owned.emplace_back(std::forward<Args>(args)...);
+        sync();
+    }
+
+    void push_back(const T &element) {
+        emplace_back(element);
+    }
+
+    void reserve(const size_t capacity) {
+        detach();
+        owned.reserve(capacity);
+        sync();
+    }
+
+    void shrink_to_fit() {
+        detach();
+        owned.shrink_to_fit();
+        sync();
+    }
+
+    void resize(const size_t size) {
+        detach();
+        owned.resize(size);
+        sync();
+    }
+
+    void assign(const size_t size, const T &value) {
+        file.reset();
+        owned.assign(size, value);
+        sync();
+    }
+
+    void clear() {
+        file.reset();
+        owned.clear();
+        sync();
+    }
+
+private:
+    vector<T> owned;
+    shared_ptr<const MappedFile> file; // Set while mapped
+    const T * ptr = nullptr;
+    size_t count = 0;
+
+    void sync() {
+        ptr = owned.data();
+        count = owned.size();
+    }
+
+    void detach() {
+        if (file) {
+            owned.assign(ptr, ptr + count);
+            file.reset();
+            sync();
+        }
+    }
+};
+
+#endif //STORAGE_H
@@ -6,12 +6,30 @@
 #ifndef TESTS_H
 #define TESTS_H
 
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <string>
 
 #include "util.h"
 #include "ray.h"
 #include "AABB.h"
 #include "intersection.h"
+#include "builder.h"
+#include "scene.h"
+#include "render.h"
+#include "packet.h"
+#include "scheduler.h"
+#include "image.h"
+#include "scene_file.h"
+#include "scenes.h"
+#include "bvh_cache.h"
+#include "refit.h"
+#include "antialias.h"
+#include "incremental.h"
+#include "wavefront.h"
+#include "distributed.h"
+#include "progressive.h"
 
 inline bool test_ray_init() {
     const Ray r = Ray(Point(0,0,0), Direction(1,0,0));
@@ -60,11 +78,14 @@ inline bool test_optimised_aabb_intersection() {
 
     const Ray r1 = Ray(Point(15,15,15), Direction(0,0,1)); // Ray inside box should intersect
     const Ray r2 = Ray(Point(-15,15,15), Direction(-1,0,0)); // Box behind ray origin so should not intersect (if optimized)
+    const Ray r3 = Ray(Point(15,15,0), Direction(0,0,1)); // Box entered at t = 10
 
     const optional<float> res1 = intersect_aabb(c1, r1);
     const optional<float> res2 = intersect_aabb(c1, r2);
+    const optional<float> res3 = intersect_aabb(c1, r3, 5); // A closer hit is already known
+    const optional<float> res4 = intersect_aabb(c1, r3, 15);
 
-    return res1.has_value() && !res2.has_value();
+    return res1.has_value() && !res2.has_value() && !res3.has_value() && res4.has_value() && res4.value() == 10;
 }
 
 // --- end intersection related tests ---
@@ -109,9 +130,15 @@ inline bool test_BVH_creation() {
         }
     }
 
-    ObjectHierarchy BVH = build_hierarchy(spheres);
+    BuildOptions options;
+    options.method = BuildMethod::Median;
+    const ObjectHierarchy BVH = build_hierarchy(spheres, options);
+    const AABB &root = BVH.nodes[0].aabb;
+    const AABB &left = BVH.nodes[1].aabb;
+    const AABB &right = BVH.nodes[BVH.nodes[0].offset].aabb;
 
-    return BVH.aabb.pmax.z == 991 && BVH.aabb.pmin.z == -1 && BVH.childs[0].aabb.pmax.z == 491 && BVH.childs[0].aabb.pmin.z == -1 && BVH.childs[1].aabb.pmax.z == 991 && BVH.childs[1].aabb.pmin.z == 499;
+    // Every axis has the same extent so the first cut is along X
+    return root.pmax.x == 991 && root.pmin.x == -1 && left.pmax.x == 491 && left.pmin.x == -1 && right.pmax.x == 991 && right.pmin.x == 499;
 }
 
 inline bool test_simple_BVH_to_ray() {
@@ -125,6 +152,1055 @@ inline bool test_simple_BVH_to_ray() {
     return intersectObjectHierarchy(BVH, r1).has_value();
 }
 
+inline bool test_SAH_BVH_to_ray() {
+    // Clustered scene : a dense ball of small spheres next to a few big ones
+    vector<Sphere> spheres;
+    for (int i = 0; i < 2000; i++) {
+        const auto f = static_cast<float>(i);
+        spheres.emplace_back(0.5f, Point(sin(f * 12.9898f) * 20, cos(f * 78.233f) * 20, sin(f * 37.719f) * 20 - 100), Color::white());
+    }
+    for (int i = 0; i < 5; i++) {
+        spheres.emplace_back(30, Point(static_cast<float>(i) * 80 - 160, 0, -300), Color::white());
+    }
+
+    BuildOptions median;
+    median.method = BuildMethod::Median;
+    BuildStats median_stats;
+    const ObjectHierarchy median_BVH = build_hierarchy(spheres, median, &median_stats);
+
+    BuildOptions sah;
+    sah.threads = 4;
+    BuildStats sah_stats;
+    const ObjectHierarchy sah_BVH = build_hierarchy(spheres, sah, &sah_stats);
+
+    // Both hierarchies must find the same closest hit as testing every sphere
+    for (int i = -20; i <= 20; i++) {
+        for (int j = -20; j <= 20; j++) {
+            const Ray r = Ray(Point(0, 0, 0), Direction(static_cast<float>(i) * 0.02f, static_cast<float>(j) * 0.02f, -1));
+            const optional<Intersection> expected = intersect_spheres(spheres, r);
+            const optional<Intersection> res_median = intersectObjectHierarchy(median_BVH, r);
+            const optional<Intersection> res_sah = intersectObjectHierarchy(sah_BVH, r);
+
+            if (expected.has_value() != res_median.has_value() || expected.has_value() != res_sah.has_value()) {
+                return false;
+            }
+            if (expected.has_value() && (expected->t != res_median->t || expected->t != res_sah->t)) {
+                return false;
+            }
+        }
+    }
+
+    return sah_stats.sah_cost <= median_stats.sah_cost && sah_BVH.spheres.size() == spheres.size();
+}
+
+// Linear builds find the same hits as testing every sphere, treelet passes only lower the SAH cost
+inline bool test_linear_BVH() {
+    vector<uint64_t> keys;
+    vector<uint32_t> values;
+    for (uint32_t i = 0; i < 40000; i++) {
+        keys.push_back((static_cast<uint64_t>(i) * 0x9e3779b97f4a7c15ull) >> 8);
+        values.push_back(i);
+    }
+    const vector<uint64_t> unsorted = keys;
+    radix_sort(keys, values, 4);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if ((i > 0 && keys[i - 1] > keys[i]) || unsorted[values[i]] != keys[i]) {
+            return false;
+        }
+    }
+
+    vector<Sphere> spheres;
+    for (int i = 0; i < 20000; i++) {
+        const auto f = static_cast<float>(i);
+        spheres.emplace_back(0.3f + static_cast<float>(i % 5) * 0.1f, Point(sin(f * 12.9898f) * 30, cos(f * 78.233f) * 30, sin(f * 37.719f) * 30 - 100), Color::white());
+    }
+    for (int i = 0; i < 50; i++) {
+        spheres.emplace_back(0.5f, Point(0, 0, -200), Color::white()); // Identical codes
+    }
+
+    BuildOptions linear;
+    linear.method = BuildMethod::Linear;
+    linear.threads = 4;
+    BuildStats linear_stats;
+    const ObjectHierarchy linear_BVH = build_hierarchy(spheres, linear, &linear_stats);
+    linear.treelet_passes = 2;
+    BuildStats treelet_stats;
+    const ObjectHierarchy treelet_BVH = build_hierarchy(spheres, linear, &treelet_stats);
+
+    for (const ObjectHierarchy *BVH : {&linear_BVH, &treelet_BVH}) {
+        vector<bool> seen(spheres.size());
+        for (const uint32_t i : BVH->indices) {
+            if (seen[i]) {
+                return false;
+            }
+            seen[i] = true;
+        }
+    }
+
+    for (int i = -20; i <= 20; i++) {
+        for (int j = -20; j <= 20; j++) {
+            const Ray r = Ray(Point(0, 0, 0), Direction(static_cast<float>(i) * 0.02f, static_cast<float>(j) * 0.02f, -1));
+            const optional<Intersection> expected = intersect_spheres(spheres, r);
+            const optional<Intersection> res_linear = intersectObjectHierarchy(linear_BVH, r);
+            const optional<Intersection> res_treelet = intersectObjectHierarchy(treelet_BVH, r);
+            if (expected.has_value() != res_linear.has_value() || expected.has_value() != res_treelet.has_value()) {
+                return false;
+            }
+            if (expected.has_value() && (expected->t != res_linear->t || expected->t != res_treelet->t)) {
+                return false;
+            }
+            if (occludedObjectHierarchy(linear_BVH, r, 200) != expected.has_value() || occludedObjectHierarchy(treelet_BVH, r, 200) != expected.has_value()) {
+                return false;
+            }
+        }
+    }
+    return treelet_stats.sah_cost < linear_stats.sah_cost && linear_BVH.spheres.size() == spheres.size();
+}
+
+inline bool test_leaf_kernels() {
+    vector<Sphere> spheres;
+    for (int i = 0; i < 24; i++) {
+        const auto f = static_cast<float>(i);
+        spheres.emplace_back(2 + static_cast<float>(i % 3), Point(sin(f * 3.1f) * 10, cos(f * 1.7f) * 10, -30 - f), Color::white());
+    }
+    spheres.emplace_back(3, spheres[5].center, Color::white()); // Same hit as spheres[5], the first one must win
+
+    ObjectHierarchy obj;
+    obj.spheres = spheres;
+    obj.updateArrays();
+    const SphereArrays &a = obj.arrays;
+
+    vector<LeafKernel> kernels = {leaf_kernel_scalar};
+#ifdef RT_X86_SIMD
+    kernels.push_back(leaf_kernel_sse);
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(leaf_kernel_avx2);
+    }
+#endif
+
+    // Every kernel must give the exact same hit as the scalar sphere intersection, for any leaf size
+    for (uint32_t count = 1; count <= spheres.size(); count++) {
+        for (int i = -10; i <= 10; i++) {
+            for (int j = -10; j <= 10; j++) {
+                const Ray r = Ray(Point(0, 0, 0), Direction(static_cast<float>(i) * 0.05f, static_cast<float>(j) * 0.05f, -1).normalize());
+                const optional<Intersection> expected = intersect_spheres(span<const Sphere>(obj.spheres.data(), count), r);
+
+                for (const LeafKernel kernel : kernels) {
+                    float t = INFINITY;
+                    const int index = kernel(a.x.data(), a.y.data(), a.z.data(), a.radius2.data(), count, r, t);
+                    if (expected.has_value() != (index >= 0)) {
+                        return false;
+                    }
+                    if (expected.has_value() && (expected->sphere != &obj.spheres[index] || expected->t != t)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+inline bool test_occlusion() {
+    vector<Sphere> spheres;
+    spheres.emplace_back(10, Point(0,0,-50), Color::white());
+    spheres.emplace_back(10, Point(100,0,-50), Color::white());
+    const Scene S = Scene(build_hierarchy(spheres), {});
+
+    const Ray r1 = Ray(Point(0,0,0), Direction(0,0,-1)); // Sphere entered at t = 40
+    const Ray r2 = Ray(Point(0,0,-50), Direction(0,0,-1)); // Starts inside the first sphere
+    const Ray r3 = Ray(Point(0,0,0), Direction(0,0,1)); // Nothing behind
+
+    return occluded(S, r1, 100) && !occluded(S, r1, 39) && occluded(S, r2, 20) && !occluded(S, r2, 5) && !occluded(S, r3, INFINITY);
+}
+
+inline bool test_wide_BVH() {
+    vector<Sphere> spheres;
+    for (int i = 0; i < 3000; i++) {
+        const auto f = static_cast<float>(i);
+        spheres.emplace_back(0.3f + static_cast<float>(i % 7) * 0.2f, Point(sin(f * 12.9898f) * 30, cos(f * 78.233f) * 30, sin(f * 37.719f) * 30 - 100), Color::white());
+    }
+
+    Scene binary = Scene(build_hierarchy(spheres), {});
+    Scene wide4 = Scene(build_hierarchy(spheres), {});
+    Scene wide8 = Scene(build_hierarchy(spheres), {});
+    wide4.useWideHierarchy(4);
+    wide8.useWideHierarchy(8);
+
+    // Same closest hits and same shadow rays answers as the binary hierarchy
+    for (int i = -25; i <= 25; i++) {
+        for (int j = -25; j <= 25; j++) {
+            const Ray r = Ray(Point(0, 0, 0), Direction(static_cast<float>(i) * 0.015f, static_cast<float>(j) * 0.015f, -1).normalize());
+            const optional<Intersection> expected = intersect(binary, r);
+
+            for (const Scene *S : {&wide4, &wide8}) {
+                const optional<Intersection> res = intersect(*S, r);
+                if (expected.has_value() != res.has_value() || (expected.has_value() && expected->t != res->t)) {
+                    return false;
+                }
+                if (occluded(*S, r, 100) != occluded(binary, r, 100)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Quantized bounds contain the exact ones, so the hits are those of the binary hierarchy
+inline bool test_quantized_BVH() {
+    vector<Sphere> spheres;
+    for (int i = 0; i < 3000; i++) {
+        const auto f = static_cast<float>(i);
+        spheres.emplace_back(0.3f + static_cast<float>(i % 7) * 0.2f, Point(sin(f * 12.9898f) * 30, cos(f * 78.233f) * 30, sin(f * 37.719f) * 30 - 100), Color::white());
+    }
+
+    const Scene binary = Scene(build_hierarchy(spheres), {});
+    vector<Scene> quantized;
+    for (const int width : {4, 8}) {
+        for (const int bits : {8, 16}) {
+            quantized.emplace_back(build_hierarchy(spheres), vector<Light>{});
+            quantized.back().useQuantizedHierarchy(width, bits);
+        }
+    }
+
+    const WideHierarchy<4> wide = collapse_hierarchy<4>(binary.root);
+    const QuantizedHierarchy<4> coarse = quantize_hierarchy(wide, 8);
+    for (size_t n = 0; n < wide.nodes.size(); n++) {
+        WideNode<4> decoded;
+        coarse.nodes8[n].decode(decoded);
+        for (uint32_t lane = 0; lane < wide.nodes[n].lanes; lane++) {
+            if (decoded.min_x[lane] > wide.nodes[n].min_x[lane] || decoded.min_y[lane] > wide.nodes[n].min_y[lane] || decoded.min_z[lane] > wide.nodes[n].min_z[lane] ||
+                decoded.max_x[lane] < wide.nodes[n].max_x[lane] || decoded.max_y[lane] < wide.nodes[n].max_y[lane] || decoded.max_z[lane] < wide.nodes[n].max_z[lane]) {
+                return false;
+            }
+        }
+    }
+
+    for (int i = -25; i <= 25; i++) {
+        for (int j = -25; j <= 25; j++) {
+            const Ray r = Ray(Point(0, 0, 0), Direction(static_cast<float>(i) * 0.015f, static_cast<float>(j) * 0.015f, -1).normalize());
+            const optional<Intersection> expected = intersect(binary, r);
+
+            for (const Scene &S : quantized) {
+                const optional<Intersection> res = intersect(S, r);
+                if (expected.has_value() != res.has_value() || (expected.has_value() && expected->t != res->t)) {
+                    return false;
+                }
+                if (occluded(S, r, 100) != occluded(binary, r, 100)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return sizeof(QuantizedNode<4, uint8_t>) < sizeof(WideNode<4>) / 2;
+}
+
+// Copies of one block give the same cube as the flat scene, and moving an instance moves its hits
+inline bool test_instancing() {
+    const Scene flat = build_scene(n_sphere_description(4));
+    Scene instanced = n_sphere_instanced_scene(4, 2);
+    if (instanced.instances.sphereCount() != flat.root.spheres.size() || instanced.instances.uniqueSphereCount() != 8) {
+        return false;
+    }
+
+    for (int i = -20; i <= 20; i++) {
+        for (int j = -20; j <= 20; j++) {
+            const Ray r = Ray(Point(0, 0, 1000), Direction(static_cast<float>(i) * 0.02f, static_cast<float>(j) * 0.02f, -1).normalize());
+            const optional<Intersection> expected = intersect(flat, r);
+            const optional<Intersection> res = intersect(instanced, r);
+            if (expected.has_value() != res.has_value()) {
+                return false;
+            }
+            if (expected.has_value() && (abs(expected->t - res->t) > 1e-2f || (expected->center - res->center).length() > 1e-2f)) {
+                return false;
+            }
+            if (occluded(flat, r, 2000) != occluded(instanced, r, 2000)) {
+                return false;
+            }
+        }
+    }
+
+    // A lone instance moved and turned a quarter of a turn : its spheres follow
+    Scene moved = n_sphere_instanced_scene(4, 8);
+    const Ray down = Ray(Point(0, 0, 1000), Direction(0, 0, -1));
+    const Ray side = Ray(Point(1000, 0, 1000), Direction(0, 0, -1));
+    if (!intersect(moved, down).has_value() || intersect(moved, side).has_value()) {
+        return false;
+    }
+    moved.instances.setTransform(0, InstanceTransform::rotateZ(static_cast<float>(M_PI) / 2, {1000, 0, 0}));
+    moved.instances.build();
+    const optional<Intersection> hit = intersect(moved, side);
+    return !intersect(moved, down).has_value() && hit.has_value() && abs(hit->intersection.x - hit->center.x) < 1e-2f &&
+           abs(hit->intersection.y - hit->center.y) < 1e-2f && !occluded(moved, down, 2000) && occluded(moved, side, 2000);
+}
+
+inline bool test_packet_tracing() {
+    vector<Sphere> spheres;
+    for (int i = -5; i < 5; i++) {
+        for (int j = -5; j < 5; j++) {
+            for (int k = -5; k < 5; k++) {
+                spheres.emplace_back(8, Point(static_cast<float>(i) * 30, static_cast<float>(j) * 30, static_cast<float>(k) * 30), Color::white());
+            }
+        }
+    }
+    const Scene S = Scene(build_hierarchy(spheres), {});
+    const Camera camera = Camera(160, 120);
+
+    // A tile of rays traced as a packet must give the same hits as tracing them one by one
+    vector<Ray> rays;
+    optional<Intersection> hits[PACKET_SIZE];
+    for (int ti = 0; ti < camera.height; ti += PACKET_WIDTH) {
+        for (int tj = 0; tj < camera.width; tj += PACKET_WIDTH) {
+            rays.clear();
+            for (int i = 0; i < PACKET_WIDTH; i++) {
+                for (int j = 0; j < PACKET_WIDTH; j++) {
+                    rays.push_back(camera.primaryRay(ti + i, tj + j));
+                }
+            }
+            intersect_packet(S, rays.data(), PACKET_SIZE, hits);
+
+            for (int i = 0; i < PACKET_SIZE; i++) {
+                const optional<Intersection> expected = intersect(S, rays[i]);
+                if (expected.has_value() != hits[i].has_value()) {
+                    return false;
+                }
+                if (expected.has_value() && (expected->t != hits[i]->t || expected->sphere != hits[i]->sphere)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+inline bool test_scheduler() {
+    TaskScheduler scheduler(4);
+    vector<int> runs(1000);
+    vector<size_t> per_thread(scheduler.threadCount());
+
+    // Uneven tasks so that threads run out of work at different times and steal
+    for (int batch = 0; batch < 3; batch++) {
+        scheduler.run(runs.size(), [&](const size_t i, const unsigned worker) {
+            volatile float sink = 0;
+            for (size_t k = 0; k < (i < 100 ? 20000 : 10); k++) {
+                sink = sink + static_cast<float>(k);
+            }
+            runs[i]++;
+            per_thread[worker]++;
+        });
+    }
+
+    size_t total = 0;
+    for (unsigned t = 0; t < scheduler.threadCount(); t++) {
+        total += scheduler.stats()[t].tasks;
+        if (scheduler.stats()[t].tasks != per_thread[t]) {
+            return false;
+        }
+    }
+    return total == 3000 && all_of(runs.begin(), runs.end(), [](const int r) { return r == 3; });
+}
+
+inline bool test_ray_stats() {
+    vector<Sphere> spheres;
+    spheres.emplace_back(10, Point(0,0,-50), Color::white());
+    spheres.emplace_back(10, Point(100,0,-50), Color::white());
+    const Scene S = Scene(build_hierarchy(spheres), {});
+    const Ray r = Ray(Point(0,0,0), Direction(0,0,-1));
+
+    take_ray_stats();
+    const bool hit = intersect(S, r).has_value() && occluded(S, r, 100);
+    const RayStats stats = take_ray_stats();
+
+    if (!ray_stats_enabled) {
+        return hit && stats.cost() == 0;
+    }
+    // Root and both children tested, a single leaf (one sphere) reached by both queries
+    return hit && stats.primary.rays == 1 && stats.shadow.rays == 1 &&
+           stats.primary.nodes == 1 && stats.primary.boxes == 3 && stats.primary.leaves == 1 && stats.primary.spheres == 1 &&
+           stats.shadow.leaves == 1 && stats.shadow.spheres == 1 && take_ray_stats().cost() == 0;
+}
+
+// Light tree against shading every light : exact with room for every light, bounded and close with many lights
+inline bool test_light_tree() {
+    vector<Sphere> spheres;
+    spheres.emplace_back(20, Point(0, 0, 100), Color::white());
+    spheres.emplace_back(12, Point(30, 15, 140), Color(255, 120, 40));
+    SceneDescription description;
+    scatter_lights(description, 300, 500.0f);
+    Scene exact = Scene(build_hierarchy(spheres), description.lights);
+    Scene all = Scene(build_hierarchy(spheres), description.lights);
+    all.useLightTree({LIGHT_TREE_MAX_CUT, 0.0f});
+    Scene clustered = Scene(build_hierarchy(spheres), description.lights);
+    clustered.useLightTree({8, 0.0f});
+    Scene cut = Scene(build_hierarchy(spheres), description.lights);
+    cut.useLightTree({8, 1e9f});
+
+    // Selection is bounded by max_lights and the cutoff drops everything
+    Light selected[LIGHT_TREE_MAX_CUT];
+    if (clustered.light_tree.select(Point(0, 0, 80), Direction(0, 0, -1), selected) > 8 ||
+        cut.light_tree.select(Point(0, 0, 80), Direction(0, 0, -1), selected) != 0) {
+        return false;
+    }
+
+    // Few lights : every light facing the point is shaded on its own, the others are hidden by the sphere anyway
+    Scene few = Scene(build_hierarchy(spheres), vector(description.lights.begin(), description.lights.begin() + 40));
+    Scene few_tree = few;
+    few_tree.useLightTree({LIGHT_TREE_MAX_CUT, 0.0f});
+
+    const Camera camera(64, 48);
+    double error = 0.0;
+    double total = 0.0;
+    for (int i = 0; i < camera.height; i++) {
+        for (int j = 0; j < camera.width; j++) {
+            const optional<Intersection> hit = intersect(few, camera.primaryRay(i, j));
+            const Color a = shade(few, hit);
+            const Color b = shade(few_tree, hit);
+            if (abs(a.red - b.red) > 0.1f || abs(a.green - b.green) > 0.1f || abs(a.blue - b.blue) > 0.1f) {
+                return false;
+            }
+            const Color c = shade(exact, hit);
+            const Color d = shade(clustered, hit);
+            error += abs(c.red - d.red) + abs(c.green - d.green) + abs(c.blue - d.blue);
+            total += c.red + c.green + c.blue;
+        }
+    }
+    return error < 0.02 * total;
+}
+
+// Shadow rays through the occluder cache give the same answers, most of them without a traversal
+inline bool test_occluder_cache() {
+    Scene S = n_sphere_scene(4);
+    const Camera camera(160, 120);
+    take_occluder_stats();
+
+    for (int i = 0; i < camera.height; i++) {
+        for (int j = 0; j < camera.width; j++) {
+            const optional<Intersection> hit = intersect(S, camera.primaryRay(i, j));
+            if (!hit.has_value()) {
+                continue;
+            }
+            for (const Light &l : S.lights) {
+                S.cache_occluders = false;
+                const float expected = visibility(S, l, hit->intersection);
+                S.cache_occluders = true;
+                if (visibility(S, l, hit->intersection) != expected) {
+                    return false;
+                }
+            }
+        }
+    }
+    const OccluderCacheStats stats = take_occluder_stats();
+    return stats.lookups > 0 && stats.hits > stats.lookups / 4 && stats.hits + stats.misses <= stats.lookups &&
+           take_occluder_stats().lookups == 0;
+}
+
+// Adaptive antialiasing against uniform 16 samples per pixel, for a fraction of the samples
+inline bool test_antialiasing() {
+    vector<Sphere> spheres;
+    spheres.emplace_back(20, Point(0, 0, 100), Color::white());
+    spheres.emplace_back(12, Point(30, 15, 140), Color(255, 120, 40));
+    const Scene S = Scene(build_hierarchy(spheres), {Light(Point(-100, -200, 0), 30000)});
+    const Camera camera(64, 48);
+    const Tile tile = {0, 0, camera.height, camera.width};
+
+    vector<float> base(static_cast<size_t>(camera.width) * camera.height * 3);
+    render_tile(S, camera, tile, base.data(), false);
+
+    const auto antialiased = [&](const int max_samples, const float threshold, AntialiasStats &stats) {
+        vector<float> framebuffer = base;
+        stats = refine_tile(S, camera, tile, base.data(), framebuffer.data(), {max_samples, threshold}, 0, camera.height);
+        return framebuffer;
+    };
+    AntialiasStats off, uniform, adaptive;
+    const vector<float> unchanged = antialiased(1, AntialiasOptions{}.threshold, off);
+    const vector<float> reference = antialiased(16, -1.0f, uniform);
+    const vector<float> image = antialiased(16, AntialiasOptions{}.threshold, adaptive);
+
+    double base_error = 0.0;
+    double error = 0.0;
+    for (size_t i = 0; i < image.size(); i++) {
+        base_error += abs(base[i] - reference[i]);
+        error += abs(image[i] - reference[i]);
+    }
+    return unchanged == base && off.samplesPerPixel() == 1.0 && uniform.samplesPerPixel() == 16.0 &&
+           adaptive.refined > 0 && adaptive.samplesPerPixel() < 4.0 && error < base_error / 4.0;
+}
+
+// Edits only trace a few tiles again, and the frame ends up as a full render of the edited scene
+inline bool test_incremental_render() {
+    constexpr int n = 3;
+    const Camera camera(320, 240);
+    const vector<Tile> tiles = make_tiles(camera.width, camera.height, 16);
+    TaskScheduler scheduler(2);
+
+    // The plain binary hierarchy, then refitted wide and quantized copies under a light tree of clusters
+    for (const int variant : {0, 1, 2}) {
+        SceneDescription description = n_sphere_description(n);
+        if (variant > 0) {
+            scatter_lights(description, 60);
+        }
+        Scene S = build_scene(std::move(description));
+        if (variant > 0) {
+            LightTreeOptions light_options;
+            light_options.max_lights = 4;
+            S.useLightTree(light_options);
+        }
+        if (variant == 1) {
+            S.useWideHierarchy(4);
+        } else if (variant == 2) {
+            S.useQuantizedHierarchy(8, 8);
+        }
+        vector<float> framebuffer(static_cast<size_t>(camera.width) * camera.height * 3);
+        IncrementalRenderer incremental(S, camera, tiles, framebuffer.data());
+        if (incremental.update(scheduler).dirty_tiles != tiles.size()) {
+            return false;
+        }
+
+        const auto matches_full_render = [&] {
+            vector<float> full(framebuffer.size());
+            for (const Tile &tile : tiles) {
+                render_tile(S, camera, tile, full.data(), false);
+            }
+            return full == framebuffer;
+        };
+
+        // The sphere in the middle of the cube, then one on its far side, then spheres all over the cube
+        const auto centre = static_cast<uint32_t>((n * 2 * n + n) * 2 * n + n);
+        vector<uint32_t> edited = {centre, centre + n - 1};
+        for (uint32_t e = 0; variant > 0 && e < 12; e++) {
+            edited.push_back((e * 7919 + 13) % (8 * n * n * n));
+        }
+        size_t dirty = 0;
+        for (const uint32_t index : edited) {
+            Sphere sphere = incremental.sphere(index);
+            sphere.center.x += 1.5f * sphere.radius;
+            sphere.center.y -= sphere.radius;
+            incremental.setSphere(index, sphere);
+            dirty += incremental.update(scheduler).dirty_tiles;
+            if (!matches_full_render()) {
+                return false;
+            }
+        }
+        Light light = S.lights[1];
+        light.position.x += 300;
+        incremental.setLight(1, light);
+        const size_t light_dirty = incremental.update(scheduler).dirty_tiles;
+        if (dirty == 0 || dirty >= tiles.size() * edited.size() || light_dirty == 0 || !matches_full_render()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool test_wavefront() {
+    Scene S = n_sphere_scene(3);
+    const Camera camera(160, 120);
+    vector<float> full(static_cast<size_t>(camera.width) * camera.height * 3);
+    for (const Tile &tile : make_tiles(camera.width, camera.height, 16)) {
+        render_tile(S, camera, tile, full.data(), false);
+    }
+    TaskScheduler scheduler(2);
+
+    // Direct lighting only, sorted or not and in several waves : the image of render_tile
+    for (const bool sort : {true, false}) {
+        WavefrontOptions options;
+        options.bounces = 0;
+        options.sort = sort;
+        options.wave_size = 5000;
+        vector<float> framebuffer(full.size());
+        const WavefrontStats stats = WavefrontRenderer(S, camera, options).render(scheduler, framebuffer.data());
+        if (framebuffer != full || stats.primary_rays != static_cast<uint64_t>(camera.width) * camera.height || stats.bounce_rays != 0) {
+            return false;
+        }
+    }
+
+    // Bounces only add light
+    WavefrontOptions options;
+    options.bounces = 2;
+    options.samples = 2;
+    vector<float> framebuffer(full.size());
+    const WavefrontStats stats = WavefrontRenderer(S, camera, options).render(scheduler, framebuffer.data());
+    double direct = 0.0;
+    double indirect = 0.0;
+    for (size_t k = 0; k < full.size(); k++) {
+        if (!isfinite(framebuffer[k]) || framebuffer[k] < 0.0f) {
+            return false;
+        }
+        direct += full[k];
+        indirect += framebuffer[k];
+    }
+    return stats.bounce_rays > 0 && stats.shadow_rays > 0 && indirect > direct;
+}
+
+inline bool test_distributed() {
+    const SceneDescription description = n_sphere_description(3);
+    const Camera camera(200, 130);
+    vector<float> framebuffer(static_cast<size_t>(camera.width) * camera.height * 3);
+    const Scene S = build_scene(description);
+    for (const Tile &tile : make_tiles(camera.width, camera.height)) {
+        render_tile(S, camera, tile, framebuffer.data(), false);
+    }
+    vector<uint8_t> expected(framebuffer.size());
+    quantize(framebuffer.data(), static_cast<size_t>(camera.width) * camera.height, expected.data());
+
+    RenderJob job{camera.width, camera.height, camera.focal};
+    const ObjectHierarchy hierarchy = build_hierarchy(description.spheres);
+    // Workers building the hierarchy, then mapping the coordinator's one.
+    // The first worker is ready before the others connect and leaves after taking its first range, which they render.
+    for (const ObjectHierarchy * shipped : {static_cast<const ObjectHierarchy *>(nullptr), &hierarchy}) {
+        const Socket listener = listen_socket(0);
+        const uint16_t port = listener.port();
+        vector<thread> workers;
+        promise<void> leaving_ready;
+        workers.emplace_back([port, &leaving_ready] {
+            const Socket coordinator = connect_socket("127.0.0.1", port);
+            receive_message(coordinator, WORKER_MESSAGE_LIMITS);
+            const WorkerReady ready{1, 0.0f};
+            send_message(coordinator, MessageType::Ready, {bytes_of(ready)});
+            leaving_ready.set_value();
+            receive_message(coordinator, WORKER_MESSAGE_LIMITS);
+        });
+        const shared_future<void> others_start = leaving_ready.get_future().share();
+        for (int w = 0; w < 2; w++) {
+            workers.emplace_back([port, others_start] {
+                others_start.wait();
+                run_worker("127.0.0.1", port, 1);
+            });
+        }
+
+        vector<uint8_t> rgb(expected.size());
+        const DistributedStats stats = render_distributed(listener, workers.size(), job, description.spheres, description.lights, rgb.data(), shipped);
+        for (thread &worker : workers) {
+            worker.join();
+        }
+        const size_t tiles = make_tiles(camera.width, camera.height).size();
+        if (rgb != expected || !stats.workers[0].lost || stats.reassigned_tiles == 0 || stats.workers[1].tiles + stats.workers[2].tiles != tiles) {
+            return false;
+        }
+    }
+
+    // A peer announcing a huge message and one stalling on its first range are dropped, the last worker rendering the frame
+    const Socket listener = listen_socket(0);
+    const uint16_t port = listener.port();
+    promise<void> frame_done;
+    const shared_future<void> stalled_leaves = frame_done.get_future().share();
+    vector<thread> workers;
+    workers.emplace_back([port] {
+        const Socket coordinator = connect_socket("127.0.0.1", port);
+        const MessageHeader header{MessageType::Ready, {}, uint64_t{1} << 39};
+        send_all(coordinator, &header, sizeof header);
+    });
+    workers.emplace_back([port, stalled_leaves] {
+        const Socket coordinator = connect_socket("127.0.0.1", port);
+        receive_message(coordinator, WORKER_MESSAGE_LIMITS);
+        const WorkerReady ready{1, 0.0f};
+        send_message(coordinator, MessageType::Ready, {bytes_of(ready)});
+        receive_message(coordinator, WORKER_MESSAGE_LIMITS);
+        stalled_leaves.wait();
+    });
+    workers.emplace_back([port] {
+        run_worker("127.0.0.1", port, 1);
+    });
+    vector<uint8_t> rgb(expected.size());
+    const DistributedStats stats = render_distributed(listener, workers.size(), job, description.spheres, description.lights, rgb.data(), nullptr, {}, 300);
+    frame_done.set_value();
+    for (thread &worker : workers) {
+        worker.join();
+    }
+    const auto lost = count_if(stats.workers.begin(), stats.workers.end(), [](const WorkerStats &worker) { return worker.lost; });
+    size_t rendered = 0;
+    for (const WorkerStats &worker : stats.workers) {
+        rendered += worker.tiles;
+    }
+    if (rgb != expected || lost != 2 || stats.reassigned_tiles == 0 || rendered != make_tiles(camera.width, camera.height).size()) {
+        return false;
+    }
+
+    // Two workers announced and one coming : it renders the frame without waiting for the other. None at all fails.
+    const Socket short_listener = listen_socket(0);
+    thread only([port = short_listener.port()] {
+        run_worker("127.0.0.1", port, 1);
+    });
+    fill(rgb.begin(), rgb.end(), 0);
+    const DistributedStats short_stats = render_distributed(short_listener, 2, job, description.spheres, description.lights, rgb.data(), nullptr, {}, 300);
+    only.join();
+    bool nobody = false;
+    try {
+        render_distributed(listen_socket(0), 1, job, description.spheres, description.lights, rgb.data(), nullptr, {}, 100);
+    } catch (const runtime_error &) {
+        nobody = true;
+    }
+    return rgb == expected && nobody && short_stats.workers[0].tiles == make_tiles(camera.width, camera.height).size();
+}
+
+inline bool test_progressive() {
+    const Scene S = n_sphere_scene(3);
+    const Camera camera(203, 117); // Not a multiple of the steps
+    vector<float> full(static_cast<size_t>(camera.width) * camera.height * 3);
+    for (const Tile &tile : make_tiles(camera.width, camera.height)) {
+        render_tile(S, camera, tile, full.data(), false);
+    }
+    TaskScheduler scheduler(2);
+
+    // No budget : the coarse pass alone, every pixel painted
+    vector<float> framebuffer(full.size(), -1.0f);
+    ProgressiveOptions options;
+    options.first_step = 8;
+    options.budget_ms = 0.0;
+    ProgressiveRenderer progressive(S, camera, framebuffer.data(), options);
+    const ProgressiveFrame first = progressive.refine(scheduler);
+    if (first.pass != 1 || first.complete || first.traced != static_cast<size_t>((camera.width + 7) / 8 * ((camera.height + 7) / 8)) ||
+        count(framebuffer.begin(), framebuffer.end(), -1.0f) != 0) {
+        return false;
+    }
+
+    // Then to the end a little at a time, passes getting finer, every pixel traced once : the full render
+    vector<int> steps;
+    while (!progressive.complete()) {
+        progressive.refine(scheduler, [&](const ProgressiveFrame &frame) {
+            steps.push_back(frame.step);
+        });
+    }
+    if (!is_sorted(steps.rbegin(), steps.rend()) || steps.back() != 1 || steps.size() <= progressive.passCount() || framebuffer != full) {
+        return false;
+    }
+
+    // Or at once, from another point of view and back
+    options.budget_ms = 1e9;
+    ProgressiveRenderer unlimited(S, camera, framebuffer.data(), options);
+    Camera closer = camera;
+    closer.focal /= 2.0f;
+    unlimited.reset(closer);
+    unlimited.refine(scheduler);
+    unlimited.reset(camera);
+    const ProgressiveFrame last = unlimited.refine(scheduler);
+    return last.complete && last.traced == static_cast<size_t>(camera.width) * camera.height && framebuffer == full;
+}
+
+inline bool test_ray_capture() {
+    const SceneDescription description = n_sphere_description(3);
+    Scene S = build_scene(description);
+    const Camera camera(120, 90);
+    const vector<Tile> tiles = make_tiles(camera.width, camera.height, 16);
+    vector<float> framebuffer(static_cast<size_t>(camera.width) * camera.height * 3);
+    TaskScheduler scheduler(2);
+
+    // Per tile, written in tile order, with packets for half of the tiles
+    const string path = (filesystem::temp_directory_path() / "rt_test_rays.rtrays").string();
+    {
+        RayCaptureWriter writer(path, scene_key(description), camera.width, camera.height);
+        vector<CapturedRays> tile_rays(tiles.size());
+        ray_capture_enabled = true;
+        scheduler.run(tiles.size(), [&](const size_t t, unsigned) {
+            render_tile(S, camera, tiles[t], framebuffer.data(), t % 2 == 1);
+            tile_rays[t] = take_captured_rays();
+        });
+        ray_capture_enabled = false;
+        for (const CapturedRays &rays : tile_rays) {
+            writer.write(rays);
+        }
+    }
+    const RayCapture capture = load_ray_capture(path);
+    filesystem::remove(path);
+    if (capture.header.scene_key != scene_key(description) || capture.rays.primary.size() != static_cast<size_t>(camera.width) * camera.height ||
+        capture.rays.shadow.empty() || capture.rays.primary[0].ray().direction.dot(camera.primaryRay(0, 0).direction) < 0.9999f) {
+        return false;
+    }
+
+    // The binary and a wide hierarchy give the captured answers
+    for (const int width : {2, 4}) {
+        if (width != 2) {
+            S.useWideHierarchy(width);
+        }
+        const ReplayStats primary = replay_rays(scheduler, capture.rays.primary, RayKind::Primary, [&](const CapturedRay * rays, const size_t count, float * results) {
+            for (size_t r = 0; r < count; r++) {
+                const optional<Intersection> hit = intersect(S, rays[r].ray());
+                results[r] = hit.has_value() ? hit->t : INFINITY;
+            }
+        });
+        const ReplayStats shadow = replay_rays(scheduler, capture.rays.shadow, RayKind::Shadow, [&](const CapturedRay * rays, const size_t count, float * results) {
+            for (size_t r = 0; r < count; r++) {
+                results[r] = occluded(S, rays[r].ray(), rays[r].tmax) ? 1.0f : 0.0f;
+            }
+        });
+        if (primary.agreeing != primary.rays || shadow.agreeing != shadow.rays) {
+            return false;
+        }
+    }
+    // A kernel ignoring every sphere only agrees on the misses
+    const ReplayStats empty = replay_rays(scheduler, capture.rays.primary, RayKind::Primary, [](const CapturedRay *, const size_t count, float * results) {
+        fill(results, results + count, INFINITY);
+    });
+    return empty.agreeing > 0 && empty.agreeing < empty.rays;
+}
+
+inline bool test_image_writers() {
+    constexpr int w = 97;
+    constexpr int h = 61;
+    // Flat runs, small and large steps, like the renders
+    vector<uint8_t> rgb(w * h * 3);
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++) {
+            uint8_t * p = &rgb[(i * w + j) * 3];
+            const bool flat = j < 30;
+            p[0] = flat ? 40 : static_cast<uint8_t>(i * 3 + j);
+            p[1] = flat ? 40 : static_cast<uint8_t>(j * 7 % 251);
+            p[2] = flat ? 40 : static_cast<uint8_t>(i * j % 13 == 0 ? 250 : j);
+        }
+    }
+
+    const string qoi = (filesystem::temp_directory_path() / "rt_test_image.qoi").string();
+    const string ppm = (filesystem::temp_directory_path() / "rt_test_image.ppm").string();
+    // Uneven bands, the encoders keep their state from one band to the next
+    for (const auto &[format, path] : {pair{ImageFormat::QOI, qoi}, pair{ImageFormat::PPM_BINARY, ppm}}) {
+        AsyncImageWriter writer(make_image_writer(format, path, w, h), w, 2);
+        for (int row = 0; row < h; row += 7) {
+            writer.writeRows(&rgb[row * w * 3], min(7, h - row));
+        }
+        writer.finish();
+    }
+
+    int width = 0;
+    int height = 0;
+    const bool qoi_ok = read_qoi(qoi, width, height) == rgb && width == w && height == h;
+    const bool ppm_ok = filesystem::file_size(ppm) == string("P6\n97 61\n255\n").size() + rgb.size();
+    filesystem::remove(qoi);
+    filesystem::remove(ppm);
+
+    // A write error is reported by finish(), a writer destroyed without it drops the error instead of terminating
+    struct FailingWriter final : ImageWriter {
+        void writeRows(const uint8_t *, int) override {
+            throw runtime_error("Image write failed");
+        }
+    };
+    bool reported = false;
+    {
+        AsyncImageWriter failing(make_unique<FailingWriter>(), w);
+        failing.writeRows(rgb.data(), 1);
+        try {
+            failing.finish();
+        } catch (const runtime_error &) {
+            reported = true;
+        }
+    }
+    {
+        AsyncImageWriter unfinished(make_unique<FailingWriter>(), w);
+        unfinished.writeRows(rgb.data(), 1);
+    }
+    return qoi_ok && ppm_ok && reported;
+}
+
+// Against streams as the QOI specification encodes them, the index of seen pixels starting as rgba 0, 0, 0, 0
+inline bool test_qoi_spec_streams() {
+    const string path = (filesystem::temp_directory_path() / "rt_test_spec.qoi").string();
+    const vector<uint8_t> header = {'q', 'o', 'i', 'f', 0, 0, 0, 2, 0, 0, 0, 1, 3, 0};
+    const vector<uint8_t> end = {0, 0, 0, 0, 0, 0, 0, 1};
+
+    // Grey then black : black is not in the index yet, both pixels are QOI_OP_LUMA
+    {
+        AsyncImageWriter writer(make_image_writer(ImageFormat::QOI, path, 2, 1), 2, 1);
+        const uint8_t rgb[6] = {5, 5, 5, 0, 0, 0};
+        writer.writeRows(rgb, 1);
+        writer.finish();
+    }
+    vector<uint8_t> expected = header;
+    expected.insert(expected.end(), {0xa5, 0x88, 0x9b, 0x88});
+    expected.insert(expected.end(), end.begin(), end.end());
+    ifstream in(path, ios::binary);
+    const bool encoded = vector<uint8_t>(istreambuf_iterator<char>(in), {}) == expected;
+    in.close();
+
+    // An unset index entry (transparent black), a diff keeping its alpha, a colour, then the entry of the diffed pixel
+    vector<uint8_t> stream = {'q', 'o', 'i', 'f', 0, 0, 0, 4, 0, 0, 0, 1, 3, 0, 0x05, 0x7f, 0xfe, 10, 20, 30, 0x0f};
+    stream.insert(stream.end(), end.begin(), end.end());
+    {
+        ofstream out(path, ios::binary);
+        out.write(reinterpret_cast<const char *>(stream.data()), static_cast<streamsize>(stream.size()));
+    }
+    int width = 0;
+    int height = 0;
+    const bool decoded = read_qoi(path, width, height) == vector<uint8_t>{0, 0, 0, 1, 1, 1, 10, 20, 30, 1, 1, 1} && width == 4 && height == 1;
+    filesystem::remove(path);
+    return encoded && decoded;
+}
+
+inline bool test_scene_files() {
+    SceneDescription scene;
+    scene.width = 640;
+    scene.height = 480;
+    scene.focal = 5000.0f;
+    for (int i = 0; i < 100; i++) {
+        const auto f = static_cast<float>(i);
+        scene.spheres.emplace_back(0.1f + f / 7.0f, Point(sin(f) * 100, cos(f) * 1e-3f, f * 1e4f), Color(f, 255 - f, 0.5f));
+    }
+    scene.lights.emplace_back(Point(1, 2, 3), 1e5f);
+
+    const auto same = [&](const SceneDescription &other) {
+        if (other.spheres.size() != scene.spheres.size() || other.lights.size() != 1 || other.width != 640 || other.height != 480 || other.focal != 5000.0f) {
+            return false;
+        }
+        for (size_t i = 0; i < scene.spheres.size(); i++) {
+            const Sphere &a = scene.spheres[i];
+            const Sphere &b = other.spheres[i];
+            if (a.radius != b.radius || a.center.x != b.center.x || a.center.y != b.center.y || a.center.z != b.center.z ||
+                a.albedo != b.albedo) {
+                return false;
+            }
+        }
+        return other.lights[0].position.z == 3 && other.lights[0].intensity == 1e5f;
+    };
+
+    // Binary file, and text read back bit exact
+    const string path = (filesystem::temp_directory_path() / "rt_test_scene.rtscene").string();
+    save_scene_file(path, scene);
+    const bool binary_ok = same(load_scene(path));
+    filesystem::remove(path);
+
+    stringstream text;
+    write_scene_text(text, scene);
+    const bool text_ok = same(parse_scene_text(text));
+
+    stringstream malformed("light 1 2 3\n");
+    bool rejected = false;
+    try {
+        parse_scene_text(malformed);
+    } catch (const runtime_error &) {
+        rejected = true;
+    }
+    return binary_ok && text_ok && rejected;
+}
+
+inline bool test_bvh_cache() {
+    vector<Sphere> spheres;
+    for (int i = 0; i < 20000; i++) {
+        const auto f = static_cast<float>(i);
+        spheres.emplace_back(0.3f + static_cast<float>(i % 5) * 0.1f, Point(sin(f * 12.9898f) * 40, cos(f * 78.233f) * 40, sin(f * 37.719f) * 40 - 100), Color::white());
+    }
+    const string directory = (filesystem::temp_directory_path() / "rt_test_bvh_cache").string();
+    filesystem::remove_all(directory);
+
+    // The thread count is not part of the key, the trees must not depend on it
+    BuildOptions one_thread;
+    one_thread.threads = 1;
+    BuildOptions four_threads;
+    four_threads.threads = 4;
+
+    bool cold = true;
+    bool warm = false;
+    const ObjectHierarchy built = build_hierarchy_cached(spheres, directory, one_thread, nullptr, &cold);
+    const ObjectHierarchy mapped = build_hierarchy_cached(spheres, directory, four_threads, nullptr, &warm);
+    spheres[7].radius += 1.0f;
+    bool changed = true;
+    build_hierarchy_cached(spheres, directory, four_threads, nullptr, &changed);
+
+    // Files whose key still matches but whose nodes point past the nodes or the spheres are rebuilt
+    bool rejected = true;
+    const uint64_t key = hierarchy_key(spheres, one_thread);
+    const string damaged = hierarchy_cache_path(directory, key);
+    for (const bool leaf : {false, true}) {
+        ObjectHierarchy corrupted = build_hierarchy(spheres, one_thread);
+        size_t n = 0;
+        while (corrupted.nodes[n].isLeaf() != leaf) {
+            n++;
+        }
+        (leaf ? corrupted.nodes[n].count : corrupted.nodes[n].offset) += static_cast<uint32_t>(spheres.size() * 2);
+        save_hierarchy(damaged, corrupted, key, {});
+        rejected = rejected && !load_hierarchy(damaged, key).has_value();
+    }
+
+    // A directory that cannot be created (below a file) still gives the built hierarchy
+    ofstream(directory + "/file").put('x');
+    string save_error;
+    const ObjectHierarchy unsaved = build_hierarchy_cached(spheres, directory + "/file/cache", one_thread, nullptr, nullptr, &save_error);
+    const bool unwritable = !save_error.empty() && unsaved.nodes.size() == build_hierarchy(spheres, one_thread).nodes.size();
+    filesystem::remove_all(directory);
+
+    if (cold || !warm || changed || !rejected || !unwritable || !mapped.nodes.isMapped() || mapped.nodes.size() != built.nodes.size()) {
+        return false;
+    }
+    spheres[7].radius -= 1.0f;
+    const ObjectHierarchy parallel = build_hierarchy(spheres, four_threads);
+    for (size_t i = 0; i < built.nodes.size(); i++) {
+        if (built.nodes[i].offset != parallel.nodes[i].offset || built.nodes[i].count != parallel.nodes[i].count) {
+            return false;
+        }
+    }
+    for (int i = -20; i <= 20; i++) {
+        for (int j = -20; j <= 20; j++) {
+            const Ray r = Ray(Point(0, 0, 0), Direction(static_cast<float>(i) * 0.02f, static_cast<float>(j) * 0.02f, -1).normalize());
+            const optional<Intersection> a = intersectObjectHierarchy(built, r);
+            const optional<Intersection> b = intersectObjectHierarchy(mapped, r);
+            if (a.has_value() != b.has_value() || (a.has_value() && (a->t != b->t || a->sphere - built.spheres.data() != b->sphere - mapped.spheres.data()))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+inline bool test_refit() {
+    vector<Sphere> spheres;
+    for (int i = 0; i < 5000; i++) {
+        const auto f = static_cast<float>(i);
+        spheres.emplace_back(0.3f, Point(sin(f * 12.9898f) * 40, cos(f * 78.233f) * 40, sin(f * 37.719f) * 40 - 100), Color::white());
+    }
+    BuildOptions build;
+    build.threads = 1;
+    RefitOptions options;
+    options.threads = 2;
+    ObjectHierarchy hierarchy = build_hierarchy(spheres, build);
+    HierarchyRefitter refitter(hierarchy, build, options);
+
+    // Refitted tree against every sphere tested one by one, spheres kept in step with their input positions
+    const auto matches = [&](const vector<Sphere> &moved) {
+        for (size_t p = 0; p < hierarchy.spheres.size(); p++) {
+            if (hierarchy.spheres[p].center != moved[hierarchy.indices[p]].center) {
+                return false;
+            }
+        }
+        for (int i = -15; i <= 15; i++) {
+            for (int j = -15; j <= 15; j++) {
+                const Ray r = Ray(Point(0, 0, 0), Direction(static_cast<float>(i) * 0.025f, static_cast<float>(j) * 0.025f, -1).normalize());
+                const optional<Intersection> a = intersectObjectHierarchy(hierarchy, r);
+                const optional<Intersection> b = intersect_spheres(moved, r);
+                if (a.has_value() != b.has_value() || (a.has_value() && abs(a->t - b->t) > 1e-4f * b->t)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    // Small motion : boxes grow a little, the tree is kept
+    vector<Sphere> moved = spheres;
+    for (size_t i = 0; i < moved.size(); i++) {
+        moved[i].center.y += 0.2f * sin(static_cast<float>(i));
+    }
+    const RefitStats small = refitter.refit(moved);
+    if (small.full_rebuild || small.rebuilt_subtrees > 0 || small.degradation < 1.0f || !matches(moved)) {
+        return false;
+    }
+
+    // Spheres of one corner slid across their neighbours : only the subtrees holding them are rebuilt
+    for (size_t i = 0; i < moved.size(); i++) {
+        if (moved[i].center.x > 30 && moved[i].center.y > 30) {
+            moved[i].center.x -= 25;
+        }
+    }
+    const RefitStats partial = refitter.refit(moved);
+    if (partial.full_rebuild || partial.rebuilt_subtrees == 0 || !matches(moved)) {
+        return false;
+    }
+
+    // Every sphere elsewhere : the whole tree is rebuilt
+    for (size_t i = 0; i < moved.size(); i++) {
+        moved[i].center = spheres[(i * 7919) % spheres.size()].center;
+    }
+    const RefitStats full = refitter.refit(moved);
+    return full.full_rebuild && matches(moved);
+}
+
 inline void launch_test(const string& name, const bool res) {
     cout << "Testing " << name << " ... ";
     if(res) {
@@ -151,6 +1227,33 @@ inline Scene full_test_scene() {
     launch_test("AABB Union", test_union_aabb());
     //launch_test("BVH creation", test_BVH_creation());
     launch_test("Simple ray intersection using BVH", test_simple_BVH_to_ray());
+    launch_test("SAH BVH against median BVH", test_SAH_BVH_to_ray());
+    launch_test("Linear BVH against every sphere", test_linear_BVH());
+    launch_test("SIMD leaf kernels against scalar", test_leaf_kernels());
+    launch_test("Shadow ray occlusion", test_occlusion());
+    launch_test("Wide BVH against binary BVH", test_wide_BVH());
+    launch_test("Quantized BVH against binary BVH", test_quantized_BVH());
+    launch_test("Instances against a flat BVH", test_instancing());
+    launch_test("Packet tracing against single rays", test_packet_tracing());
+    launch_test("BVH cache round trip", test_bvh_cache());
+    launch_test("BVH refit against brute force", test_refit());
+
+    cout << endl << "--- RENDERING ---" << endl;
+    launch_test("Work stealing scheduler", test_scheduler());
+    launch_test("Traversal statistics", test_ray_stats());
+    launch_test("Adaptive antialiasing against 16 samples per pixel", test_antialiasing());
+    launch_test("Incremental rendering against a full render", test_incremental_render());
+    launch_test("Wavefront direct lighting against a full render", test_wavefront());
+    launch_test("Distributed rendering against a local render", test_distributed());
+    launch_test("Progressive preview against a full render", test_progressive());
+    launch_test("Light tree against every light", test_light_tree());
+    launch_test("Occluder cache against full traversals", test_occluder_cache());
+
+    cout << endl << "--- FILES ---" << endl;
+    launch_test("Image writers round trip", test_image_writers());
+    launch_test("QOI streams of the specification", test_qoi_spec_streams());
+    launch_test("Scene files round trip", test_scene_files());
+    launch_test("Ray capture round trip and replay", test_ray_capture());
 
     // --- End of unit testing ---
 
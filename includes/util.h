@@ -10,7 +10,6 @@
 #define LEAF_SIZE 10
 
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <cmath>
 
@@ -58,11 +57,6 @@ struct Color {
     }
 };
 
-static void write_color(std::ofstream * out, const float * c) {
-
-    * out << std::to_string(static_cast<int>(c[0])) << " " << std::to_string(static_cast<int>(c[1])) << " " << std::to_string(static_cast<int>(c[2])) << " ";
-}
-
 // --- Both basically vectors but two different concepts ---
 
 struct Direction {
@@ -137,6 +131,11 @@ struct Point {
         return Direction{ this->x / val, this->y / val, this->z / val };
     }
 
+    // Coordinate along axis 0 (x), 1 (y) or 2 (z)
+    [[nodiscard]] float operator[](const int axis) const {
+        return axis == 0 ? this->x : (axis == 1 ? this->y : this->z);
+    }
+
     [[nodiscard]] Point minp(const Point p2) const {
         return {std::min(this->x, p2.x),std::min(this->y, p2.y),std::min(this->z, p2.z)};
     }
@@ -0,0 +1,389 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "util.h"
+#include "ray.h"
+#include "AABB.h"
+#include "intersection.h"
+#include "scene.h"
+#include "render.h"
+#include "lbvh.h"
+#include "occluder_cache.h"
+#include "scheduler.h"
+
+using namespace std;
+
+// Wavefront path tracer : instead of following each path to its end, a wave of paths advances one stage at a time,
+// every stage being a parallel kernel over a queue :
+// - generate : primary rays of a range of pixels, samples per pixel paths each
+// - extend : closest hit of every ray of the path queue
+// - shade : direct lighting of every hit, one shadow ray per light (or light tree cluster), and a diffuse bounce ray
+//   pushed to the next path queue
+// - shadow : any hit test of the shadow queue, the contributions of the unblocked rays being added to their path
+// Before extend (bounces only) and shadow, queues are sorted by direction octant then Morton code of the origin, so that neighbouring
+// rays of a batch traverse the same nodes. With no bounce the image is exactly the one of render_tile.
+// Diffuse bounces reflect albedo / 255 of the light, the background is not a light.
+
+// Queue items per kernel task
+constexpr size_t WAVEFRONT_CHUNK = 1024;
+
+struct WavefrontOptions {
+    int bounces = 1; // Diffuse bounces after the primary hit, 0 for direct lighting only
+    int samples = 1; // Paths per pixel, the first one through the pixel corner as render_tile, the others jittered
+    bool sort = true; // Sort the bounce and shadow queues before tracing them
+    size_t wave_size = 1 << 18; // Paths in flight
+    uint32_t seed = 0;
+};
+
+struct WavefrontStats {
+    uint64_t primary_rays = 0;
+    uint64_t bounce_rays = 0;
+    uint64_t shadow_rays = 0;
+    double generate_ms = 0.0;
+    double sort_ms = 0.0;
+    double extend_ms = 0.0;
+    double shade_ms = 0.0;
+    double shadow_ms = 0.0;
+
+    WavefrontStats &operator+=(const WavefrontStats &other) {
+        primary_rays += other.primary_rays;
+        bounce_rays += other.bounce_rays;
+        shadow_rays += other.shadow_rays;
+        generate_ms += other.generate_ms;
+        sort_ms += other.sort_ms;
+        extend_ms += other.extend_ms;
+        shade_ms += other.shade_ms;
+        shadow_ms += other.shadow_ms;
+        return *this;
+    }
+
+    [[nodiscard]] uint64_t rays() const {
+        return primary_rays + bounce_rays + shadow_rays;
+    }
+
+    [[nodiscard]] double totalMs() const {
+        return generate_ms + sort_ms + extend_ms + shade_ms + shadow_ms;
+    }
+
+    [[nodiscard]] double mraysPerSecond() const {
+        return static_cast<double>(rays()) / max(1e-9, totalMs()) / 1000.0;
+    }
+};
+
+// Small hash, also used to derive random number streams (lowbias32)
+inline uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Uniform in [0, 1[, advancing state (xorshift)
+inline float random_float(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return static_cast<float>(state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Direction around N with a density proportional to the cosine to N
+inline Direction cosine_direction(const Direction &N, uint32_t &state) {
+    const float u1 = random_float(state);
+    const float u2 = random_float(state);
+    const float r = sqrt(u1);
+    const float phi = 2.0f * numbers::pi_v<float> * u2;
+    const float x = r * cos(phi);
+    const float y = r * sin(phi);
+    const float z = sqrt(max(0.0f, 1.0f - u1));
+
+    // Orthonormal basis around N (Duff et al.)
+    const float sign = copysign(1.0f, N.z);
+    const float a = -1.0f / (sign + N.z);
+    const float b = N.x * N.y * a;
+    const Direction t = {1.0f + sign * N.x * N.x * a, sign * b, -sign * N.x};
+    const Direction s = {b, sign + N.y * N.y * a, -N.y};
+    return (t * x + s * y + N * z).normalize();
+}
+
+// Direction octant above a Morton code of the origin within bounds (20 bits per axis)
+inline uint64_t ray_sort_key(const Ray &ray, const AABB &bounds) {
+    const Direction extent = bounds.pmax - bounds.pmin;
+    const auto cell = [](const float x, const float lo, const float size) {
+        const float u = size > 0.0f ? (x - lo) / size : 0.0f;
+        return static_cast<uint64_t>(clamp(u, 0.0f, 1.0f) * 1048575.0f);
+    };
+    const uint64_t octant = (ray.direction.x < 0.0f) << 2 | (ray.direction.y < 0.0f) << 1 | (ray.direction.z < 0.0f);
+    return octant << 60 | expand_bits_21(cell(ray.origin.x, bounds.pmin.x, extent.x)) << 2 |
+           expand_bits_21(cell(ray.origin.y, bounds.pmin.y, extent.y)) << 1 | expand_bits_21(cell(ray.origin.z, bounds.pmin.z, extent.z));
+}
+
+class WavefrontRenderer {
+public:
+    WavefrontRenderer(const Scene &scene, const Camera &camera, const WavefrontOptions &options) : scene(scene), camera(camera), options(options) {
+        if (!scene.root.nodes.empty()) {
+            bounds = scene.root.nodes[0].aabb;
+        } else {
+            // Binary nodes freed for a quantized hierarchy
+            for (const Sphere &sphere : scene.root.spheres) {
+                bounds = bounds.unionAABB(sphere_to_aabb(sphere));
+            }
+        }
+        for (const Instance &instance : scene.instances.instances) {
+            bounds = bounds.unionAABB(instance.bounds);
+        }
+    }
+
+    // Renders the whole image into framebuffer (camera.width RGB floats per row)
+    WavefrontStats render(TaskScheduler &scheduler, float * framebuffer) {
+        WavefrontStats stats;
+        const size_t pixels = static_cast<size_t>(camera.width) * camera.height;
+        const size_t samples = max(1, options.samples);
+        const size_t wave_pixels = max<size_t>(1, options.wave_size / samples);
+
+        for (size_t first = 0; first < pixels; first += wave_pixels) {
+            const size_t last = min(pixels, first + wave_pixels);
+            renderWave(scheduler, first, last, framebuffer, stats);
+        }
+        return stats;
+    }
+
+private:
+    struct Path {
+        Ray ray;
+        Color throughput;
+        uint32_t slot; // In radiance
+        uint32_t random;
+    };
+
+    struct ShadowRay {
+        Ray ray;
+        float tmax;
+        Point light; // For the occluder cache
+    };
+
+    // Added to the path radiance when its shadow ray is not blocked
+    struct Contribution {
+        uint32_t slot;
+        Color color;
+    };
+
+    const Scene &scene;
+    Camera camera;
+    WavefrontOptions options;
+    AABB bounds = AABB::empty();
+
+    vector<Path> paths, next_paths;
+    vector<optional<Intersection>> hits;
+    vector<ShadowRay> shadows;
+    vector<Contribution> contributions; // Of every shadow ray, in shade order
+    vector<uint8_t> visible; // Per shadow ray, in shade order
+    vector<size_t> shadow_chunks; // First shadow ray of every shade task
+    vector<Color> radiance; // Per path slot, (pixel - first) * samples + sample
+
+    // task(begin, end, chunk) over the chunks of [0, count[
+    template<typename Task>
+    static void forChunks(TaskScheduler &scheduler, const size_t count, const Task &task) {
+        scheduler.run((count + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK, [&](const size_t chunk, unsigned) {
+            task(chunk * WAVEFRONT_CHUNK, min(count, (chunk + 1) * WAVEFRONT_CHUNK), chunk);
+        });
+    }
+
+    static double since(const chrono::steady_clock::time_point &begin) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    }
+
+    // Permutation of items in the order of their sort keys
+    template<typename Item>
+    void sortQueue(TaskScheduler &scheduler, vector<Item> &items, vector<uint32_t> * order, WavefrontStats &stats) const {
+        const auto begin = chrono::steady_clock::now();
+        vector<uint64_t> keys(items.size());
+        vector<uint32_t> permutation(items.size());
+        forChunks(scheduler, items.size(), [&](const size_t first, const size_t last, size_t) {
+            for (size_t i = first; i < last; i++) {
+                keys[i] = ray_sort_key(items[i].ray, bounds);
+                permutation[i] = static_cast<uint32_t>(i);
+            }
+        });
+        radix_sort(keys, permutation, scheduler.threadCount());
+
+        vector<Item> sorted;
+        sorted.reserve(items.size());
+        for (const uint32_t i : permutation) {
+            sorted.push_back(items[i]);
+        }
+        items = std::move(sorted);
+        if (order != nullptr) {
+            *order = std::move(permutation);
+        }
+        stats.sort_ms += since(begin);
+    }
+
+    void renderWave(TaskScheduler &scheduler, const size_t first, const size_t last, float * framebuffer, WavefrontStats &stats) {
+        const auto samples = static_cast<size_t>(max(1, options.samples));
+
+        // Generate
+        auto begin = chrono::steady_clock::now();
+        paths.assign((last - first) * samples, {camera.primaryRay(0, 0), Color::black(), 0, 0}); // Rays have no default
+        radiance.assign(paths.size(), Color::black());
+        forChunks(scheduler, paths.size(), [&](const size_t begin_path, const size_t end_path, size_t) {
+            for (size_t p = begin_path; p < end_path; p++) {
+                const size_t pixel = first + p / samples;
+                const auto sample = static_cast<uint32_t>(p % samples);
+                uint32_t random = hash_u32(static_cast<uint32_t>(pixel) * 9781u + sample * 6271u + hash_u32(options.seed)) | 1u;
+                const int i = static_cast<int>(pixel / camera.width);
+                const int j = static_cast<int>(pixel % camera.width);
+                const Ray ray = sample == 0 ? camera.primaryRay(i, j) : camera.primaryRay(i, j, random_float(random), random_float(random));
+                paths[p] = {ray, Color(1, 1, 1), static_cast<uint32_t>(p), random};
+            }
+        });
+        stats.primary_rays += paths.size();
+        stats.generate_ms += since(begin);
+
+        for (int bounce = 0; bounce <= options.bounces && !paths.empty(); bounce++) {
+            if (bounce > 0) {
+                stats.bounce_rays += paths.size();
+            }
+            // Primary rays leave in pixel order, already coherent
+            if (options.sort && bounce > 0) {
+                sortQueue(scheduler, paths, nullptr, stats);
+            }
+
+            // Extend
+            begin = chrono::steady_clock::now();
+            hits.assign(paths.size(), nullopt);
+            forChunks(scheduler, paths.size(), [&](const size_t begin_path, const size_t end_path, size_t) {
+                for (size_t p = begin_path; p < end_path; p++) {
+                    hits[p] = intersect(scene, paths[p].ray);
+                }
+            });
+            stats.extend_ms += since(begin);
+
+            // Shade : every task writes its own shadow rays and bounces, gathered in task order
+            begin = chrono::steady_clock::now();
+            const size_t chunks = (paths.size() + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+            vector<vector<ShadowRay>> chunk_shadows(chunks);
+            vector<vector<Contribution>> chunk_contributions(chunks);
+            vector<vector<Path>> chunk_paths(chunks);
+            forChunks(scheduler, paths.size(), [&](const size_t begin_path, const size_t end_path, const size_t chunk) {
+                shade(begin_path, end_path, bounce, chunk_shadows[chunk], chunk_contributions[chunk], chunk_paths[chunk]);
+            });
+            shadows.clear();
+            contributions.clear();
+            next_paths.clear();
+            shadow_chunks.assign(1, 0);
+            for (size_t c = 0; c < chunks; c++) {
+                shadows.insert(shadows.end(), chunk_shadows[c].begin(), chunk_shadows[c].end());
+                contributions.insert(contributions.end(), chunk_contributions[c].begin(), chunk_contributions[c].end());
+                next_paths.insert(next_paths.end(), chunk_paths[c].begin(), chunk_paths[c].end());
+                shadow_chunks.push_back(shadows.size());
+            }
+            stats.shade_ms += since(begin);
+
+            // Shadow
+            stats.shadow_rays += shadows.size();
+            vector<uint32_t> order;
+            if (options.sort) {
+                sortQueue(scheduler, shadows, &order, stats);
+            }
+            begin = chrono::steady_clock::now();
+            visible.assign(shadows.size(), 0);
+            forChunks(scheduler, shadows.size(), [&](const size_t begin_ray, const size_t end_ray, size_t) {
+                for (size_t k = begin_ray; k < end_ray; k++) {
+                    const ShadowRay &shadow = shadows[k];
+                    const bool blocked = scene.cache_occluders ? occluded_cached(scene, shadow.light, shadow.ray, shadow.tmax)
+                                                               : occluded(scene, shadow.ray, shadow.tmax);
+                    visible[order.empty() ? k : order[k]] = !blocked;
+                }
+            });
+            // Contributions in shade order, as direct_lighting() adds them : the rays of a path all come from one shade task
+            scheduler.run(chunks, [&](const size_t chunk, unsigned) {
+                for (size_t k = shadow_chunks[chunk]; k < shadow_chunks[chunk + 1]; k++) {
+                    if (visible[k]) {
+                        Color &sum = radiance[contributions[k].slot];
+                        sum = sum + contributions[k].color;
+                    }
+                }
+            });
+            stats.shadow_ms += since(begin);
+
+            paths.swap(next_paths);
+        }
+
+        // Average of the samples of every pixel
+        for (size_t pixel = first; pixel < last; pixel++) {
+            Color sum = radiance[(pixel - first) * samples];
+            for (size_t s = 1; s < samples; s++) {
+                sum = sum + radiance[(pixel - first) * samples + s];
+            }
+            Color color = samples > 1 ? sum * (1.0f / static_cast<float>(samples)) : sum;
+            color.cap();
+            store_color(framebuffer + pixel * 3, color);
+        }
+    }
+
+    // Lights of a hit point, as shade() picks them
+    span<const Light> lightsOf(const Intersection &hit, const Direction &N, Light * selected) const {
+        if (scene.light_tree.empty()) {
+            return scene.lights;
+        }
+        return {selected, static_cast<size_t>(scene.light_tree.select(hit.intersection, N, selected))};
+    }
+
+    void shade(const size_t begin_path, const size_t end_path, const int bounce, vector<ShadowRay> &out_shadows,
+               vector<Contribution> &out_contributions, vector<Path> &out_paths) {
+        Light selected[LIGHT_TREE_MAX_CUT];
+        for (size_t p = begin_path; p < end_path; p++) {
+            Path &path = paths[p];
+            if (!hits[p].has_value()) {
+                if (bounce == 0) {
+                    radiance[path.slot] = background();
+                }
+                continue;
+            }
+            const Intersection &hit = hits[p].value();
+            const Direction N = (hit.intersection - hit.center).normalize();
+            const Color &albedo = hit.sphere->albedo;
+
+            // As direct_lighting(), the visibility being known later
+            const span<const Light> lights = lightsOf(hit, N, selected);
+            for (const Light &light : lights) {
+                const Direction to_light = light.position - hit.intersection;
+                const float light_distance = to_light.length();
+                const Direction dir = to_light / light_distance;
+
+                const float cos = to_light.normalize().dot(N);
+                Color contribution = (albedo * (cos / to_light.length_squared())) * light.intensity;
+                if (bounce > 0) {
+                    contribution = {contribution.red * path.throughput.red, contribution.green * path.throughput.green,
+                                    contribution.blue * path.throughput.blue};
+                }
+                out_shadows.push_back({Ray(hit.intersection + dir * 0.1, dir), light_distance - 0.1f, light.position});
+                out_contributions.push_back({path.slot, contribution});
+            }
+
+            if (bounce < options.bounces) {
+                const Direction dir = cosine_direction(N, path.random);
+                const Color throughput = {path.throughput.red * albedo.red / 255.0f, path.throughput.green * albedo.green / 255.0f,
+                                          path.throughput.blue * albedo.blue / 255.0f};
+                out_paths.push_back({Ray(hit.intersection + N * 0.1f, dir), throughput, path.slot, path.random});
+            }
+        }
+    }
+};
+
+#endif //WAVEFRONT_H
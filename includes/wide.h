@@ -0,0 +1,282 @@
+//
+// Created by maaitaddi on 18/10/2026.
+//
+
+#ifndef WIDE_H
+#define WIDE_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "AABB.h"
+#include "intersection.h"
+#include "simd.h"
+
+using namespace std;
+
+// Wide hierarchy : the binary hierarchy collapsed into nodes of up to N children (N = 4 or 8).
+// Children bounds are stored as structure of arrays so a single SIMD slab test handles all of them.
+// Leaves are not copied, they still index the spheres (and sphere arrays) of the binary hierarchy.
+template<int N>
+struct alignas(32) WideNode {
+    float min_x[N], min_y[N], min_z[N];
+    float max_x[N], max_y[N], max_z[N];
+    uint32_t child[N]; // Index of a WideNode, or first sphere of a leaf
+    uint32_t count[N]; // Number of spheres of a leaf child, 0 for an inner child
+    uint32_t lanes; // Children are in lanes [0, lanes[
+
+    void setChild(const int lane, const AABB &aabb, const uint32_t child_index, const uint32_t sphere_count) {
+        min_x[lane] = aabb.pmin.x; min_y[lane] = aabb.pmin.y; min_z[lane] = aabb.pmin.z;
+        max_x[lane] = aabb.pmax.x; max_y[lane] = aabb.pmax.y; max_z[lane] = aabb.pmax.z;
+        child[lane] = child_index;
+        count[lane] = sphere_count;
+    }
+};
+
+template<int N>
+struct WideHierarchy {
+    vector<WideNode<N>> nodes; // Root is nodes[0]
+};
+
+// Creates the wide node standing for the binary node index, returns its index
+template<int N>
+uint32_t collapse_node(WideHierarchy<N> &wide, const ObjectHierarchy &obj, const uint32_t index) {
+    // Opens the largest inner child until there are N children or only leaves
+    vector<uint32_t> children;
+    const HierarchyNode &node = obj.nodes[index];
+    if (node.isLeaf()) {
+        children.push_back(index);
+    } else {
+        children.push_back(index + 1);
+        children.push_back(node.offset);
+    }
+
+    while (children.size() < N) {
+        int largest = -1;
+        float largest_area = -1.0f;
+        for (int i = 0; i < static_cast<int>(children.size()); i++) {
+            if (const HierarchyNode &child = obj.nodes[children[i]]; !child.isLeaf() && child.aabb.area() > largest_area) {
+                largest = i;
+                largest_area = child.aabb.area();
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        const uint32_t opened = children[largest];
+        children[largest] = opened + 1;
+        children.push_back(obj.nodes[opened].offset);
+    }
+
+    const auto wide_index = static_cast<uint32_t>(wide.nodes.size());
+    wide.nodes.emplace_back();
+    wide.nodes[wide_index].lanes = static_cast<uint32_t>(children.size());
+
+    for (int lane = 0; lane < N; lane++) {
+        if (lane >= static_cast<int>(children.size())) {
+            // Unused lanes are masked out by lanes, their content does not matter
+            wide.nodes[wide_index].setChild(lane, AABB::empty(), 0, 0);
+            continue;
+        }
+        const HierarchyNode &child = obj.nodes[children[lane]];
+        if (child.isLeaf()) {
+            wide.nodes[wide_index].setChild(lane, child.aabb, child.offset, child.count);
+        } else {
+            // The vector may grow in the recursive call, so no reference is kept across it
+            const uint32_t child_index = collapse_node(wide, obj, children[lane]);
+            wide.nodes[wide_index].setChild(lane, child.aabb, child_index, 0);
+        }
+    }
+    return wide_index;
+}
+
+template<int N>
+WideHierarchy<N> collapse_hierarchy(const ObjectHierarchy &obj) {
+    WideHierarchy<N> wide;
+    if (!obj.nodes.empty()) {
+        wide.nodes.reserve(obj.nodes.size() / (N - 1) + 1);
+        collapse_node(wide, obj, 0);
+        wide.nodes.shrink_to_fit();
+    }
+    return wide;
+}
+
+// --- Slab tests : bitmask of the children hit before tfar, entry distances in tmin ---
+
+inline int wide_slab_test_scalar(const float * min_x, const float * min_y, const float * min_z,
+                                 const float * max_x, const float * max_y, const float * max_z,
+                                 const int lanes, const Ray &ray, const float tfar, float * tmin) {
+    int mask = 0;
+    for (int lane = 0; lane < lanes; lane++) {
+        if (const optional<float> t = intersect_aabb(AABB{Point{min_x[lane], min_y[lane], min_z[lane]}, Point{max_x[lane], max_y[lane], max_z[lane]}}, ray, tfar); t.has_value()) {
+            tmin[lane] = t.value();
+            mask |= 1 << lane;
+        }
+    }
+    return mask;
+}
+
+inline int wide_slab_test(const WideNode<4> &node, const Ray &ray, const float tfar, float * tmin) {
+#ifdef RT_X86_SIMD
+    const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+    const __m128 ix = _mm_set1_ps(ray.inv_direction.x), iy = _mm_set1_ps(ray.inv_direction.y), iz = _mm_set1_ps(ray.inv_direction.z);
+
+    const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x), ox), ix);
+    const __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x), ox), ix);
+    const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y), oy), iy);
+    const __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y), oy), iy);
+    const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z), oz), iz);
+    const __m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z), oz), iz);
+
+    const __m128 tentry = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+    const __m128 texit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+    const __m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(texit, tentry), _mm_cmpge_ps(texit, _mm_setzero_ps())),
+                                  _mm_cmple_ps(tentry, _mm_set1_ps(tfar)));
+    _mm_storeu_ps(tmin, tentry);
+    return _mm_movemask_ps(hit) & ((1 << node.lanes) - 1);
+#else
+    return wide_slab_test_scalar(node.min_x, node.min_y, node.min_z, node.max_x, node.max_y, node.max_z, static_cast<int>(node.lanes), ray, tfar, tmin);
+#endif
+}
+
+#ifdef RT_X86_SIMD
+__attribute__((target("avx")))
+inline int wide_slab_test_avx(const WideNode<8> &node, const Ray &ray, const float tfar, float * tmin) {
+    const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+    const __m256 ix = _mm256_set1_ps(ray.inv_direction.x), iy = _mm256_set1_ps(ray.inv_direction.y), iz = _mm256_set1_ps(ray.inv_direction.z);
+
+    const __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_x), ox), ix);
+    const __m256 tx2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_x), ox), ix);
+    const __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_y), oy), iy);
+    const __m256 ty2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_y), oy), iy);
+    const __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_z), oz), iz);
+    const __m256 tz2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_z), oz), iz);
+
+    const __m256 tentry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+    const __m256 texit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+
+    const __m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(texit, tentry, _CMP_GE_OQ), _mm256_cmp_ps(texit, _mm256_setzero_ps(), _CMP_GE_OQ)),
+                                     _mm256_cmp_ps(tentry, _mm256_set1_ps(tfar), _CMP_LE_OQ));
+    _mm256_storeu_ps(tmin, tentry);
+    return _mm256_movemask_ps(hit) & ((1 << node.lanes) - 1);
+}
+#endif
+
+inline int wide_slab_test(const WideNode<8> &node, const Ray &ray, const float tfar, float * tmin) {
+#ifdef RT_X86_SIMD
+    static const bool avx = __builtin_cpu_supports("avx");
+    if (avx) {
+        return wide_slab_test_avx(node, ray, tfar, tmin);
+    }
+#endif
+    return wide_slab_test_scalar(node.min_x, node.min_y, node.min_z, node.max_x, node.max_y, node.max_z, static_cast<int>(node.lanes), ray, tfar, tmin);
+}
+
+// --- Traversal ---
+
+struct WideStackEntry {
+    uint32_t child;
+    uint32_t count; // 0 for a wide node
+    float tmin;
+};
+
+// Pushes the children hit by the ray, farthest first so that the nearest one is popped next
+template<int N>
+void push_wide_children(const WideNode<N> &node, int mask, const float * tmin, WideStackEntry * stack, int &stack_size) {
+    const int first = stack_size;
+    while (mask != 0) {
+        const int lane = countr_zero(static_cast<unsigned>(mask));
+        mask &= mask - 1;
+
+        // Insertion sort by decreasing entry distance, there are at most N entries
+        int i = stack_size++;
+        while (i > first && stack[i - 1].tmin < tmin[lane]) {
+            stack[i] = stack[i - 1];
+            i--;
+        }
+        stack[i] = {node.child[lane], node.count[lane], tmin[lane]};
+    }
+}
+
+template<int N>
+std::optional<Intersection> intersectWideHierarchy(const WideHierarchy<N> &wide, const ObjectHierarchy &obj, const Ray &ray) {
+    if (wide.nodes.empty()) {
+        return nullopt;
+    }
+
+    WideStackEntry stack[HIERARCHY_MAX_DEPTH * (N - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, -INFINITY};
+
+    std::optional<Intersection> closest = nullopt;
+    float tmax = INFINITY;
+    alignas(32) float tmin[N];
+
+    while (stack_size > 0) {
+        const WideStackEntry entry = stack[--stack_size];
+        if (entry.tmin > tmax) {
+            continue; // Farther than the closest hit
+        }
+
+        if (entry.count > 0) {
+            RT_STAT(primary, leaves, 1);
+            RT_STAT(primary, spheres, entry.count);
+            if (std::optional<Intersection> it = intersect_leaf(obj, entry.child, entry.count, ray, tmax); it.has_value()) {
+                tmax = it.value().t;
+                closest = it;
+            }
+            continue;
+        }
+
+        const WideNode<N> &node = wide.nodes[entry.child];
+        RT_STAT(primary, nodes, 1);
+        RT_STAT(primary, boxes, node.lanes);
+        push_wide_children(node, wide_slab_test(node, ray, tmax, tmin), tmin, stack, stack_size);
+    }
+    return closest;
+}
+
+template<int N>
+bool occludedWideHierarchy(const WideHierarchy<N> &wide, const ObjectHierarchy &obj, const Ray &ray, const float tmax, LeafRange * occluder = nullptr) {
+    if (wide.nodes.empty()) {
+        return false;
+    }
+
+    uint32_t stack[HIERARCHY_MAX_DEPTH * (N - 1) + 1];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    alignas(32) float tmin[N];
+
+    while (stack_size > 0) {
+        const WideNode<N> &node = wide.nodes[stack[--stack_size]];
+        RT_STAT(shadow, nodes, 1);
+        RT_STAT(shadow, boxes, node.lanes);
+        int mask = wide_slab_test(node, ray, tmax, tmin);
+
+        while (mask != 0) {
+            const int lane = countr_zero(static_cast<unsigned>(mask));
+            mask &= mask - 1;
+
+            if (node.count[lane] > 0) {
+                RT_STAT(shadow, leaves, 1);
+                RT_STAT(shadow, spheres, node.count[lane]);
+                float t = tmax;
+                if (intersect_leaf_index(obj, node.child[lane], node.count[lane], ray, t) >= 0) {
+                    if (occluder != nullptr) {
+                        *occluder = {node.child[lane], node.count[lane]};
+                    }
+                    return true;
+                }
+            } else {
+                stack[stack_size++] = node.child[lane];
+            }
+        }
+    }
+    return false;
+}
+
+#endif //WIDE_H
@@ -3,160 +3,661 @@
 
 // ReSharper disable CppUseAuto
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
 #include <cmath>
+#include <optional>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include <memory>
+#include <mutex>
 
 #include "util.h"
 #include "ray.h"
 #include "intersection.h"
+#include "builder.h"
+#include "scene.h"
+#include "render.h"
+#include "incremental.h"
+#include "wavefront.h"
+#include "distributed.h"
+#include "progressive.h"
+#include "ray_capture.h"
+#include "scheduler.h"
+#include "image.h"
+#include "stats.h"
+#include "scenes.h"
+#include "bvh_cache.h"
+#include "refit.h"
+#include "antialias.h"
 #include "tests.h"
 
 using namespace std;
 
-/*Calculates light visibility for a given light and point*/
-float visibility(const Scene& S, const Light l, const Point p) {
-    const Direction dir = (l.position - p).normalize();
-    const auto r = Ray(p + dir * 0.1, dir);
-
-    if(const optional<Intersection> ret = intersectObjectHierarchy(S.root, r); ret.has_value()) {
-        if (const float intersection_distance = (ret.value().intersection - p).length(); intersection_distance < (l.position - p).length()) {
-            return 0;
-        }
-    }
-
-    return 1;
-}
-
-// --- Some scenes --
-/*
-Scene Cornell_box() {
-    Scene S = Scene();
-
-    // Box
-    S.addSphere( Sphere(1e5, Point{ 1e5+1,40.8,81.6 }, Color::white()) ); //left
-    S.addSphere( Sphere(1e5, Point{ -1e5+99,40.8,81.6 }, Color::white()) ); //Right
-    S.addSphere( Sphere(1e5, Point{ 50,40.8, 1e5 }, Color::white()) ); //Back
-    S.addSphere( Sphere(1e5, Point{ 50, 1e5, 81.6 }, Color::white()) ); //Bottom
-    S.addSphere( Sphere(1e5, Point{ 50,-1e5+81.6,81.6 }, Color::white()) ); //Top
-
-    // Spheres
-    S.addSphere( Sphere(16.5, Point{ 27,16.5,47 }, Color(0, 255, 255)) ); //left
-    S.addSphere( Sphere(16.5, Point{ 73,16.5,78}, Color(255, 0, 255)) ); //right
-
-    // Lights
-    S.addLight( Light(Point{ 0, 0,50 }, 100000));
-
-    return S;
+void print_counters(const string &name, const TraversalCounters &counters, const int frames) {
+    const double rays = static_cast<double>(max<uint64_t>(1, counters.rays));
+    cout << "  " << name << " : " << counters.rays / frames << " rays per frame, per ray "
+         << static_cast<double>(counters.nodes) / rays << " nodes, " << static_cast<double>(counters.boxes) / rays << " box tests, "
+         << static_cast<double>(counters.leaves) / rays << " leaves, " << static_cast<double>(counters.spheres) / rays << " sphere tests" << endl;
 }
 
-Scene very_simple() {
-    Scene S = Scene();
-
-    S.addLight( Light(Point{ 200,250,-100 }, 100000));
-    S.addLight( Light(Point{ -200,-250, -100 }, 100000));
-
-    S.addSphere( Sphere(200, Point{ 0,0,300 }, Color::white()) );
-    S.addSphere( Sphere(150, Point{ -400,-200,320 }, Color(200, 0, 0) ));
-    return S;
+void print_memory(const Scene &S) {
+    const Scene::Memory bytes = S.memory();
+    const double spheres = static_cast<double>(max<size_t>(1, S.root.spheres.size() + S.instances.sphereCount()));
+    const auto per_sphere = [&](const size_t part) {
+        return static_cast<double>(part) / spheres;
+    };
+    cout << "Memory : " << static_cast<double>(bytes.total()) / (1024.0 * 1024.0) << " MB, " << per_sphere(bytes.total()) << " bytes per sphere ("
+         << per_sphere(bytes.nodes) << " binary nodes, " << per_sphere(bytes.spheres) << " spheres, " << per_sphere(bytes.arrays) << " sphere arrays, "
+         << per_sphere(bytes.indices) << " indices, " << per_sphere(bytes.wide) << " wide nodes, " << per_sphere(bytes.quantized) << " quantized nodes)" << endl;
+    // What the same nodes take with float bounds
+    const size_t uncompressed = S.quantized4.nodes8.size() * sizeof(WideNode<4>) + S.quantized4.nodes16.size() * sizeof(WideNode<4>) +
+                                S.quantized8.nodes8.size() * sizeof(WideNode<8>) + S.quantized8.nodes16.size() * sizeof(WideNode<8>);
+    if (uncompressed > 0) {
+        cout << "  Quantized nodes take " << per_sphere(bytes.quantized) << " bytes per sphere against " << per_sphere(uncompressed)
+             << " with float bounds" << endl;
+    }
 }
-*/
-
-
-Scene n_sphere_scene(int n) {
-    vector<Sphere> spheres;
-    vector<Light> lights;
-
-    const float d = 300.0f / static_cast<float>(n);
-    const float radius = 80.f / static_cast<float>(n);
 
-    for (int i = -n; i < n; i++) {
-        for (int j = -n; j < n; j++) {
-            for (int k = -n; k < n; k++) {
-                spheres.emplace_back(radius, Point(static_cast<float>(i) * d, static_cast<float>(j) * d, static_cast<float>(k) * d), Color::white());
+int main(int argc, char * argv[])
+{
+    BuildOptions options;
+    int width = 2;
+    bool packets = false;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    int w = 0; // 1920x1080 unless the scene file or --resolution says otherwise
+    int h = 0;
+    string scene_path;
+    string cache_directory;
+    ImageFormat format = ImageFormat::PPM_BINARY;
+    string output;
+    int band = 0;
+    bool heatmap = false;
+    bool animate = false;
+    AntialiasOptions antialias;
+    antialias.max_samples = 1;
+    int light_count = 0;
+    bool light_tree = false;
+    LightTreeOptions light_options;
+    bool cache_occluders = false;
+    int quantize_bits = 0;
+    bool memory = false;
+    int cluster = 0;
+    int edits = 0;
+    bool wavefront = false;
+    WavefrontOptions wavefront_options;
+    int coordinator_port = -1;
+    int worker_count = 1;
+    bool ship_bvh = false;
+    string worker_address;
+    double preview_ms = 0.0;
+    string capture_path;
+    for (int i = 1; i < argc; i++) {
+        if (const string arg = argv[i]; arg == "--builder" && i + 1 < argc) {
+            const string method = argv[++i];
+            if (method == "median") {
+                options.method = BuildMethod::Median;
+            } else if (method == "sah") {
+                options.method = BuildMethod::SAH;
+            } else if (method == "lbvh") {
+                options.method = BuildMethod::Linear;
+            } else {
+                cerr << "Unknown builder " << method << " (expected median, sah or lbvh)" << endl;
+                return 1;
+            }
+        } else if (arg == "--treelets" && i + 1 < argc) {
+            options.treelet_passes = max(0, stoi(argv[++i]));
+        } else if (arg == "--width" && i + 1 < argc) {
+            width = stoi(argv[++i]);
+        } else if (arg == "--packets") {
+            packets = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(max(1, stoi(argv[++i])));
+        } else if (arg == "--resolution" && i + 1 < argc) {
+            const string resolution = argv[++i];
+            const size_t x = resolution.find('x');
+            w = x == string::npos ? 0 : stoi(resolution.substr(0, x));
+            h = x == string::npos ? 0 : stoi(resolution.substr(x + 1));
+            if (w <= 0 || h <= 0) {
+                cerr << "Bad resolution " << resolution << " (expected WIDTHxHEIGHT)" << endl;
+                return 1;
+            }
+        } else if (arg == "--format" && i + 1 < argc) {
+            const string name = argv[++i];
+            if (name == "p3") {
+                format = ImageFormat::PPM_ASCII;
+            } else if (name == "p6") {
+                format = ImageFormat::PPM_BINARY;
+            } else if (name == "qoi") {
+                format = ImageFormat::QOI;
+            } else {
+                cerr << "Unknown format " << name << " (expected p3, p6 or qoi)" << endl;
+                return 1;
+            }
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg == "--band" && i + 1 < argc) {
+            band = max(1, stoi(argv[++i]));
+        } else if (arg == "--scene" && i + 1 < argc) {
+            scene_path = argv[++i];
+        } else if (arg == "--bvh-cache" && i + 1 < argc) {
+            cache_directory = argv[++i];
+        } else if (arg == "--heatmap") {
+            heatmap = true;
+        } else if (arg == "--animate") {
+            animate = true;
+        } else if (arg == "--aa" && i + 1 < argc) {
+            antialias.max_samples = stoi(argv[++i]);
+            if (antialias.max_samples != 1 && (antialias.max_samples % AA_BATCH != 0 || antialias.max_samples < AA_BATCH || antialias.max_samples > AA_MAX_SAMPLES)) {
+                cerr << "Bad sample count " << antialias.max_samples << " (expected 1, 4, 8, 12 or 16)" << endl;
+                return 1;
+            }
+        } else if (arg == "--aa-threshold" && i + 1 < argc) {
+            antialias.threshold = stof(argv[++i]);
+        } else if (arg == "--lights" && i + 1 < argc) {
+            light_count = max(1, stoi(argv[++i]));
+        } else if (arg == "--light-tree" && i + 1 < argc) {
+            light_tree = true;
+            light_options.max_lights = stoi(argv[++i]);
+        } else if (arg == "--light-cutoff" && i + 1 < argc) {
+            light_options.cutoff = stof(argv[++i]);
+        } else if (arg == "--occluder-cache") {
+            cache_occluders = true;
+        } else if (arg == "--quantize" && i + 1 < argc) {
+            quantize_bits = stoi(argv[++i]);
+            if (quantize_bits != 8 && quantize_bits != 16) {
+                cerr << "Bad quantization " << quantize_bits << " (expected 8 or 16 bits)" << endl;
+                return 1;
             }
+        } else if (arg == "--memory") {
+            memory = true;
+        } else if (arg == "--instances" && i + 1 < argc) {
+            cluster = stoi(argv[++i]);
+        } else if (arg == "--edits" && i + 1 < argc) {
+            edits = max(0, stoi(argv[++i]));
+        } else if (arg == "--wavefront" && i + 1 < argc) {
+            wavefront = true;
+            wavefront_options.bounces = max(0, stoi(argv[++i]));
+        } else if (arg == "--spp" && i + 1 < argc) {
+            wavefront_options.samples = max(1, stoi(argv[++i]));
+        } else if (arg == "--no-sort") {
+            wavefront_options.sort = false;
+        } else if (arg == "--coordinator" && i + 1 < argc) {
+            coordinator_port = stoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            worker_count = max(1, stoi(argv[++i]));
+        } else if (arg == "--ship-bvh") {
+            ship_bvh = true;
+        } else if (arg == "--worker" && i + 1 < argc) {
+            worker_address = argv[++i];
+        } else if (arg == "--preview" && i + 1 < argc) {
+            preview_ms = max(0.0, stod(argv[++i]));
+        } else if (arg == "--capture" && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else {
+            cerr << "Usage : " << argv[0] << " [--builder median|sah|lbvh] [--treelets passes] [--width 2|4|8] [--packets] [--threads n]"
+                 << " [--resolution WxH] [--format p3|p6|qoi] [--output file] [--band rows] [--heatmap] [--animate] [--aa samples] [--aa-threshold t]"
+                 << " [--lights n] [--light-tree max_lights] [--light-cutoff c] [--occluder-cache]"
+                 << " [--quantize 8|16] [--memory] [--instances cluster] [--edits n]"
+                 << " [--wavefront bounces] [--spp n] [--no-sort] [--coordinator port] [--workers n] [--ship-bvh] [--worker host:port]"
+                 << " [--preview budget_ms] [--capture file] [--scene file] [--bvh-cache directory]" << endl;
+            return 1;
         }
     }
 
-    lights.push_back({ { 5000.f, 0.f, 0.f }, 400000.f });
-    lights.push_back({ { 1.f, -1000.f, 0.f }, 100000.f});
-    lights.push_back({ { -1000.f, 1000.f, 0.f }, 100000.f });
-    Scene S = Scene(build_hierarchy(spheres), lights);
-
-    return S;
-}
+    if (!worker_address.empty()) {
+        // Everything else comes from the coordinator
+        const size_t colon = worker_address.rfind(':');
+        if (colon == string::npos) {
+            cerr << "Bad coordinator address " << worker_address << " (expected host:port)" << endl;
+            return 1;
+        }
+        try {
+            const size_t tiles = run_worker(worker_address.substr(0, colon), static_cast<uint16_t>(stoi(worker_address.substr(colon + 1))), threads);
+            cout << tiles << " tiles rendered for " << worker_address << endl;
+            return 0;
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
 
-static float buffer[1080][1920][3];
-int main()
-{
-    constexpr int w = 1920;
-    constexpr int h = 1080;
+    if (heatmap && !ray_stats_enabled) {
+        cerr << "--heatmap needs a build with RAY_TRACER_STATS" << endl;
+        return 1;
+    }
+    if (heatmap && band > 0) {
+        cerr << "--heatmap is scaled over the whole frame and cannot be streamed with --band" << endl;
+        return 1;
+    }
+    if (animate && band > 0) {
+        cerr << "--animate renders several frames and cannot be streamed with --band" << endl;
+        return 1;
+    }
 
-    // We use the ppm format
-    std::ofstream fileOut;
-    fileOut.open("rtresult.ppm", std::fstream::out);
-    fileOut << "P3" << std::endl << std::to_string(w) << " " << std::to_string(h) << std::endl << "255" << std::endl;
+    if (edits > 0 && (band > 0 || animate || cluster != 0 || antialias.max_samples > 1)) {
+        cerr << "--edits re-renders the whole frame in memory, one sample per pixel, and cannot be used with --band, --animate, --instances or --aa" << endl;
+        return 1;
+    }
 
-    int n = 10;
-    Scene S =  n_sphere_scene(n); // One million sphere -> n = 50
+    if (wavefront && (band > 0 || heatmap || edits > 0 || antialias.max_samples > 1)) {
+        cerr << "--wavefront traces the whole frame in queues and cannot be used with --band, --heatmap, --edits or --aa" << endl;
+        return 1;
+    }
 
-    cout << 8 * n * n * n << " Spheres in the scene, beginning ray tracing..." << endl;
+    if (preview_ms > 0.0 && (band > 0 || heatmap || animate || edits > 0 || wavefront || antialias.max_samples > 1 || coordinator_port >= 0)) {
+        cerr << "--preview refines one frame of single sample pixels in memory and cannot be used with --band, --heatmap, --animate, --edits,"
+             << " --wavefront, --aa or --coordinator" << endl;
+        return 1;
+    }
 
-    clock_t begin = clock();
+    // The capture names the scene at rest, --animate moves it before the first frame
+    if (!capture_path.empty() && (animate || edits > 0 || wavefront || antialias.max_samples > 1 || coordinator_port >= 0 || preview_ms > 0.0 || cluster != 0)) {
+        cerr << "--capture records the rays of render_tile in the scene as given and cannot be used with --animate, --edits, --wavefront, --aa,"
+             << " --coordinator, --preview or --instances" << endl;
+        return 1;
+    }
 
-    for(int a = 0; a < 10; a++) {
-        for (int i = 0; i < h; i++) {
-            auto y = static_cast<float>(i);
-            for (int j = 0; j < w; j++) {
-                constexpr float focal = 10000.0;
-                auto x = static_cast<float>(j);
+    if (coordinator_port >= 0 && (band > 0 || heatmap || animate || edits > 0 || wavefront || antialias.max_samples > 1 || cluster != 0)) {
+        cerr << "--coordinator renders one frame of single sample tiles and cannot be used with --band, --heatmap, --animate, --edits,"
+             << " --wavefront, --aa or --instances" << endl;
+        return 1;
+    }
 
-                Point pixel = Point{static_cast<float>(x * 2.0 - w),static_cast<float>(y * 2.0 - h),0.0};
+    if (cluster != 0 && (!scene_path.empty() || !cache_directory.empty() || animate)) {
+        cerr << "--instances builds its own scene and cannot be used with --scene, --bvh-cache or --animate" << endl;
+        return 1;
+    }
 
-                Point focalPoint = Point{0.0,0.0,-focal};
-                Direction direction = pixel - focalPoint;
+    options.threads = threads;
+    if (output.empty()) {
+        output = format == ImageFormat::QOI ? "rtresult.qoi" : "rtresult.ppm";
+    }
 
-                Ray ray = Ray(pixel, direction.normalize());
+    int n = 10;
+    if (cluster != 0 && (cluster < 1 || (2 * n) % cluster != 0)) {
+        cerr << "Bad cluster size " << cluster << " (expected a divisor of " << 2 * n << ")" << endl;
+        return 1;
+    }
+    SceneDescription description;
+    if (scene_path.empty()) {
+        description = n_sphere_description(n); // One million sphere -> n = 50
+    } else {
+        try {
+            const auto begin = chrono::steady_clock::now();
+            description = load_scene(scene_path);
+            cout << scene_path << " loaded in " << chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() << " ms" << endl;
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+    if (light_count > 0) {
+        scatter_lights(description, light_count);
+    }
+    // Names the scene in the capture file, before the spheres go to the builder
+    const uint64_t capture_key = capture_path.empty() ? 0 : scene_key(description);
+    if (w == 0) {
+        w = description.width > 0 ? description.width : 1920;
+        h = description.height > 0 ? description.height : 1080;
+    }
+    const size_t sphere_count = description.spheres.size();
+    if (edits > 0 && (sphere_count == 0 || description.lights.empty())) {
+        cerr << "--edits moves spheres and changes a light, the scene needs at least one of each" << endl;
+        return 1;
+    }
+    Camera camera = Camera(w, h);
+    camera.focal = description.focal;
+    if (coordinator_port >= 0) {
+        // The workers build the hierarchy unless it is shipped to them
+        RenderJob job{w, h, camera.focal, width, quantize_bits, packets, cache_occluders, light_tree, 0, options, light_options};
+        try {
+            BuildStats stats;
+            optional<ObjectHierarchy> hierarchy;
+            if (ship_bvh) {
+                string cache_error;
+                hierarchy = cache_directory.empty() ? build_hierarchy(description.spheres, options, &stats)
+                                                    : build_hierarchy_cached(description.spheres, cache_directory, options, &stats, nullptr, &cache_error);
+                if (!cache_error.empty()) {
+                    cerr << "Warning : the BVH cache was not written, " << cache_error << endl;
+                }
+                cout << "BVH built in " << stats.build_ms << " ms (" << stats.nodes << " nodes), shipped to the workers" << endl;
+            }
+            const Socket listener = listen_socket(static_cast<uint16_t>(coordinator_port));
+            cout << "Waiting for " << worker_count << " workers on port " << listener.port() << endl;
+
+            vector<uint8_t> rgb(static_cast<size_t>(w) * h * 3);
+            const DistributedStats distributed = render_distributed(listener, worker_count, job, description.spheres, description.lights, rgb.data(),
+                                                                    hierarchy.has_value() ? &hierarchy.value() : nullptr, stats);
+            cout << "Workers ready in " << distributed.setup_ms << " ms, frame rendered in " << distributed.render_ms << " ms" << endl;
+            for (size_t k = 0; k < distributed.workers.size(); k++) {
+                const WorkerStats &worker = distributed.workers[k];
+                cout << "  Worker " << k << " : " << worker.threads << " threads, ready in " << worker.setup_ms << " ms, " << worker.tiles << " tiles in "
+                     << worker.ranges << " ranges" << (worker.lost ? ", lost" : "") << endl;
+            }
+            if (distributed.reassigned_tiles > 0) {
+                cout << distributed.reassigned_tiles << " tiles of lost workers rendered again" << endl;
+            }
 
-                if (optional<Intersection> it_m = intersectObjectHierarchy(S.root, ray); it_m.has_value()) {
-                    // Compute the distance in "scene"-space
-                    Color v = Color::black();
+            const auto begin = chrono::steady_clock::now();
+            AsyncImageWriter writer(make_image_writer(format, output, w, h), w);
+            writer.writeRows(std::move(rgb), h);
+            writer.finish();
+            cout << output << " written in " << chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() << " ms" << endl;
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
 
-                    for (auto l : S.lights) {
-                        Direction to_light = l.position - it_m.value().intersection;
-                        float light_distance = to_light.length_squared();
+    // Spheres in their input order, moved a little every frame by --animate
+    const vector<Sphere> rest = animate ? description.spheres : vector<Sphere>{};
+
+    BuildStats stats;
+    bool cached = false;
+    string cache_error;
+    optional<Scene> scene;
+    try {
+        scene.emplace(cluster > 0 ? n_sphere_instanced_scene(n, cluster, options, &stats)
+                      : cache_directory.empty()
+                          ? build_scene(std::move(description), options, &stats)
+                          : Scene(build_hierarchy_cached(std::move(description.spheres), cache_directory, options, &stats, &cached, &cache_error),
+                                  description.lights));
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    Scene &S = scene.value();
+    if (!cache_error.empty()) {
+        cerr << "Warning : the BVH cache was not written, " << cache_error << endl;
+    }
+    if (cluster > 0) {
+        S.lights = description.lights;
+        cout << S.instances.instances.size() << " instances of " << S.instances.uniqueSphereCount() << " spheres, "
+             << S.instances.sphereCount() << " spheres traced" << endl;
+    }
 
-                        Direction N = (it_m.value().intersection - it_m.value().sphere->center).normalize();
-                        float cos = to_light.normalize().dot(N);
+    cout << "BVH " << (cached ? "mapped from the cache" : "built") << " in " << stats.build_ms << " ms ("
+         << stats.nodes << " nodes, SAH cost " << stats.sah_cost << ")" << endl;
+    if (quantize_bits > 0) {
+        const int used = S.useQuantizedHierarchy(width, quantize_bits);
+        cout << "Traversing a " << used << " wide hierarchy with " << quantize_bits << " bit bounds" << endl;
+        if (!packets && !animate && edits == 0) {
+            // Only the quantized nodes and the spheres are read from now on
+            S.root.nodes = vector<HierarchyNode>{};
+            S.root.indices = vector<uint32_t>{};
+        }
+    } else if (width != 2) {
+        cout << "Traversing a " << S.useWideHierarchy(width) << " wide hierarchy" << endl;
+    }
+    if (memory) {
+        print_memory(S);
+    }
+    if (light_tree) {
+        S.useLightTree(light_options);
+        cout << "Shading at most " << S.light_tree.options.max_lights << " clusters of " << S.lights.size() << " lights per hit" << endl;
+    }
+    S.cache_occluders = cache_occluders;
+    cout << sphere_count << " Spheres in the scene, beginning ray tracing..." << endl;
+
+    TaskScheduler scheduler(threads);
+    vector<size_t> pixels(scheduler.threadCount());
+    vector<RayStats> ray_stats_per_thread(scheduler.threadCount());
+    vector<OccluderCacheStats> occluder_stats_per_thread(scheduler.threadCount());
+    unique_ptr<ImageWriter> image_writer;
+    try {
+        image_writer = make_image_writer(format, output, w, h);
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    AsyncImageWriter writer(std::move(image_writer), w);
+
+    if (preview_ms > 0.0) {
+        // The image written is the one shown after the first budget, the following budgets are only timed
+        vector<float> framebuffer(static_cast<size_t>(w) * h * 3);
+        ProgressiveOptions progressive_options;
+        progressive_options.budget_ms = preview_ms;
+        ProgressiveRenderer progressive(S, camera, framebuffer.data(), progressive_options);
+        const ProgressiveFrame preview = progressive.refine(scheduler, [&](const ProgressiveFrame &frame) {
+            cout << "  " << frame.pass << "/" << frame.pass_count << " passes : " << frame.step << "x" << frame.step << " blocks, "
+                 << 100.0 * static_cast<double>(frame.traced) / (static_cast<double>(w) * h) << "% of the pixels traced, " << frame.ms << " ms" << endl;
+        });
+        vector<uint8_t> rgb(framebuffer.size());
+        quantize(framebuffer.data(), static_cast<size_t>(w) * h, rgb.data());
+        writer.writeRows(std::move(rgb), h);
+
+        int budgets = 1;
+        while (!progressive.complete()) {
+            progressive.refine(scheduler);
+            budgets++;
+        }
+        try {
+            writer.finish();
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        cout << "Preview of " << preview.step << "x" << preview.step << " blocks written to " << output << ", full quality after " << budgets
+             << " budgets of " << preview_ms << " ms" << endl;
+        return 0;
+    }
 
-                        Color light_contribution = (it_m.value().sphere->albedo * (cos / light_distance)) * l.intensity;
+    vector<AntialiasStats> antialias_per_thread(scheduler.threadCount());
+    vector<float> base;
+
+    // Rays of the first frame, tile after tile, written as soon as the tiles before are
+    optional<RayCaptureWriter> capture;
+    vector<CapturedRays> tile_rays;
+    vector<bool> tile_captured;
+    size_t next_written = 0;
+    mutex capture_mutex;
+    if (!capture_path.empty()) {
+        try {
+            capture.emplace(capture_path, capture_key, w, h);
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        ray_capture_enabled = true;
+    }
 
-                        v = v + light_contribution * visibility(S, l, it_m.value().intersection);
-                    }
-                    v.cap();
-                    buffer[i][j][0] = v.red;
-                    buffer[i][j][1] = v.green;
-                    buffer[i][j][2] = v.blue;
-                    //write_color(&fileOut, v);
+    const auto render = [&](const vector<Tile> &tiles, float * framebuffer, const int first_row, const int last_row, float * cost) {
+        const bool capturing = ray_capture_enabled;
+        tile_rays.assign(capturing ? tiles.size() : 0, {});
+        tile_captured.assign(tile_rays.size(), false);
+        next_written = 0;
+        scheduler.run(tiles.size(), [&](const size_t t, const unsigned worker) {
+            render_tile(S, camera, tiles[t], framebuffer, packets, first_row, cost);
+            pixels[worker] += tiles[t].pixels();
+            ray_stats_per_thread[worker] += take_ray_stats();
+            occluder_stats_per_thread[worker] += take_occluder_stats();
+            if (capturing) {
+                lock_guard lock(capture_mutex);
+                tile_rays[t] = take_captured_rays();
+                tile_captured[t] = true;
+                for (; next_written < tiles.size() && tile_captured[next_written]; next_written++) {
+                    capture->write(exchange(tile_rays[next_written], {}));
                 }
-                else {
-                    buffer[i][j][0] = 40.0f;
-                    buffer[i][j][1] = 40.0f;
-                    buffer[i][j][2] = 40.0f;
+            }
+        });
+        if (antialias.max_samples > 1) {
+            // Second pass once every base sample is known, reading them from a copy while the framebuffer is refined
+            base.assign(framebuffer, framebuffer + static_cast<size_t>(w) * (last_row - first_row) * 3);
+            scheduler.run(tiles.size(), [&](const size_t t, const unsigned worker) {
+                antialias_per_thread[worker] += refine_tile(S, camera, tiles[t], base.data(), framebuffer, antialias, first_row, last_row, cost);
+                ray_stats_per_thread[worker] += take_ray_stats();
+                occluder_stats_per_thread[worker] += take_occluder_stats();
+            });
+        }
+    };
+
+    const auto begin = chrono::steady_clock::now();
+    double elapsed_ms;
+    int frames = 1;
+    vector<float> cost(heatmap ? static_cast<size_t>(w) * h : 0);
+
+    if (band == 0) {
+        // Whole frame in memory, rendered several times to time it
+        const vector<Tile> tiles = make_tiles(w, h);
+        vector<float> framebuffer(static_cast<size_t>(w) * h * 3);
+        cout << "Rendering " << tiles.size() << " tiles on " << scheduler.threadCount() << " threads" << endl;
+
+        RefitOptions refit_options;
+        refit_options.threads = threads;
+        optional<HierarchyRefitter> refitter;
+        if (animate) {
+            refitter.emplace(S.root, options, refit_options);
+        }
+        vector<Sphere> moving = rest;
+        double refit_ms = 0.0;
+        size_t rebuilt_subtrees = 0;
+        int full_rebuilds = 0;
+        WavefrontStats wavefront_stats;
+
+        frames = 10;
+        for (int a = 0; a < frames; a++) {
+            if (animate) {
+                // Every sphere bobs up and down by twice its radius, out of phase with its neighbours
+                const auto refit_begin = chrono::steady_clock::now();
+                for (size_t i = 0; i < moving.size(); i++) {
+                    moving[i].center.y = rest[i].center.y + 2.0f * rest[i].radius * sin(0.5f * static_cast<float>(a + 1) + 0.7f * static_cast<float>(i));
                 }
+                const RefitStats refit_stats = refitter->refit(moving);
+                S.updateWideHierarchy();
+                refit_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - refit_begin).count();
+                rebuilt_subtrees += refit_stats.rebuilt_subtrees;
+                full_rebuilds += refit_stats.full_rebuild;
             }
+            if (wavefront) {
+                wavefront_stats += WavefrontRenderer(S, camera, wavefront_options).render(scheduler, framebuffer.data());
+            } else {
+                render(tiles, framebuffer.data(), 0, h, heatmap ? cost.data() : nullptr);
+                ray_capture_enabled = false;
+            }
+        }
+        elapsed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        cout << "Mean Time elapsed in ms: " << elapsed_ms / frames << std::endl;
+        if (animate) {
+            cout << "Mean refit in ms: " << refit_ms / frames << " (against " << stats.build_ms << " ms for the first build), "
+                 << rebuilt_subtrees << " subtrees and " << full_rebuilds << " whole trees rebuilt, SAH cost "
+                 << sah_cost(S.root, options.traversal_cost, options.intersection_cost) << endl;
+        }
+        if (wavefront) {
+            cout << "Wavefront : " << wavefront_options.bounces << " bounces, " << wavefront_options.samples << " paths per pixel, "
+                 << (wavefront_options.sort ? "sorted" : "unsorted") << " queues, " << wavefront_stats.mraysPerSecond() << " Mrays/s" << endl;
+            cout << "  Per frame : " << wavefront_stats.primary_rays / frames << " primary, " << wavefront_stats.bounce_rays / frames
+                 << " bounce and " << wavefront_stats.shadow_rays / frames << " shadow rays" << endl;
+            cout << "  Mean stage in ms : generate " << wavefront_stats.generate_ms / frames << ", sort " << wavefront_stats.sort_ms / frames
+                 << ", extend " << wavefront_stats.extend_ms / frames << ", shade " << wavefront_stats.shade_ms / frames << ", shadow "
+                 << wavefront_stats.shadow_ms / frames << endl;
+        }
+        if (edits > 0) {
+            // Look-dev session : one sphere moved at a time, then one light changed, only the tiles they change are traced again
+            IncrementalRenderer incremental(S, camera, tiles, framebuffer.data());
+            const IncrementalRenderer::UpdateStats recorded = incremental.update(scheduler);
+            cout << "Frame recorded in " << recorded.ms << " ms over " << incremental.regionCount() << " regions" << endl;
+
+            double edit_ms = 0.0;
+            size_t dirty_tiles = 0;
+            for (int e = 0; e < edits; e++) {
+                const auto index = static_cast<uint32_t>((static_cast<size_t>(e) * 7919 + 13) % sphere_count);
+                Sphere sphere = incremental.sphere(index);
+                sphere.center.x += 2.0f * sphere.radius;
+                const auto edit_begin = chrono::steady_clock::now();
+                incremental.setSphere(index, sphere);
+                dirty_tiles += incremental.update(scheduler).dirty_tiles;
+                edit_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - edit_begin).count();
+            }
+            cout << "Mean sphere edit in ms: " << edit_ms / edits << ", " << static_cast<double>(dirty_tiles) / edits << " of " << tiles.size()
+                 << " tiles traced again" << endl;
+
+            Light light = S.lights[0];
+            light.intensity *= 1.5f;
+            incremental.setLight(0, light);
+            const IncrementalRenderer::UpdateStats light_edit = incremental.update(scheduler);
+            cout << "Light edit in ms: " << light_edit.ms << ", " << light_edit.dirty_tiles << " of " << tiles.size() << " tiles traced again" << endl;
+        }
+
+        vector<uint8_t> rgb(framebuffer.size());
+        quantize(framebuffer.data(), static_cast<size_t>(w) * h, rgb.data());
+        writer.writeRows(std::move(rgb), h);
+    } else {
+        // Streaming : only band rows of floats exist, the writer encodes a band while the next one renders
+        vector<float> framebuffer(static_cast<size_t>(w) * band * 3);
+        cout << "Rendering " << (h + band - 1) / band << " bands of " << band << " rows on " << scheduler.threadCount() << " threads" << endl;
+
+        for (int row = 0; row < h; row += band) {
+            const int last_row = min(row + band, h);
+            render(make_tiles(w, h, TILE_SIZE, row, last_row), framebuffer.data(), row, last_row, nullptr);
+
+            vector<uint8_t> rgb(static_cast<size_t>(w) * (last_row - row) * 3);
+            quantize(framebuffer.data(), static_cast<size_t>(w) * (last_row - row), rgb.data());
+            writer.writeRows(std::move(rgb), last_row - row);
+        }
+        elapsed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+        cout << "Time elapsed in ms: " << elapsed_ms << std::endl;
+    }
+
+    // Wavefront tasks are queue chunks rather than tiles
+    for (unsigned t = 0; t < scheduler.threadCount() && !wavefront; t++) {
+        const ThreadStats &thread_stats = scheduler.stats()[t];
+        cout << "  Thread " << t << " : " << thread_stats.tasks << " tiles (" << thread_stats.stolen << " stolen), "
+             << static_cast<double>(pixels[t]) / thread_stats.busy_ms / 1000.0 << " Mpixels/s" << endl;
+    }
+
+    if (antialias.max_samples > 1) {
+        AntialiasStats total;
+        for (const AntialiasStats &thread_stats : antialias_per_thread) {
+            total += thread_stats;
         }
+        cout << "Antialiasing : " << 100.0 * static_cast<double>(total.refined) / static_cast<double>(max<uint64_t>(1, total.pixels))
+             << "% of the pixels refined, " << total.samplesPerPixel() << " samples per pixel (up to " << antialias.max_samples << ")" << endl;
     }
-    clock_t end = clock();
 
-    cout << "Mean Time elapsed in ms: " << (end - begin) * 1000.0 / CLOCKS_PER_SEC / 10 << std::endl;
+    if (cache_occluders) {
+        OccluderCacheStats total;
+        for (const OccluderCacheStats &thread_stats : occluder_stats_per_thread) {
+            total += thread_stats;
+        }
+        cout << "Occluder cache : " << total.lookups / frames << " shadow rays per frame, " << 100.0 * total.hitRate()
+             << "% blocked by the last occluder (" << total.hits / frames << " hits, " << total.misses / frames << " misses)" << endl;
+    }
 
-    for (auto & i : buffer) {
-        for (auto & j : i) {
-            write_color(&fileOut, j);
+    if (ray_stats_enabled) {
+        RayStats total;
+        for (const RayStats &thread_stats : ray_stats_per_thread) {
+            total += thread_stats;
         }
+        cout << "Traversal statistics :" << endl;
+        print_counters("Primary rays", total.primary, frames);
+        print_counters("Shadow rays", total.shadow, frames);
     }
 
-    fileOut.close();
+    if (heatmap) {
+        // Next to the image, same name with a _heatmap suffix
+        const string heatmap_path = filesystem::path(output).replace_extension().string() + "_heatmap.ppm";
+        vector<uint8_t> rgb(cost.size() * 3);
+        quantize_heatmap(cost.data(), cost.size(), rgb.data());
+        PPMBinaryWriter heatmap_writer(heatmap_path, w, h);
+        heatmap_writer.writeRows(rgb.data(), h);
+        heatmap_writer.finish();
+        cout << "Traversal cost heatmap written to " << heatmap_path << endl;
+    }
+
+    if (capture.has_value()) {
+        capture->finish();
+        cout << capture->counts().primary_count << " primary and " << capture->counts().shadow_count << " shadow rays captured to " << capture_path << endl;
+    }
+
+    try {
+        writer.finish();
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    cout << output << " written " << chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() - elapsed_ms
+         << " ms after the end of the rendering" << endl;
 }
@@ -0,0 +1,150 @@
+// Ray replay : traces the rays captured by ray_tracer --capture through the traversal kernels alone, and reports their
+// speed and whether they give the captured answers.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "builder.h"
+#include "packet.h"
+#include "ray_capture.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "scenes.h"
+#include "scheduler.h"
+
+using namespace std;
+
+void print_replay(const string &name, vector<ReplayStats> runs) {
+    if (runs.empty() || runs[0].rays == 0) {
+        cout << "  " << name << " : no rays" << endl;
+        return;
+    }
+    sort(runs.begin(), runs.end(), [](const ReplayStats &a, const ReplayStats &b) { return a.ms < b.ms; });
+    const ReplayStats &median = runs[runs.size() / 2];
+    cout << "  " << name << " : " << runs[0].rays << " rays, " << runs[0].mraysPerSecond() << " Mrays/s best, " << median.mraysPerSecond()
+         << " Mrays/s median, " << 100.0 * runs[0].agreement() << "% agreement (" << runs[0].rays - runs[0].agreeing << " rays differ)" << endl;
+}
+
+int main(int argc, char * argv[]) {
+    string capture_path;
+    string scene_path;
+    BuildOptions options;
+    int width = 2;
+    int quantize_bits = 0;
+    bool packets = false;
+    unsigned threads = 1; // One thread by default, the most stable timing
+    int repeat = 5;
+    int light_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (const string arg = argv[i]; arg == "--scene" && i + 1 < argc) {
+            scene_path = argv[++i];
+        } else if (arg == "--lights" && i + 1 < argc) {
+            light_count = max(1, stoi(argv[++i]));
+        } else if (arg == "--builder" && i + 1 < argc) {
+            const string method = argv[++i];
+            if (method != "median" && method != "sah" && method != "lbvh") {
+                cerr << "Unknown builder " << method << " (expected median, sah or lbvh)" << endl;
+                return 1;
+            }
+            options.method = method == "median" ? BuildMethod::Median : method == "sah" ? BuildMethod::SAH : BuildMethod::Linear;
+        } else if (arg == "--treelets" && i + 1 < argc) {
+            options.treelet_passes = max(0, stoi(argv[++i]));
+        } else if (arg == "--width" && i + 1 < argc) {
+            width = stoi(argv[++i]);
+        } else if (arg == "--quantize" && i + 1 < argc) {
+            quantize_bits = stoi(argv[++i]);
+            if (quantize_bits != 8 && quantize_bits != 16) {
+                cerr << "Bad quantization " << quantize_bits << " (expected 8 or 16 bits)" << endl;
+                return 1;
+            }
+        } else if (arg == "--packets") {
+            packets = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(max(1, stoi(argv[++i])));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = max(1, stoi(argv[++i]));
+        } else if (capture_path.empty() && !arg.starts_with("--")) {
+            capture_path = arg;
+        } else {
+            capture_path.clear();
+            break;
+        }
+    }
+    if (capture_path.empty()) {
+        cerr << "Usage : " << argv[0] << " <capture> [--scene file] [--lights n] [--builder median|sah|lbvh] [--treelets passes] [--width 2|4|8]"
+             << " [--quantize 8|16] [--packets] [--threads n] [--repeat n]" << endl
+             << "The scene options must match the ones the rays were captured with, the traversal ones are free." << endl;
+        return 1;
+    }
+
+    try {
+        const RayCapture capture = load_ray_capture(capture_path);
+        SceneDescription description = scene_path.empty() ? n_sphere_description(10) : load_scene(scene_path);
+        if (light_count > 0) {
+            scatter_lights(description, light_count);
+        }
+        if (scene_key(description) != capture.header.scene_key) {
+            throw runtime_error(capture_path + " was captured in another scene");
+        }
+        cout << capture.rays.primary.size() << " primary and " << capture.rays.shadow.size() << " shadow rays of a "
+             << capture.header.width << "x" << capture.header.height << " frame" << endl;
+
+        options.threads = max(1u, thread::hardware_concurrency());
+        BuildStats stats;
+        Scene S = build_scene(std::move(description), options, &stats);
+        cout << "BVH built in " << stats.build_ms << " ms (" << build_method_name(options.method) << ", SAH cost " << stats.sah_cost << ")" << endl;
+        if (quantize_bits > 0) {
+            cout << "Traversing a " << S.useQuantizedHierarchy(width, quantize_bits) << " wide hierarchy with " << quantize_bits << " bit bounds" << endl;
+        } else if (width != 2) {
+            cout << "Traversing a " << S.useWideHierarchy(width) << " wide hierarchy" << endl;
+        }
+
+        TaskScheduler scheduler(threads);
+        const auto primary = [&](const CapturedRay * rays, const size_t count, float * results) {
+            if (packets) {
+                vector<Ray> packet;
+                optional<Intersection> hits[PACKET_SIZE];
+                for (size_t first = 0; first < count; first += PACKET_SIZE) {
+                    const size_t size = min<size_t>(PACKET_SIZE, count - first);
+                    packet.clear();
+                    for (size_t r = 0; r < size; r++) {
+                        packet.push_back(rays[first + r].ray());
+                    }
+                    intersect_packet(S, packet.data(), static_cast<int>(size), hits);
+                    for (size_t r = 0; r < size; r++) {
+                        results[first + r] = hits[r].has_value() ? hits[r]->t : INFINITY;
+                    }
+                }
+                return;
+            }
+            for (size_t r = 0; r < count; r++) {
+                const optional<Intersection> hit = intersect(S, rays[r].ray());
+                results[r] = hit.has_value() ? hit->t : INFINITY;
+            }
+        };
+        const auto shadow = [&](const CapturedRay * rays, const size_t count, float * results) {
+            for (size_t r = 0; r < count; r++) {
+                results[r] = occluded(S, rays[r].ray(), rays[r].tmax) ? 1.0f : 0.0f;
+            }
+        };
+
+        // A first untimed run warms the caches
+        replay_rays(scheduler, capture.rays.primary, RayKind::Primary, primary);
+        vector<ReplayStats> primary_runs;
+        vector<ReplayStats> shadow_runs;
+        for (int r = 0; r < repeat; r++) {
+            primary_runs.push_back(replay_rays(scheduler, capture.rays.primary, RayKind::Primary, primary));
+            shadow_runs.push_back(replay_rays(scheduler, capture.rays.shadow, RayKind::Shadow, shadow));
+        }
+        cout << "Replayed " << repeat << " times on " << scheduler.threadCount() << " threads :" << endl;
+        print_replay(packets ? "Primary rays (packets)" : "Primary rays", primary_runs);
+        print_replay("Shadow rays", shadow_runs);
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
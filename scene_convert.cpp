@@ -0,0 +1,50 @@
+// Scene converter : text scenes to the binary format loaded by ray_tracer --scene, and back.
+//
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "scene_file.h"
+#include "scenes.h"
+
+using namespace std;
+
+// Binary unless the output name ends in .txt
+bool is_text_path(const string &path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".txt") == 0;
+}
+
+int main(int argc, char * argv[]) {
+    if (argc != 3 && !(argc == 4 && string(argv[1]) == "--cube")) {
+        cerr << "Usage : " << argv[0] << " <input scene> <output scene>" << endl
+             << "        " << argv[0] << " --cube n <output scene>   (the 8 * n^3 spheres benchmark scene)" << endl
+             << "Either file can be text or binary, an output ending in .txt is written as text." << endl;
+        return 1;
+    }
+
+    try {
+        const auto begin = chrono::steady_clock::now();
+        const SceneDescription scene = argc == 4 ? n_sphere_description(stoi(argv[2])) : load_scene(argv[1]);
+        const auto loaded = chrono::steady_clock::now();
+
+        const string output = argv[argc - 1];
+        if (is_text_path(output)) {
+            ofstream out(output);
+            write_scene_text(out, scene);
+            if (!out) {
+                throw runtime_error("Cannot write " + output);
+            }
+        } else {
+            save_scene_file(output, scene);
+        }
+
+        cout << scene.spheres.size() << " spheres and " << scene.lights.size() << " lights read in "
+             << chrono::duration<double, milli>(loaded - begin).count() << " ms, " << output << " written in "
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - loaded).count() << " ms" << endl;
+    } catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}